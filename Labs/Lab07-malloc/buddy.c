@@ -0,0 +1,406 @@
+/*
+ * buddy.c - binary buddy allocator, a second backend for mdriver (-A buddy)
+ *
+ * The heap is a row of roots, blocks of 2^top bytes. A block of order k
+ * can be split into two halves of order k-1, the buddies of each other,
+ * down to blocks of 2^MIN_ORDER bytes, and two free buddies merge back
+ * into their parent. A request takes a block of the smallest order that holds it, so
+ * blocks carry no header, and up to half of each block is wasted.
+ *
+ * Each block is a node of one binary tree over the 2^MAX_ORDER bytes
+ * from the start of the heap, numbered top-down and left to right, so
+ * that the node of the block of order k at offset off is
+ * NODE(k, off). Two bitmaps hold one bit per node: free_map marks the
+ * blocks on a free list, split_map the blocks split into their halves.
+ * The free blocks of each order are also on a doubly-linked list through
+ * their first two words, and bit k of nonempty is set iff list k is not
+ * empty, so one count-trailing-zeros finds the smallest free block that
+ * fits. Splitting it down to the order asked for, and merging a freed
+ * block with its buddy for as long as free_map says the buddy is free,
+ * each take O(log n) steps. buddy_free() finds the order of a block by
+ * walking up from the smallest order until the parent is split.
+ *
+ * When no free block is large enough the heap grows. While it is a
+ * single root smaller than 2^ROOT_ORDER bytes it doubles: mem_sbrk()
+ * adds a free block of order top right after it, the buddy of the whole
+ * heap, and top grows by one. After that mem_sbrk() adds one more root
+ * at a time, so that a large heap grows by 2^ROOT_ORDER bytes and not
+ * by as much as it already has. Requests of MAP_THRESHOLD bytes and more
+ * get a memlib mapping of their own, as in mm.c, whose size and start
+ * are kept in a header in front of the payload. buddy_realloc() keeps a
+ * block where it is when the order stays the same, splits off the upper
+ * halves when it shrinks, and absorbs the buddies to its right when they
+ * are all free.
+ *
+ * A block of order k starts at a multiple of 2^k from the heap, which
+ * starts on a page, so buddy_memalign() need only ask for a block of
+ * at least align bytes; larger alignments are placed inside a mapping.
+ * buddy_calloc() clears what lies below mem_heap_zero(), and above it
+ * only the words where grow_heap() left the links of free blocks; the
+ * rest of that memory has never been used.
+ *
+ * Like mm.c's run_map, the bitmaps are static arrays sized for the
+ * largest heap, which buddy_init() only clears as far as the heap grew.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "memlib.h"
+#include "buddy.h"
+
+#define MIN_ORDER 4   // smallest block, 16 bytes: room for the two free-list links
+#define INIT_ORDER 12 // the heap starts as one free block of 4 KB
+#define ROOT_ORDER 20 // and doubles up to 1 MB, then grows by a root of 1 MB at a time
+#define MAX_ORDER 26  // up to 64 MB
+#define MAP_THRESHOLD (128*1024) // requests this large get a mapping, as in mm.c
+#define MAP_HDR 16               // in front of a mapped payload: its size and the mapping's start
+
+#define BITS (8 * sizeof(unsigned long))
+#define NODES (1UL << (MAX_ORDER - MIN_ORDER + 1)) // one more than the tree has
+
+// node of the block of order k at offset off from the start of the heap
+#define NODE(k, off) ((1UL << (MAX_ORDER - (k))) - 1 + ((off) >> (k)))
+#define BIT_GET(map, n) (((map)[(n) / BITS] >> ((n) % BITS)) & 1)
+#define BIT_SET(map, n) ((map)[(n) / BITS] |= 1UL << ((n) % BITS))
+#define BIT_CLR(map, n) ((map)[(n) / BITS] &= ~(1UL << ((n) % BITS)))
+
+// whether ptr was handed out from a mapping rather than the heap
+#define IS_MAPPED(ptr) ((char *)(ptr) < base || (char *)(ptr) >= base + heap_len)
+#define MAP_SIZE(ptr) (((size_t *) (ptr))[-2])
+#define MAP_BASE(ptr) (((char **) (ptr))[-1])
+
+// links of a free block, in its first two words
+typedef struct free_block {
+    struct free_block *prev, *next;
+} free_block_t;
+
+static char *base;      // start of the heap
+static size_t heap_len; // bytes in the heap, a multiple of 2^top
+static int top;         // order of the roots, the largest blocks
+static size_t heap_hi;  // largest heap_len since buddy_init(), as far as the bitmaps are used
+static free_block_t *free_lists[MAX_ORDER + 1];
+static unsigned int nonempty; // bit k is set iff free_lists[k] is not empty
+static unsigned long free_map[NODES / BITS];  // node is a free block
+static unsigned long split_map[NODES / BITS]; // node is split into its halves
+
+static int size_order(size_t size);
+static int block_order(size_t off);
+static void push_block(int k, size_t off);
+static void unlink_block(int k, size_t off);
+static void release_block(int k, size_t off);
+static int grow_heap(int k);
+static void clear_map(unsigned long *map);
+static void *map_block(size_t size, size_t align);
+
+/*
+ * buddy_init - start over with a heap of one free root of 2^INIT_ORDER bytes
+ */
+int buddy_init(void)
+{
+    // the heap itself was set up by mem_init(), and is reset by mem_reset_brk()
+    clear_map(free_map);
+    clear_map(split_map);
+    memset(free_lists, 0, sizeof(free_lists));
+    nonempty = 0;
+    if ((base = mem_sbrk(1 << INIT_ORDER)) == (void *) -1) {
+        return -1;
+    }
+    heap_len = heap_hi = 1UL << INIT_ORDER;
+    top = INIT_ORDER;
+    push_block(top, 0);
+    return 0;
+}
+
+/*
+ * buddy_malloc - split the smallest free block that holds size bytes
+ *     down to the smallest order that does
+ */
+void *buddy_malloc(size_t size)
+{
+    free_block_t *b;
+    size_t off;
+    int k, j;
+
+    if (size == 0) {
+        return NULL;
+    }
+    if (size >= MAP_THRESHOLD) {
+        return map_block(size, MAP_HDR);
+    }
+    k = size_order(size);
+    if ((nonempty >> k) == 0 && grow_heap(k) < 0) {
+        return NULL;
+    }
+    j = k + __builtin_ctz(nonempty >> k);
+    b = free_lists[j];
+    off = (char *) b - base;
+    unlink_block(j, off);
+    while (j > k) {
+        BIT_SET(split_map, NODE(j, off));
+        j--;
+        push_block(j, off + (1UL << j));
+    }
+    return b;
+}
+
+/*
+ * buddy_free - give a block back, merging it with its buddy while that is free
+ */
+void buddy_free(void *ptr)
+{
+    size_t off;
+
+    if (ptr == NULL) {
+        return;
+    }
+    if (IS_MAPPED(ptr)) {
+        mem_unmap(MAP_BASE(ptr));
+        return;
+    }
+    off = (char *) ptr - base;
+    release_block(block_order(off), off);
+}
+
+/*
+ * buddy_realloc - resize in place if the block can keep its order, shrink
+ *     or grow to the new one, otherwise move it
+ */
+void *buddy_realloc(void *ptr, size_t size)
+{
+    char *newp;
+    size_t off, old_size;
+    int k, want, j;
+
+    if (ptr == NULL) {
+        return buddy_malloc(size);
+    }
+    if (size == 0) {
+        buddy_free(ptr);
+        return NULL;
+    }
+    if (IS_MAPPED(ptr)) {
+        old_size = MAP_SIZE(ptr);
+        if (size >= MAP_THRESHOLD) {
+            // the payload keeps its offset in the mapping, and so its alignment
+            off = (char *) ptr - MAP_BASE(ptr);
+            if ((newp = mem_remap(MAP_BASE(ptr), off + size)) == NULL) {
+                return NULL;
+            }
+            newp += off;
+            MAP_SIZE(newp) = size;
+            MAP_BASE(newp) = newp - off;
+            return newp;
+        }
+    } else {
+        off = (char *) ptr - base;
+        k = block_order(off);
+        old_size = 1UL << k;
+        if (size < MAP_THRESHOLD) {
+            want = size_order(size);
+            // shrink: the upper halves split off are free, their buddies are not
+            if (want <= k) {
+                while (k > want) {
+                    BIT_SET(split_map, NODE(k, off));
+                    k--;
+                    push_block(k, off + (1UL << k));
+                }
+                return ptr;
+            }
+            // grow: the block must be a left half each time, and its buddy free
+            for (j = k; j < want; j++) {
+                if (j == top || (off & (1UL << j)) || !BIT_GET(free_map, NODE(j, off + (1UL << j)))) {
+                    break;
+                }
+            }
+            if (j == want) {
+                for (j = k; j < want; j++) {
+                    unlink_block(j, off + (1UL << j));
+                    BIT_CLR(split_map, NODE(j + 1, off));
+                }
+                return ptr;
+            }
+        }
+    }
+    if ((newp = buddy_malloc(size)) == NULL) {
+        return NULL;
+    }
+    memcpy(newp, ptr, old_size < size ? old_size : size);
+    buddy_free(ptr);
+    return newp;
+}
+
+/*
+ * buddy_memalign - allocate size bytes at a multiple of align, a power
+ *     of two: a block of align bytes or more is aligned that much already
+ */
+void *buddy_memalign(size_t align, size_t size)
+{
+    if (align == 0 || (align & (align - 1)) != 0 || size == 0) {
+        return NULL;
+    }
+    if (align > mem_heap_pagesize() || align >= MAP_THRESHOLD || size >= MAP_THRESHOLD) {
+        return map_block(size, align);
+    }
+    return buddy_malloc(size < align ? align : size);
+}
+
+/*
+ * buddy_calloc - allocate nmemb elements of size bytes each, cleared to zero
+ */
+void *buddy_calloc(size_t nmemb, size_t size)
+{
+    char *zero = mem_heap_zero(); // before the heap grows for this block
+    char *ptr;
+    size_t off, end;
+
+    if (size != 0 && nmemb > (size_t) -1 / size) {
+        return NULL;
+    }
+    size *= nmemb;
+    if ((ptr = buddy_malloc(size)) == NULL || IS_MAPPED(ptr)) {
+        return ptr; // mappings are fresh pages
+    }
+    if (zero >= ptr + size) {
+        memset(ptr, 0, size);
+        return ptr;
+    }
+    // above zero only the links of the free blocks that grow_heap() added
+    // were written, each at a multiple of 2^INIT_ORDER, and those of ptr
+    off = ptr - base;
+    end = off + size;
+    if (zero > ptr) {
+        memset(ptr, 0, zero - ptr);
+        off = zero - base;
+    }
+    memset(ptr, 0, size < sizeof(free_block_t) ? size : sizeof(free_block_t));
+    for (off = (off + (1UL << INIT_ORDER) - 1) & ~((1UL << INIT_ORDER) - 1); off < end; off += 1UL << INIT_ORDER) {
+        memset(base + off, 0, end - off < sizeof(free_block_t) ? end - off : sizeof(free_block_t));
+    }
+    return ptr;
+}
+
+// smallest order of a block that holds size bytes
+static int size_order(size_t size)
+{
+    if (size <= (1UL << MIN_ORDER)) {
+        return MIN_ORDER;
+    }
+    return BITS - __builtin_clzl(size - 1);
+}
+
+// order of the allocated block at offset off: the parent of a block is
+// split, the parents of the nodes inside it are not
+static int block_order(size_t off)
+{
+    int k = MIN_ORDER;
+
+    while (k < top && !BIT_GET(split_map, NODE(k + 1, off))) {
+        k++;
+    }
+    return k;
+}
+
+// put the block of order k at offset off on the front of its free list
+static void push_block(int k, size_t off)
+{
+    free_block_t *b = (free_block_t *) (base + off);
+
+    b->prev = NULL;
+    b->next = free_lists[k];
+    if (b->next != NULL) {
+        b->next->prev = b;
+    }
+    free_lists[k] = b;
+    nonempty |= 1U << k;
+    BIT_SET(free_map, NODE(k, off));
+}
+
+// take the free block of order k at offset off off its free list
+static void unlink_block(int k, size_t off)
+{
+    free_block_t *b = (free_block_t *) (base + off);
+
+    if (b->prev != NULL) {
+        b->prev->next = b->next;
+    } else if ((free_lists[k] = b->next) == NULL) {
+        nonempty &= ~(1U << k);
+    }
+    if (b->next != NULL) {
+        b->next->prev = b->prev;
+    }
+    BIT_CLR(free_map, NODE(k, off));
+}
+
+// free the block of order k at offset off, merging it with its buddy, and
+// the parent they make with its own, for as long as the buddy is free
+static void release_block(int k, size_t off)
+{
+    size_t buddy;
+
+    while (k < top) {
+        buddy = off ^ (1UL << k);
+        if (!BIT_GET(free_map, NODE(k, buddy))) {
+            break;
+        }
+        unlink_block(k, buddy);
+        off &= ~(1UL << k);
+        k++;
+        BIT_CLR(split_map, NODE(k, off));
+    }
+    push_block(k, off);
+}
+
+// grow the heap until it has a free block of order k or more, returns
+// -1 if the heap cannot grow that far
+static int grow_heap(int k)
+{
+    while ((nonempty >> k) == 0) {
+        if (heap_len + (1UL << top) > (1UL << MAX_ORDER) ||
+            mem_sbrk(1 << top) == (void *) -1) {
+            return -1;
+        }
+        if (top < ROOT_ORDER) {
+            // the new block is the buddy of the old heap, their parent the new root
+            heap_len <<= 1;
+            top++;
+            BIT_SET(split_map, NODE(top, 0));
+            release_block(top - 1, heap_len >> 1);
+        } else {
+            release_block(top, heap_len);
+            heap_len += 1UL << top;
+        }
+        if (heap_len > heap_hi) {
+            heap_hi = heap_len;
+        }
+    }
+    return 0;
+}
+
+// clear the bits of every order that the heap has used since buddy_init()
+static void clear_map(unsigned long *map)
+{
+    size_t lo, hi;
+    int k;
+
+    for (k = MIN_ORDER; k <= MAX_ORDER && (heap_hi >> k) > 0; k++) {
+        lo = NODE(k, 0) / BITS;
+        hi = NODE(k, heap_hi) / BITS;
+        memset(map + lo, 0, (hi - lo + 1) * sizeof(unsigned long));
+    }
+}
+
+// give a request of size bytes a mapping of its own, its payload at a
+// multiple of align behind the header
+static void *map_block(size_t size, size_t align)
+{
+    size_t pad = (align > MAP_HDR) ? align : 0; // mappings start on a page, not at a multiple of align
+    char *p, *ptr;
+
+    if ((p = mem_map(MAP_HDR + pad + size)) == NULL) {
+        return NULL;
+    }
+    ptr = (char *) (((unsigned long) p + MAP_HDR + align - 1) & ~(unsigned long) (align - 1));
+    MAP_SIZE(ptr) = size;
+    MAP_BASE(ptr) = p;
+    return ptr;
+}
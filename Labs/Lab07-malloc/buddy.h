@@ -0,0 +1,17 @@
+#ifndef __BUDDY_H_
+#define __BUDDY_H_
+
+/*
+ * buddy.h - Binary buddy allocator on memlib, see buddy.c. It has the
+ *     interface of mm.h, so mdriver can evaluate it side by side (-A).
+ */
+#include <stddef.h>
+
+extern int buddy_init(void);
+extern void *buddy_malloc(size_t size);
+extern void buddy_free(void *ptr);
+extern void *buddy_realloc(void *ptr, size_t size);
+extern void *buddy_memalign(size_t align, size_t size);
+extern void *buddy_calloc(size_t nmemb, size_t size);
+
+#endif /* __BUDDY_H_ */
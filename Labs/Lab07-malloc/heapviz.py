@@ -0,0 +1,163 @@
+#!/usr/bin/python3
+
+"""
+heapviz.py - render the heap snapshots of "mdriver -s" as pictures
+
+For every trace in the log, writes <prefix>-<trace>.svg with two panels:
+
+  - a time series of the heap size, the bytes in allocated blocks, the
+    bytes the trace has asked for, the free bytes and the largest free
+    block, against the request number
+  - an address-space map, one row per snapshot from top to bottom, the
+    heap from left to right: allocated blocks blue, slab runs orange,
+    free blocks white
+
+and prints where the memory goes when the trace has the most bytes
+requested: payload the trace asked for, internal fragmentation (headers,
+padding, free slab objects, blocks with mappings of their own), external
+fragmentation (free blocks) and the free lists.
+
+usage: heapviz.py [--width px] [--rows n] <heap.log> <prefix>
+"""
+
+import argparse
+import os
+
+COLORS = {"a": "#4a7ab5", "s": "#e8963a", "f": "#ffffff"}
+SERIES = [("heap", "heap", "#000000"), ("alloc", "allocated blocks", "#4a7ab5"),
+          ("requested", "requested", "#2e9e4a"), ("free", "free", "#c23b3b"),
+          ("largest", "largest free", "#9a5fc0")]
+
+
+def read_log(path):
+    traces = []
+    with open(path) as f:
+        for line in f:
+            words = line.split()
+            if words[0] == "trace":
+                traces.append((words[1], []))
+            elif words[0] == "op":
+                snap = {"op": int(words[1]), "requested": int(words[2])}
+                traces[-1][1].append(snap)
+            elif words[0] == "heap":
+                (snap["heap"], snap["alloc"], snap["free"], snap["largest"],
+                 snap["nfree"], snap["runs"], snap["slabfree"],
+                 snap["mapped"]) = map(int, words[1:])
+            elif words[0] == "lists":
+                snap["lists"] = list(map(int, words[1:]))
+            elif words[0] == "hist":
+                snap["hist"] = list(map(int, words[1:]))
+            elif words[0] == "map":
+                snap["map"] = words[1:]
+    return traces
+
+
+def blocks(snap):
+    """(size, kind) of every block of the snapshot, in address order"""
+    for word in snap["map"]:
+        entry, _, reps = word.partition("*")
+        for _ in range(int(reps or 1)):
+            yield int(entry[:-1]), entry[-1]
+
+
+def map_row(snap, width, scale, y, height):
+    """rects for one snapshot; each pixel takes the kind covering most of it"""
+    cover = [dict() for _ in range(width)]
+    addr = 0
+    for size, kind in blocks(snap):
+        lo, hi = addr * scale, (addr + size) * scale
+        px = int(lo)
+        while px < hi and px < width:
+            part = min(hi, px + 1) - max(lo, px)
+            cover[px][kind] = cover[px].get(kind, 0) + part
+            px += 1
+        addr += size
+    rects = []
+    start, last = 0, None
+    for px in range(width + 1):
+        kind = max(cover[px], key=cover[px].get) if px < width and cover[px] else None
+        if kind != last:
+            if last is not None:
+                rects.append('<rect x="%d" y="%.2f" width="%d" height="%.2f" fill="%s"/>'
+                             % (start, y, px - start, height, COLORS[last]))
+            start, last = px, kind
+    return rects
+
+
+def render(name, snaps, width, rows, path):
+    plot_h, map_h, margin = 240, 360, 60
+    out = ['<svg xmlns="http://www.w3.org/2000/svg" width="%d" height="%d" '
+           'font-family="sans-serif" font-size="11">'
+           % (width + 2 * margin, plot_h + map_h + 3 * margin)]
+    out.append('<rect width="100%" height="100%" fill="#ffffff"/>')
+    out.append('<text x="%d" y="20" font-size="14">%s</text>' % (margin, name))
+
+    # time series
+    last_op = snaps[-1]["op"]
+    top = max(s["heap"] for s in snaps) or 1
+    x = lambda op: margin + width * op / last_op
+    y = lambda v: margin + plot_h * (1 - v / top)
+    out.append('<rect x="%d" y="%d" width="%d" height="%d" fill="none" stroke="#888"/>'
+               % (margin, margin, width, plot_h))
+    for i, (key, label, color) in enumerate(SERIES):
+        pts = " ".join("%.1f,%.1f" % (x(s["op"]), y(s[key])) for s in snaps)
+        out.append('<polyline points="%s" fill="none" stroke="%s"/>' % (pts, color))
+        out.append('<text x="%d" y="%d" fill="%s">%s</text>'
+                   % (margin + 10 + 110 * i, margin - 6, color, label))
+    out.append('<text x="%d" y="%d">%d KB</text>' % (4, margin + 10, top // 1024))
+    out.append('<text x="%d" y="%d">request %d</text>'
+               % (margin + width - 80, margin + plot_h + 14, last_op))
+
+    # address-space map, at most rows snapshots
+    picked = snaps[::max(1, -(-len(snaps) // rows))]
+    map_y = 2 * margin + plot_h
+    row_h = map_h / len(picked)
+    scale = width / top
+    out.append('<text x="%d" y="%d">heap address 0 .. %d KB, one row per snapshot '
+               '(blue allocated, orange slab runs, white free)</text>'
+               % (margin, map_y - 6, top // 1024))
+    out.append('<g transform="translate(%d,0)">' % margin)
+    for i, s in enumerate(picked):
+        out.extend(map_row(s, width, scale, map_y + i * row_h, row_h))
+    out.append('</g>')
+    out.append('<rect x="%d" y="%d" width="%d" height="%d" fill="none" stroke="#888"/>'
+               % (margin, map_y, width, map_h))
+    out.append("</svg>")
+    with open(path, "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+def summarize(name, snaps):
+    s = max(snaps, key=lambda s: s["requested"])
+    total = (s["heap"] + s["mapped"]) or 1
+    internal = s["alloc"] + s["mapped"] - s["requested"]
+    pct = lambda v: 100.0 * v / total
+    print("%s: at the most bytes requested, request %d of %d, heap %d KB + "
+          "mapped %d KB" % (name, s["op"], snaps[-1]["op"], s["heap"] // 1024,
+                            s["mapped"] // 1024))
+    print("  requested %5.1f%%  internal %5.1f%% (free slab objects %4.1f%%)  "
+          "external %5.1f%% in %d free blocks, largest %d bytes"
+          % (pct(s["requested"]), pct(internal), pct(s["slabfree"]),
+             pct(s["free"]), s["nfree"], s["largest"]))
+    print("  free list lengths %s, tree %d; free blocks per power of two "
+          "from 16 bytes %s" % (s["lists"][:-1], s["lists"][-1], s["hist"]))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--width", type=int, default=900, help="map width in pixels")
+    parser.add_argument("--rows", type=int, default=200, help="most snapshots in the map")
+    parser.add_argument("log")
+    parser.add_argument("prefix")
+    args = parser.parse_args()
+
+    for name, snaps in read_log(args.log):
+        if not snaps:
+            continue
+        summarize(name, snaps)
+        path = "%s-%s.svg" % (args.prefix, os.path.splitext(os.path.basename(name))[0])
+        render(name, snaps, args.width, args.rows, path)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,73 @@
+#!/usr/bin/python3
+
+"""
+mdcompare.py - compare two "mdriver -J" result files
+
+Prints util, Kops and, when both runs used -p, the p99 malloc and free
+cycles of every trace in the old and new run side by side, with the
+change in percent. Typical use, across two commits:
+
+    unix> mdriver -p -J old.json
+    ... rebuild with the new mm.c ...
+    unix> mdriver -p -J new.json
+    unix> mdcompare.py old.json new.json
+
+usage: mdcompare.py <old.json> <new.json>
+"""
+
+import argparse
+import json
+
+
+def change(old, new):
+    if not old:
+        return "-"
+    return "%+.1f%%" % ((new - old) * 100.0 / old)
+
+
+def p99(trace, kind):
+    lat = trace.get("latency")
+    return lat[kind]["p99"] if lat else None
+
+
+def row(name, pairs):
+    cols = ["%-20s" % name]
+    for old, new in pairs:
+        if old is None or new is None:
+            cols.append("%26s" % "-")
+        else:
+            cols.append("%8g %8g %8s" % (old, new, change(old, new)))
+    print(" ".join(cols))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("old")
+    parser.add_argument("new")
+    args = parser.parse_args()
+
+    with open(args.old) as f:
+        old = json.load(f)
+    with open(args.new) as f:
+        new = json.load(f)
+    new_traces = {t["name"]: t for t in new["traces"]}
+
+    print("%-20s %26s %26s %26s %26s" % ("tracefile", "util (%)", "Kops",
+                                         "malloc p99", "free p99"))
+    for o in old["traces"]:
+        n = new_traces.get(o["name"])
+        if n is None or not o["valid"] or not n["valid"]:
+            print("%-20s %s" % (o["name"], "not valid in both runs"))
+            continue
+        row(o["name"], [(o["util"] * 100, n["util"] * 100),
+                        (o["kops"], n["kops"]),
+                        (p99(o, "malloc"), p99(n, "malloc")),
+                        (p99(o, "free"), p99(n, "free"))])
+    row("Total", [(old["total"]["util"] * 100, new["total"]["util"] * 100),
+                  (old["total"]["kops"], new["total"]["kops"]),
+                  (None, None), (None, None)])
+    print("perf index %d -> %d" % (old["perfindex"], new["perfindex"]))
+
+
+if __name__ == "__main__":
+    main()
@@ -15,11 +15,19 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include "mm.h"
+#include "buddy.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -33,6 +41,15 @@
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
+/* Latency histograms have 2^LAT_SUB_BITS buckets per power of two cycles */
+#define LAT_SUB_BITS   4
+#define LAT_BUCKETS    (64 << LAT_SUB_BITS)
+#define LAT_RUNS       3 /* times eval_mm_latency replays each trace */
+
+/* Shortest and longest runs of requests replayed with one batch call (-b) */
+#define BATCH_MIN      4
+#define BATCH_MAX    256
+
 /****************************** 
  * The key compound data types 
  *****************************/
@@ -44,22 +61,18 @@ typedef struct range_t {
     struct range_t *next;  /* next list element */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
+    traceop_t *ops;      /* array of requests (see trace.h) */
+    void *map;           /* binary trace file ops points into, or NULL */
+    size_t map_len;      /* length of that mapping */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    unsigned short *batch; /* requests in the batch starting at each one (-b) */
 } trace_t;
 
 /* 
@@ -72,6 +85,30 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Histogram of the cycles taken by one type of request */
+typedef struct {
+    unsigned long long count;               /* requests recorded */
+    unsigned long long total;               /* cycles of them all */
+    unsigned long long max;                 /* cycles of the slowest one */
+    unsigned long long bucket[LAT_BUCKETS]; /* see lat_record() */
+} lat_t;
+
+/* An allocator mdriver can evaluate (-A); NULL where it has no such call */
+typedef struct {
+    char *name;
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void *(*memalign)(size_t align, size_t size);
+    void *(*calloc)(size_t nmemb, size_t size);
+    int (*malloc_batch)(size_t size, int n, void **out);
+    void (*free_batch)(void **ptrs, int n);
+    int (*check_heap)(void);
+    void (*snapshot)(FILE *fp);
+    void (**prof_hook)(int point, unsigned long long value);
+} backend_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -81,6 +118,13 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t peak;     /* largest heap footprint during the trace */
+    size_t resident; /* heap bytes still backed by memory after the trace */
+    lat_t lat[4];    /* per request type, indexed by ALLOC/FREE/REALLOC/XALLOC (-p) */
+    lat_t prof[MM_PROF_POINTS]; /* per profiling point of mm.c (-P) */
+    unsigned long long prof_cycles; /* cycles of the profiled replay */
+    double dtlb;     /* dTLB load misses per timed run, < 0 if not counted */
+    double faults;   /* page faults per timed run, < 0 if not counted */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -92,6 +136,30 @@ int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* Heap snapshots: every snap_every requests of eval_mm_util() (-s) */
+static int snap_every = 0;
+static FILE *snapfp = NULL;
+
+/* Times eval_mm_speed has run, to turn counter totals into per-run values */
+static int speed_runs = 0;
+
+/* If set, replay batches with mm_malloc_batch and mm_free_batch (-b) */
+static int batching = 0;
+
+/* If set, replay each trace once more with mm.c's profiler on (-P) */
+static int profiling = 0;
+static lat_t *prof_lat; /* what the profiler records into */
+
+/* The allocators -A picks from, and the one being evaluated */
+static backend_t backends[] = {
+    {"mm", mm_init, mm_malloc, mm_free, mm_realloc, mm_memalign, mm_calloc,
+     mm_malloc_batch, mm_free_batch, mm_check_heap, mm_snapshot, &mm_prof_hook},
+    {"buddy", buddy_init, buddy_malloc, buddy_free, buddy_realloc,
+     buddy_memalign, buddy_calloc, NULL, NULL, NULL, NULL, NULL},
+};
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+static backend_t *be = &backends[0];
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -113,20 +181,48 @@ static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void map_trace(trace_t *trace, char *path, FILE *tracefile);
 static void free_trace(trace_t *trace);
+static void find_batches(trace_t *trace);
+static void *xalloc(unsigned int xsize);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
+static void *libc_xalloc(unsigned int xsize);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, lat_t *lat);
+static void eval_mm_profile(speed_t *params, stats_t *stats);
+static void prof_record(int point, unsigned long long value);
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats,
+			  int latency);
+static void run_mm_traces(char **tracefiles, int n, stats_t *stats,
+			  int jobs, int latency);
+
+/* These functions record and summarize latency histograms */
+static void lat_record(lat_t *lat, unsigned long long cycles);
+static void lat_merge(lat_t *to, lat_t *from);
+static unsigned long long lat_percentile(lat_t *lat, double q);
+
+/* These functions count hardware and software events around a replay */
+static int perf_open(unsigned int type, unsigned long long config);
+static double perf_close(int fd, int runs);
 
 /* Various helper routines */
-static void printresults(int n, stats_t *stats);
+static void printresults(int n, stats_t *stats, char **tracefiles);
+static void printlatency(int n, stats_t *stats, char **tracefiles);
+static void printprofile(int n, stats_t *stats, char **tracefiles);
+static void printcounters(int n, stats_t *stats, char **tracefiles);
+static void printbackends(int n, int nb, backend_t **bes, stats_t **stats,
+			  char **tracefiles);
+static void json_string(FILE *fp, char *s);
+static void writejson(char *path, int n, stats_t *stats, char **tracefiles,
+		      int jobs, double perfindex);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -137,19 +233,27 @@ static void app_error(char *msg);
  **************/
 int main(int argc, char **argv)
 {
-    int i;
-    char c;
+    int i, b;
+    char c, *name;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    backend_t *bes[NUM_BACKENDS] = {&backends[0]}; /* allocators to run (-A) */
+    stats_t *be_stats[NUM_BACKENDS]; /* and the stats of each, mm_stats first */
+    int be_errors[NUM_BACKENDS];     /* and the errors each one made */
+    int num_bes = 1;
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int jobs = 1;        /* Number of traces run at once (set by -j) */
+    int latency = 0;     /* If set, record per-request latencies (-p) */
+    char *jsonfile = NULL; /* If set, write the results here as JSON (-J) */
+    char *snapfile = "heap.log"; /* Heap snapshots go here (-S) */
+    int pages = MEM_PAGES_BASE;  /* What backs the heap (-H) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +262,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalj:pPJ:s:S:c:H:bA:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,12 +282,66 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'b': /* Replay runs of requests with the batch calls */
+            batching = 1;
+            break;
+        case 'A': /* Evaluate these allocators, in this order */
+            num_bes = 0;
+            for (name = strtok(optarg, ","); name != NULL; name = strtok(NULL, ",")) {
+                for (b = 0; b < NUM_BACKENDS && strcmp(name, backends[b].name); b++)
+                    ;
+                if (b == NUM_BACKENDS || num_bes == NUM_BACKENDS) {
+                    usage();
+                    exit(1);
+                }
+                bes[num_bes++] = &backends[b];
+            }
+            if (num_bes == 0) {
+                usage();
+                exit(1);
+            }
+            break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'j': /* Run this many traces at once, each in its own process */
+            jobs = atoi(optarg);
+            break;
+        case 'p': /* Record per-request latency histograms */
+            latency = 1;
+            break;
+        case 'P': /* Profile the steps of mm.c's requests */
+            profiling = 1;
+            break;
+        case 'J': /* Write the results as JSON to this file */
+            jsonfile = optarg;
+            break;
+        case 's': /* Snapshot the heap every so many requests */
+            snap_every = atoi(optarg);
+            break;
+        case 'S': /* Write the heap snapshots to this file */
+            snapfile = optarg;
+            break;
+        case 'c': /* Check the heap at this level, auditing every so often */
+            if (sscanf(optarg, "%d:%d", &mm_check_level, &mm_check_every) < 1 ||
+                mm_check_every <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'H': /* Back the heap with huge pages */
+            if (!strcmp(optarg, "thp"))
+                pages = MEM_PAGES_THP;
+            else if (!strcmp(optarg, "hugetlb"))
+                pages = MEM_PAGES_HUGETLB;
+            else {
+                usage();
+                exit(1);
+            }
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -238,6 +396,15 @@ int main(int argc, char **argv)
     /* Initialize the timing package */
     init_fsecs();
 
+    /* Snapshots of every trace go to one file, so run them in order */
+    if (snap_every > 0) {
+	if ((snapfp = fopen(snapfile, "w")) == NULL) {
+	    sprintf(msg, "Could not open %s in main", snapfile);
+	    unix_error(msg);
+	}
+	jobs = 1;
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -269,50 +436,63 @@ int main(int argc, char **argv)
 	/* Display the libc results in a compact table */
 	if (verbose) {
 	    printf("\nResults for libc malloc:\n");
-	    printresults(num_tracefiles, libc_stats);
+	    printresults(num_tracefiles, libc_stats, tracefiles);
 	}
     }
 
-    /*
-     * Always run and evaluate the student's mm package
-     */
-    if (verbose > 1)
-	printf("\nTesting mm malloc\n");
-
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-	unix_error("mm_stats calloc in main failed");
-    
     /* Initialize the simulated memory system in memlib.c */
+    mem_set_pages(pages);
     mem_init(); 
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
+    /*
+     * Always run and evaluate the student's mm package, or each of the
+     * allocators picked with -A; the first one is the one scored below
+     */
+    for (b = 0; b < num_bes; b++) {
+	be = bes[b];
 	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    printf("\nTesting %s malloc\n", be->name);
+
+	/* 
+	 * Allocate the stats array, with one stats_t struct per tracefile.
+	 * It is shared so that the -j child processes can fill it in.
+	 */
+	be_stats[b] = (stats_t *)mmap(NULL, num_tracefiles * sizeof(stats_t),
+				      PROT_READ | PROT_WRITE,
+				      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (be_stats[b] == MAP_FAILED)
+	    unix_error("mm_stats mmap in main failed");
+	mm_stats = be_stats[b];
+
+	/* Evaluate the malloc package using the K-best scheme */
+	errors = 0;
+	run_mm_traces(tracefiles, num_tracefiles, mm_stats, jobs, latency);
+	be_errors[b] = errors;
+
+	/* Display the results in a compact table */
+	if (verbose) {
+	    printf("\nResults for %s malloc:\n", be->name);
+	    printresults(num_tracefiles, mm_stats, tracefiles);
+	    printf("\nHeap footprint for %s malloc (KB):\n", be->name);
+	    printf("%5s%10s%10s  %s\n", "trace", "peak", "resident", "tracefile");
+	    for (i=0; i < num_tracefiles; i++) {
+		if (mm_stats[i].valid)
+		    printf("%2d%13zu%10zu  %s\n", i, mm_stats[i].peak / 1024,
+			   mm_stats[i].resident / 1024, tracefiles[i]);
+	    }
+	    printf("\n");
+	    printcounters(num_tracefiles, mm_stats, tracefiles);
 	}
-	free_trace(trace);
-    }
-
-    /* Display the mm results in a compact table */
-    if (verbose) {
-	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
-	printf("\n");
+	if (latency)
+	    printlatency(num_tracefiles, mm_stats, tracefiles);
+	if (profiling && be->prof_hook != NULL)
+	    printprofile(num_tracefiles, mm_stats, tracefiles);
     }
+    if (num_bes > 1)
+	printbackends(num_tracefiles, num_bes, bes, be_stats, tracefiles);
+    mm_stats = be_stats[0];
+    be = bes[0];
+    errors = be_errors[0];
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -362,6 +542,12 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    if (snapfp != NULL)
+	fclose(snapfp);
+    if (jsonfile != NULL)
+	writejson(jsonfile, num_tracefiles, mm_stats, tracefiles, jobs,
+		  perfindex);
+
     exit(0);
 }
 
@@ -395,9 +581,10 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or a mapping */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_is_mapped(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -469,20 +656,25 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. A binary
+ *     trace (see trace.h) is mapped rather than read.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
     FILE *tracefile;
     trace_t *trace;
+    tracehdr_t hdr;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, align;
     unsigned max_index = 0;
     unsigned op_index;
+    struct timespec start, end;
 
-    if (verbose > 1)
+    if (verbose > 1) {
 	printf("Reading tracefile: %s\n", filename);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+    }
 
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
@@ -495,6 +687,18 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
+    if (fread(&hdr, sizeof(hdr), 1, tracefile) == 1 &&
+	!memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic))) {
+	trace->sugg_heapsize = hdr.sugg_heapsize;
+	trace->num_ids = hdr.num_ids;
+	trace->num_ops = hdr.num_ops;
+	trace->weight = hdr.weight;
+	map_trace(trace, path, tracefile);
+	fclose(tracefile);
+	goto done;
+    }
+    rewind(tracefile);
+    trace->map = NULL;
     fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
@@ -505,16 +709,6 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
 	unix_error("malloc 2 failed in read_trace");
 
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
@@ -539,6 +733,24 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
+	case 'm':
+	case 'c':
+	    align = 1;
+	    if (type[0] == 'm')
+		fscanf(tracefile, "%u %u %u", &index, &size, &align);
+	    else
+		fscanf(tracefile, "%u %u", &index, &size);
+	    if (size > XALLOC_SIZE_MAX || align == 0 || (align & (align - 1))) {
+		printf("Bad %s request %u in tracefile %s\n",
+		       type[0] == 'm' ? "memalign" : "calloc", op_index, path);
+		exit(1);
+	    }
+	    trace->ops[op_index].type = XALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = (type[0] == 'm') ?
+		XALLOC_MEMALIGN(size, __builtin_ctz(align)) : XALLOC_CALLOC_OF(size);
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
@@ -550,22 +762,121 @@ static trace_t *read_trace(char *tracedir, char *filename)
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
-    
+
+ done:
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+
+    /* ... and, if asked, where its batches are */
+    trace->batch = NULL;
+    if (batching && be->malloc_batch != NULL)
+	find_batches(trace);
+
+    if (verbose > 1) {
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Read %d requests in %.3f secs\n", trace->num_ops,
+	       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    }
     return trace;
 }
 
+/*
+ * map_trace - map the requests of the binary trace at path, whose
+ *     header has already been read into trace, and check them
+ */
+static void map_trace(trace_t *trace, char *path, FILE *tracefile)
+{
+    struct stat st;
+    traceop_t *op, *end;
+
+    trace->map_len = sizeof(tracehdr_t) + 
+	(size_t)trace->num_ops * sizeof(traceop_t);
+    if (fstat(fileno(tracefile), &st) < 0)
+	unix_error("fstat failed in map_trace");
+    if (trace->num_ids <= 0 || trace->num_ops < 0 ||
+	(size_t)st.st_size != trace->map_len) {
+	printf("Bad header or length in binary tracefile %s\n", path);
+	exit(1);
+    }
+    trace->map = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE,
+		      fileno(tracefile), 0);
+    if (trace->map == MAP_FAILED)
+	unix_error("mmap failed in map_trace");
+    madvise(trace->map, trace->map_len, MADV_WILLNEED);
+    trace->ops = (traceop_t *)((char *)trace->map + sizeof(tracehdr_t));
+
+    /* Every id must fit in the blocks array read_trace() allocates */
+    end = trace->ops + trace->num_ops;
+    for (op = trace->ops; op < end; op++) {
+	if (op->index >= (unsigned)trace->num_ids) {
+	    printf("Bogus request %ld in tracefile %s\n",
+		   (long)(op - trace->ops), path);
+	    exit(1);
+	}
+    }
+}
+
+/*
+ * xalloc - Make the XALLOC request whose packed size is xsize, a calloc
+ *     or a memalign (see trace.h)
+ */
+static void *xalloc(unsigned int xsize)
+{
+    if (xsize & XALLOC_CALLOC)
+	return be->calloc(1, XALLOC_SIZE(xsize));
+    return be->memalign(XALLOC_ALIGN(xsize), XALLOC_SIZE(xsize));
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* unmap or free the three arrays... */
+	munmap(trace->map, trace->map_len);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->batch);
     free(trace);              /* and the trace record itself... */
 }
 
+/*
+ * find_batches - Mark the runs of requests that -b replays with one
+ *     call: mallocs of the same size, and frees, BATCH_MIN to BATCH_MAX
+ *     of them. batch[i] is the length of the run starting at request i,
+ *     1 for requests in no run, and 0 for the rest of a run. Shorter
+ *     runs stay single calls, which are cheaper for them.
+ */
+static void find_batches(trace_t *trace)
+{
+    traceop_t *ops = trace->ops;
+    int i, j;
+
+    if ((trace->batch = (unsigned short *)calloc(trace->num_ops + 1, 
+				 sizeof(unsigned short))) == NULL)
+	unix_error("calloc failed in find_batches");
+    for (i = 0; i < trace->num_ops; i = j) {
+	for (j = i + 1; j < trace->num_ops && j - i < BATCH_MAX && 
+		 ops[j].type == ops[i].type &&
+		 (ops[i].type == ALLOC || ops[i].type == FREE) &&
+		 (ops[i].type == FREE || ops[j].size == ops[i].size); j++)
+	    ;
+	if (j - i < BATCH_MIN)
+	    j = i + 1;
+	trace->batch[i] = j - i;
+    }
+}
+
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
@@ -580,16 +891,19 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     int index;
     int size;
     int oldsize;
+    unsigned int xsize;
     char *newp;
     char *oldp;
     char *p;
+    void *batch[BATCH_MAX];
+    int n = 0, next = 0;
     
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (be->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
@@ -603,8 +917,18 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case ALLOC: /* mm_malloc */
 
-	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    /* Call the student's malloc, or take the next block of a batch */
+	    if (trace->batch != NULL && trace->batch[i] > 1) {
+		n = trace->batch[i];
+		next = 0;
+		if (be->malloc_batch(size, n, batch) < n) {
+		    malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		    return 0;
+		}
+	    }
+	    if (next < n)
+		p = batch[next++];
+	    else if ((p = be->malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -633,7 +957,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    if ((newp = be->realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
@@ -653,7 +977,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if (newp[j] != (char)(index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -666,12 +990,54 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    trace->block_sizes[index] = size;
 	    break;
 
+        case XALLOC: /* mm_memalign or mm_calloc */
+	    xsize = trace->ops[i].size;
+	    size = XALLOC_SIZE(xsize);
+	    if ((p = xalloc(xsize)) == NULL) {
+		malloc_error(tracenum, i, (xsize & XALLOC_CALLOC) ?
+			     "mm_calloc failed." : "mm_memalign failed.");
+		return 0;
+	    }
+
+	    /* 
+	     * The block must start at a multiple of the alignment asked
+	     * for, and a calloc'd one must be all zeros, even where the
+	     * blocks that were there before were filled with their ids
+	     */
+	    if ((unsigned long)p % XALLOC_ALIGN(xsize) != 0) {
+		malloc_error(tracenum, i, "mm_memalign did not align the block");
+		return 0;
+	    }
+	    for (j = 0; (xsize & XALLOC_CALLOC) && j < size; j++) {
+		if (p[j] != 0) {
+		    malloc_error(tracenum, i, "mm_calloc did not clear the block");
+		    return 0;
+		}
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
         case FREE: /* mm_free */
 	    
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    if (trace->batch != NULL && trace->batch[i] > 1) {
+		n = trace->batch[i];
+		for (next = 0; next < n; next++) {
+		    batch[next] = trace->blocks[trace->ops[i + next].index];
+		    if (next > 0)
+			remove_range(ranges, batch[next]);
+		}
+		be->free_batch(batch, n);
+		i += n - 1;
+	    }
+	    else
+		be->free(p);
 	    break;
 
 	default:
@@ -680,6 +1046,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
     }
 
+    /* Audit what the trace left behind */
+    if (mm_check_level > 0 && be->check_heap != NULL)
+	be->check_heap();
+
     /* As far as we know, this is a valid malloc package */
     return 1;
 }
@@ -707,7 +1077,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (be->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -717,7 +1087,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = be->malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -739,7 +1109,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = be->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -755,12 +1125,25 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 		total_size : max_total_size;
 	    break;
 
+	case XALLOC: /* mm_memalign or mm_calloc */
+	    index = trace->ops[i].index;
+	    size = XALLOC_SIZE(trace->ops[i].size);
+
+	    if ((p = xalloc(trace->ops[i].size)) == NULL)
+		app_error("mm_memalign or mm_calloc failed in eval_mm_util");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
         case FREE: /* mm_free */
 	    index = trace->ops[i].index;
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    be->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -772,9 +1155,17 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	/* With -s, log the heap and the bytes the trace has asked for */
+	if (snapfp != NULL && be->snapshot != NULL &&
+	    ((i + 1) % snap_every == 0 || i == trace->num_ops - 1)) {
+	    fprintf(snapfp, "op %d %d\n", i + 1, total_size);
+	    be->snapshot(snapfp);
+	}
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    /* the heap may have shrunk since, so use its peak footprint */
+    return ((double)max_total_size / (double)mem_peaksize());
 }
 
 
@@ -784,13 +1175,15 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, j, n, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    void *batch[BATCH_MAX];
 
     /* Reset the heap and initialize the mm package */
+    speed_runs++;
     mem_reset_brk();
-    if (mm_init() < 0) 
+    if (be->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -800,7 +1193,15 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+	    if (trace->batch != NULL && (n = trace->batch[i]) > 1) {
+		if (be->malloc_batch(size, n, batch) < n)
+		    app_error("mm_malloc_batch error in eval_mm_speed");
+		for (j = 0; j < n; j++)
+		    trace->blocks[trace->ops[i + j].index] = batch[j];
+		i += n - 1;
+		break;
+	    }
+            if ((p = be->malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -809,15 +1210,29 @@ static void eval_mm_speed(void *ptr)
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = be->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
 
+	case XALLOC: /* mm_memalign or mm_calloc */
+	    index = trace->ops[i].index;
+	    if ((p = xalloc(trace->ops[i].size)) == NULL)
+		app_error("mm_memalign or mm_calloc error in eval_mm_speed");
+	    trace->blocks[index] = p;
+	    break;
+
         case FREE: /* mm_free */
+	    if (trace->batch != NULL && (n = trace->batch[i]) > 1) {
+		for (j = 0; j < n; j++)
+		    batch[j] = trace->blocks[trace->ops[i + j].index];
+		be->free_batch(batch, n);
+		i += n - 1;
+		break;
+	    }
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            be->free(block);
             break;
 
 	default:
@@ -825,6 +1240,214 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * read_tsc - Read the time stamp counter; other machines fall back
+ *     to nanoseconds from the monotonic clock.
+ */
+static inline unsigned long long read_tsc(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned hi, lo;
+
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long)hi << 32) | lo;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * eval_mm_latency - Replay the trace LAT_RUNS times, timing every 
+ *    request with the TSC and adding it to lat[] by request type.
+ */
+static void eval_mm_latency(trace_t *trace, lat_t *lat)
+{
+    int i, r, index;
+    unsigned long long start, end;
+    char *p;
+
+    for (r = 0; r < LAT_RUNS; r++) {
+	mem_reset_brk();
+	if (be->init() < 0) 
+	    app_error("mm_init failed in eval_mm_latency");
+
+	for (i = 0;  i < trace->num_ops;  i++) {
+	    index = trace->ops[i].index;
+	    switch (trace->ops[i].type) {
+
+	    case ALLOC: /* mm_malloc */
+		start = read_tsc();
+		p = be->malloc(trace->ops[i].size);
+		end = read_tsc();
+		if (p == NULL)
+		    app_error("mm_malloc error in eval_mm_latency");
+		trace->blocks[index] = p;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		start = read_tsc();
+		p = be->realloc(trace->blocks[index], trace->ops[i].size);
+		end = read_tsc();
+		if (p == NULL)
+		    app_error("mm_realloc error in eval_mm_latency");
+		trace->blocks[index] = p;
+		break;
+
+	    case XALLOC: /* mm_memalign or mm_calloc */
+		start = read_tsc();
+		p = xalloc(trace->ops[i].size);
+		end = read_tsc();
+		if (p == NULL)
+		    app_error("mm_memalign or mm_calloc error in eval_mm_latency");
+		trace->blocks[index] = p;
+		break;
+
+	    case FREE: /* mm_free */
+		p = trace->blocks[index];
+		start = read_tsc();
+		be->free(p);
+		end = read_tsc();
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_mm_latency");
+	    }
+	    lat_record(&lat[trace->ops[i].type], end - start);
+	}
+    }
+}
+
+/*
+ * eval_mm_profile - Replay the trace once more with the allocator's
+ *    profiler recording into stats->prof[], and count the cycles the
+ *    whole replay took, that the profiling points add up to a share of
+ */
+static void eval_mm_profile(speed_t *params, stats_t *stats)
+{
+    unsigned long long start;
+
+    prof_lat = stats->prof;
+    *be->prof_hook = prof_record;
+    start = read_tsc();
+    eval_mm_speed(params);
+    stats->prof_cycles = read_tsc() - start;
+    *be->prof_hook = NULL;
+}
+
+/*
+ * prof_record - The profiler hook: add a value to the histogram of
+ *    its profiling point
+ */
+static void prof_record(int point, unsigned long long value)
+{
+    lat_record(&prof_lat[point], value);
+}
+
+/*
+ * eval_mm_trace - Read one trace and evaluate the mm package on it
+ *    for correctness, utilization, speed and, if asked, latency.
+ */
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats,
+			  int latency)
+{
+    trace_t *trace;
+    range_t *ranges = NULL;
+    speed_t speed_params;
+    int dtlb_fd, fault_fd;
+
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, &ranges);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	if (snapfp != NULL)
+	    fprintf(snapfp, "trace %s %d\n", tracefile, trace->num_ops);
+	stats->util = eval_mm_util(trace, tracenum, &ranges);
+	stats->peak = mem_peaksize();
+	stats->resident = mem_residentsize();
+	speed_params.trace = trace;
+	speed_params.ranges = ranges;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	dtlb_fd = perf_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+			    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	fault_fd = perf_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+	speed_runs = 0;
+	stats->secs = fsecs(eval_mm_speed, &speed_params);
+	stats->dtlb = perf_close(dtlb_fd, speed_runs);
+	stats->faults = perf_close(fault_fd, speed_runs);
+	if (latency)
+	    eval_mm_latency(trace, stats->lat);
+	if (profiling && be->prof_hook != NULL)
+	    eval_mm_profile(&speed_params, stats);
+    }
+    clear_ranges(&ranges);
+    free_trace(trace);
+}
+
+/*
+ * run_mm_traces - Evaluate the mm package on each of the n traces.
+ *    With jobs > 1, up to jobs traces run at once, each in a child
+ *    process with its own copy of the heap. A child writes its results
+ *    into stats, which main() maps shared, and exits with the number
+ *    of errors it found. The children compete for the CPUs, so only 
+ *    compare Kops between runs with the same jobs on the same machine.
+ */
+static void run_mm_traces(char **tracefiles, int n, stats_t *stats,
+			  int jobs, int latency)
+{
+    int i, status;
+    int running = 0;
+    int next = 0;
+    pid_t pid, *pids;
+
+    if (jobs <= 1) {
+	for (i = 0; i < n; i++)
+	    eval_mm_trace(tracefiles[i], i, &stats[i], latency);
+	return;
+    }
+
+    if ((pids = (pid_t *)calloc(n, sizeof(pid_t))) == NULL)
+	unix_error("calloc failed in run_mm_traces");
+    while (next < n || running > 0) {
+	if (next < n && running < jobs) {
+	    fflush(stdout); /* or the child prints it again */
+	    if ((pid = fork()) < 0)
+		unix_error("fork failed in run_mm_traces");
+	    if (pid == 0) {
+		eval_mm_trace(tracefiles[next], next, &stats[next], latency);
+		exit(errors < 255 ? errors : 255);
+	    }
+	    pids[next++] = pid;
+	    running++;
+	    continue;
+	}
+
+	if ((pid = wait(&status)) < 0)
+	    unix_error("wait failed in run_mm_traces");
+	running--;
+	for (i = 0; pids[i] != pid; i++)
+	    ;
+	if (WIFEXITED(status)) {
+	    errors += WEXITSTATUS(status);
+	}
+	else {
+	    stats[i].valid = 0;
+	    errors++;
+	    printf("ERROR [trace %d]: killed by signal %d\n", i,
+		   WTERMSIG(status));
+	}
+    }
+    free(pids);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -856,6 +1479,14 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    }
 	    trace->blocks[trace->ops[i].index] = newp;
 	    break;
+
+	case XALLOC: /* posix_memalign or calloc */
+	    if ((p = libc_xalloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc posix_memalign or calloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
 	    
         case FREE: /* free */
 	    free(trace->blocks[trace->ops[i].index]);
@@ -869,6 +1500,22 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
     return 1;
 }
 
+/*
+ * libc_xalloc - Make the XALLOC request whose packed size is xsize
+ *     with libc's calloc or posix_memalign
+ */
+static void *libc_xalloc(unsigned int xsize)
+{
+    void *p;
+    size_t align = XALLOC_ALIGN(xsize);
+
+    if (xsize & XALLOC_CALLOC)
+	return calloc(1, XALLOC_SIZE(xsize));
+    if (align < sizeof(void *))  /* posix_memalign's least alignment */
+	align = sizeof(void *);
+    return posix_memalign(&p, align, XALLOC_SIZE(xsize)) == 0 ? p : NULL;
+}
+
 /* 
  * eval_libc_speed - This is the function that is used by fcyc() to
  *    measure the running time of the libc malloc package on the set
@@ -900,6 +1547,13 @@ static void eval_libc_speed(void *ptr)
 	    
 	    trace->blocks[index] = newp;
 	    break;
+
+	case XALLOC: /* posix_memalign or calloc */
+	    index = trace->ops[i].index;
+	    if ((p = libc_xalloc(trace->ops[i].size)) == NULL)
+		unix_error("posix_memalign or calloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
 	    
         case FREE: /* free */
 	    index = trace->ops[i].index;
@@ -918,7 +1572,7 @@ static void eval_libc_speed(void *ptr)
 /*
  * printresults - prints a performance summary for some malloc package
  */
-static void printresults(int n, stats_t *stats) 
+static void printresults(int n, stats_t *stats, char **tracefiles) 
 {
     int i;
     double secs = 0;
@@ -926,35 +1580,37 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%8s%10s%8s  %s\n", 
+	   "trace", " valid", "util", "ops", "secs", "Kops", "tracefile");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%8.0f  %s\n", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
-		   (stats[i].ops/1e3)/stats[i].secs);
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   tracefiles[i]);
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n", 
+	    printf("%2d%10s%6s%8s%10s%8s  %s\n", 
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
-		   "-");
+		   "-",
+		   tracefiles[i]);
 	}
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%8.0f%10.6f%8.0f\n", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       ops, 
@@ -962,7 +1618,7 @@ static void printresults(int n, stats_t *stats)
 	       (ops/1e3)/secs);
     }
     else {
-	printf("%12s%6s%8s%10s%6s\n", 
+	printf("%12s%6s%8s%10s%8s\n", 
 	       "Total       ",
 	       "-", 
 	       "-", 
@@ -972,6 +1628,398 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * lat_record - Count a request that took the given cycles. Values
+ *     below 2^(LAT_SUB_BITS+1) get a bucket each; above that every
+ *     power of two is split into 2^LAT_SUB_BITS equal buckets, so a
+ *     bucket is at most 1/16 of its value wide.
+ */
+static void lat_record(lat_t *lat, unsigned long long cycles)
+{
+    int msb, i;
+
+    if (cycles < (2 << LAT_SUB_BITS)) {
+	i = cycles;
+    }
+    else {
+	msb = 63 - __builtin_clzll(cycles);
+	i = ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+	    ((cycles >> (msb - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+    }
+    lat->bucket[i]++;
+    lat->count++;
+    lat->total += cycles;
+    if (cycles > lat->max)
+	lat->max = cycles;
+}
+
+/*
+ * lat_merge - Add the requests counted in from to to
+ */
+static void lat_merge(lat_t *to, lat_t *from)
+{
+    int i;
+
+    for (i = 0; i < LAT_BUCKETS; i++)
+	to->bucket[i] += from->bucket[i];
+    to->count += from->count;
+    to->total += from->total;
+    if (from->max > to->max)
+	to->max = from->max;
+}
+
+/*
+ * lat_percentile - Return the cycles that a fraction q of the requests
+ *     did not exceed, rounded up to the top of their bucket
+ */
+static unsigned long long lat_percentile(lat_t *lat, double q)
+{
+    unsigned long long seen = 0;
+    unsigned long long top;
+    int i, shift;
+
+    if (lat->count == 0)
+	return 0;
+    for (i = 0; i < LAT_BUCKETS - 1; i++) {
+	seen += lat->bucket[i];
+	if (seen >= q * lat->count)
+	    break;
+    }
+    if (i < (2 << LAT_SUB_BITS)) {
+	top = i;
+    }
+    else {
+	shift = (i >> LAT_SUB_BITS) - 1;
+	top = ((unsigned long long)((1 << LAT_SUB_BITS) + 
+				    (i & ((1 << LAT_SUB_BITS) - 1)) + 1) 
+	       << shift) - 1;
+    }
+    return (top < lat->max) ? top : lat->max;
+}
+
+/*
+ * printlatency - prints the p50/p99/max cycles of each request type
+ *     for every trace, and for all the traces together
+ */
+static void printlatency(int n, stats_t *stats, char **tracefiles)
+{
+    static char *names[4] = {"malloc", "free", "realloc",
+			     "memalign+calloc"};
+    lat_t total[4];
+    int i, t;
+    lat_t *lat;
+
+    memset(total, 0, sizeof(total));
+    printf("Latency for %s malloc (cycles, p50/p99/max):\n", be->name);
+    printf("%5s", "trace");
+    for (t = 0; t < 4; t++)
+	printf("%22s", names[t]);
+    printf("  %s\n", "tracefile");
+    for (i = 0; i <= n; i++) {
+	if (i < n && !stats[i].valid)
+	    continue;
+	if (i < n)
+	    printf("%2d   ", i);
+	else
+	    printf("%5s", "Total");
+	for (t = 0; t < 4; t++) {
+	    lat = (i < n) ? &stats[i].lat[t] : &total[t];
+	    if (lat->count == 0)
+		printf("%22s", "-");
+	    else
+		printf("%7llu%7llu%8llu", lat_percentile(lat, 0.5), 
+		       lat_percentile(lat, 0.99), lat->max);
+	    if (i < n)
+		lat_merge(&total[t], lat);
+	}
+	printf("  %s\n", (i < n) ? tracefiles[i] : "");
+    }
+    printf("\n");
+}
+
+/*
+ * printprofile - Print where the profiled replay of each trace spent
+ *     its cycles, point by point (see mm.h), and how many free blocks
+ *     the searches looked at, by powers of two
+ */
+static void printprofile(int n, stats_t *stats, char **tracefiles)
+{
+    static char *names[MM_PROF_POINTS] = {
+	"find_fit", "blocks scanned", "place", "coalesce 1 (none)",
+	"coalesce 2 (next)", "coalesce 3 (prev)", "coalesce 4 (both)",
+	"mem_sbrk grow", "mem_sbrk trim", "slab malloc"};
+    unsigned long long hist[65], low;
+    int i, t, b, r;
+    lat_t *lat;
+
+    printf("Profile of %s malloc (TSC cycles; free blocks for blocks scanned):\n",
+	   be->name);
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	printf("%2d   %s, %llu cycles\n", i, tracefiles[i], 
+	       stats[i].prof_cycles);
+	printf("     %-18s%10s%10s%8s%8s%10s%7s\n", "point", "count", "mean", 
+	       "p50", "p99", "max", "share");
+	for (t = 0; t < MM_PROF_POINTS; t++) {
+	    lat = &stats[i].prof[t];
+	    if (lat->count == 0)
+		continue;
+	    printf("     %-18s%10llu%10.1f%8llu%8llu%10llu", names[t], 
+		   lat->count, (double)lat->total / lat->count, 
+		   lat_percentile(lat, 0.5), lat_percentile(lat, 0.99), 
+		   lat->max);
+	    if (t == MM_PROF_SCANNED)
+		printf("%7s\n", "-");
+	    else
+		printf("%6.1f%%\n", 100.0 * lat->total / stats[i].prof_cycles);
+	}
+
+	/* Searches by blocks scanned: 0, 1, 2-3, 4-7, ... */
+	memset(hist, 0, sizeof(hist));
+	lat = &stats[i].prof[MM_PROF_SCANNED];
+	for (b = 0; b < LAT_BUCKETS; b++) {
+	    if (b < (2 << LAT_SUB_BITS))
+		low = b;
+	    else
+		low = (unsigned long long)((1 << LAT_SUB_BITS) + 
+					   (b & ((1 << LAT_SUB_BITS) - 1)))
+		    << ((b >> LAT_SUB_BITS) - 1);
+	    hist[low ? 64 - __builtin_clzll(low) : 0] += lat->bucket[b];
+	}
+	if (lat->count > 0) {
+	    printf("     %-18s", "searches scanning");
+	    for (r = 0; r < 65; r++) {
+		if (hist[r] == 0)
+		    continue;
+		if (r < 2)
+		    printf(" %d:%llu", r, hist[r]);
+		else
+		    printf(" %llu-%llu:%llu", 1ULL << (r - 1), (1ULL << r) - 1,
+			   hist[r]);
+	    }
+	    printf("\n");
+	}
+    }
+    printf("\n");
+}
+
+/*
+ * perf_open - Start counting an event of this thread in user mode, 
+ *     returns its file descriptor or -1 if the event is not available
+ *     (as the TLB counters are not in many virtual machines)
+ */
+static int perf_open(unsigned int type, unsigned long long config)
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = type;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    if ((fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)) < 0)
+	return -1;
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    return fd;
+}
+
+/*
+ * perf_close - Stop counting and return the count per run, or -1 if
+ *     fd is not counting
+ */
+static double perf_close(int fd, int runs)
+{
+    unsigned long long count;
+    int ok;
+
+    if (fd < 0)
+	return -1;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    ok = read(fd, &count, sizeof(count)) == sizeof(count);
+    close(fd);
+    return (ok && runs > 0) ? (double)count / runs : -1;
+}
+
+/*
+ * printbackends - prints the util and Kops of each of the nb allocators
+ *     of -A side by side, "-" where a trace was not valid
+ */
+static void printbackends(int n, int nb, backend_t **bes, stats_t **stats,
+			  char **tracefiles)
+{
+    int i, b, valid;
+    double secs, ops, util;
+
+    printf("\nAllocators side by side (util, Kops):\n");
+    printf("%5s", "trace");
+    for (b = 0; b < nb; b++)
+	printf("%16s", bes[b]->name);
+    printf("  %s\n", "tracefile");
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	for (b = 0; b < nb; b++) {
+	    if (stats[b][i].valid)
+		printf("%7.0f%%%8.0f", stats[b][i].util*100.0,
+		       (stats[b][i].ops/1e3)/stats[b][i].secs);
+	    else
+		printf("%8s%8s", "-", "-");
+	}
+	printf("  %s\n", tracefiles[i]);
+    }
+
+    /* Totals of each allocator that ran every trace correctly */
+    printf("%-5s", "Total");
+    for (b = 0; b < nb; b++) {
+	secs = ops = util = 0;
+	valid = 0;
+	for (i = 0; i < n; i++) {
+	    if (stats[b][i].valid) {
+		secs += stats[b][i].secs;
+		ops += stats[b][i].ops;
+		util += stats[b][i].util;
+		valid++;
+	    }
+	}
+	if (valid == n)
+	    printf("%7.0f%%%8.0f", (util/n)*100.0, (ops/1e3)/secs);
+	else
+	    printf("%8s%8s", "-", "-");
+    }
+    printf("\n\n");
+}
+
+/*
+ * printcounters - prints the dTLB misses and page faults of one timed 
+ *     run of each trace, "-" where the event could not be counted
+ */
+static void printcounters(int n, stats_t *stats, char **tracefiles)
+{
+    int i;
+
+    printf("Memory system per timed run, %zu KB heap pages:\n", 
+	   mem_heap_pagesize() / 1024);
+    printf("%5s%12s%10s%12s  %s\n", "trace", "dTLB miss", "faults", 
+	   "miss/Kop", "tracefile");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	printf("%2d   ", i);
+	if (stats[i].dtlb < 0)
+	    printf("%12s", "-");
+	else
+	    printf("%12.0f", stats[i].dtlb);
+	if (stats[i].faults < 0)
+	    printf("%10s", "-");
+	else
+	    printf("%10.0f", stats[i].faults);
+	if (stats[i].dtlb < 0)
+	    printf("%12s", "-");
+	else
+	    printf("%12.1f", stats[i].dtlb / (stats[i].ops / 1e3));
+	printf("  %s\n", tracefiles[i]);
+    }
+    printf("\n");
+}
+
+/*
+ * json_string - Write s to fp as a JSON string, quoted, with quotes,
+ *     backslashes and control characters escaped
+ */
+static void json_string(FILE *fp, char *s)
+{
+    unsigned char c;
+
+    fputc('"', fp);
+    for (; (c = *s) != '\0'; s++) {
+	if (c == '"' || c == '\\')
+	    fprintf(fp, "\\%c", c);
+	else if (c < 0x20)
+	    fprintf(fp, "\\u%04x", c);
+	else
+	    fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * writejson - Write the mm results to path as a JSON object, one
+ *     entry per trace, for comparing allocator versions by script
+ */
+static void writejson(char *path, int n, stats_t *stats, char **tracefiles,
+		      int jobs, double perfindex)
+{
+    static char *names[4] = {"malloc", "free", "realloc", "xalloc"};
+    static char *prof_names[MM_PROF_POINTS] = {
+	"find_fit", "scanned", "place", "coalesce1", "coalesce2", 
+	"coalesce3", "coalesce4", "grow", "trim", "slab"};
+    FILE *fp;
+    int i, t;
+    double secs = 0, ops = 0, util = 0;
+    lat_t *lat;
+
+    if ((fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in writejson", path);
+	unix_error(msg);
+    }
+    fprintf(fp, "{\n  \"jobs\": %d,\n  \"heap_page\": %zu,\n  \"traces\": [\n",
+	    jobs, mem_heap_pagesize());
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "    {\"name\": ");
+	json_string(fp, tracefiles[i]);
+	fprintf(fp, ", \"valid\": %s", stats[i].valid ? "true" : "false");
+	if (stats[i].valid) {
+	    fprintf(fp, ", \"util\": %.4f, \"ops\": %.0f, \"secs\": %.6f, "
+		    "\"kops\": %.0f, \"peak\": %zu, \"resident\": %zu",
+		    stats[i].util, stats[i].ops, stats[i].secs,
+		    (stats[i].ops/1e3)/stats[i].secs, stats[i].peak,
+		    stats[i].resident);
+	    if (stats[i].dtlb >= 0)
+		fprintf(fp, ", \"dtlb_misses\": %.0f", stats[i].dtlb);
+	    if (stats[i].faults >= 0)
+		fprintf(fp, ", \"page_faults\": %.0f", stats[i].faults);
+	    secs += stats[i].secs;
+	    ops += stats[i].ops;
+	    util += stats[i].util;
+	}
+	if (stats[i].valid && stats[i].lat[ALLOC].count > 0) {
+	    fprintf(fp, ",\n     \"latency\": {");
+	    for (t = 0; t < 4; t++) {
+		lat = &stats[i].lat[t];
+		fprintf(fp, "%s\"%s\": {\"count\": %llu, \"p50\": %llu, "
+			"\"p99\": %llu, \"max\": %llu}", t ? ", " : "",
+			names[t], lat->count, lat_percentile(lat, 0.5),
+			lat_percentile(lat, 0.99), lat->max);
+	    }
+	    fprintf(fp, "}");
+	}
+	if (stats[i].valid && stats[i].prof_cycles > 0) {
+	    fprintf(fp, ",\n     \"profile\": {\"cycles\": %llu", 
+		    stats[i].prof_cycles);
+	    for (t = 0; t < MM_PROF_POINTS; t++) {
+		lat = &stats[i].prof[t];
+		fprintf(fp, ", \"%s\": {\"count\": %llu, \"total\": %llu, "
+			"\"p50\": %llu, \"p99\": %llu, \"max\": %llu}", 
+			prof_names[t], lat->count, lat->total, 
+			lat_percentile(lat, 0.5), lat_percentile(lat, 0.99), 
+			lat->max);
+	    }
+	    fprintf(fp, "}");
+	}
+	fprintf(fp, "}%s\n", (i < n - 1) ? "," : "");
+    }
+    fprintf(fp, "  ],\n");
+    fprintf(fp, "  \"total\": {\"util\": %.4f, \"ops\": %.0f, "
+	    "\"secs\": %.6f, \"kops\": %.0f},\n", util/n, ops, secs,
+	    secs > 0 ? (ops/1e3)/secs : 0.0);
+    fprintf(fp, "  \"errors\": %d,\n  \"perfindex\": %.0f\n}\n", errors,
+	    perfindex);
+    fclose(fp);
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,13 +2052,26 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValpPb] [-f <file>] [-t <dir>] [-j <n>] [-J <file>] [-s <n>] [-S <file>]\n");
+    fprintf(stderr, "               [-c <level>[:<n>]] [-H thp|hugetlb] [-A <allocator>,...]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <list>  Evaluate these allocators, comma separated: mm (default),\n");
+    fprintf(stderr, "\t           buddy. The first one is scored.\n");
+    fprintf(stderr, "\t-b         Replay runs of same-size mallocs, and of frees, as batches.\n");
+    fprintf(stderr, "\t-c <l>[:<n>] Check the heap: 1 blocks touched, 2 also audit every <n>\n");
+    fprintf(stderr, "\t           requests (1024), 3 audit on every request.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <kind>  Back the heap with transparent (thp) or hugetlb huge pages.\n");
+    fprintf(stderr, "\t-j <n>     Run up to <n> traces at once in separate processes.\n");
+    fprintf(stderr, "\t-J <file>  Also write the results to <file> as JSON.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-p         Print p50/p99/max TSC cycles per malloc, free and realloc.\n");
+    fprintf(stderr, "\t-P         Profile the cycles of mm.c's search, split, coalesce and sbrk.\n");
+    fprintf(stderr, "\t-s <n>     Snapshot the heap every <n> requests (see heapviz.py).\n");
+    fprintf(stderr, "\t-S <file>  Write the snapshots to <file> instead of heap.log.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
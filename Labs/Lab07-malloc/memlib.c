@@ -2,7 +2,22 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * The heap is a MAX_HEAP reservation of address space that only takes
+ * physical pages once they are touched, and hands them back when the heap
+ * shrinks. Pages it never touched, or released, read as zeros, and
+ * mem_heap_zero() says where they start. Blocks too large for the heap
+ * can get mappings of their own with mem_map(), which threads may call
+ * at once, for instance for the chunks of region.c. Both count towards
+ * the footprint mem_peaksize() reports.
+ *
+ * mem_set_pages(), called before mem_init(), backs the heap with 2 MB
+ * huge pages instead: transparent ones the kernel is asked for with
+ * madvise(), or explicit ones from the hugetlb pool. Either way the heap
+ * starts on a huge page boundary, mem_heap_pagesize() says how large its
+ * pages are, and shrinking it only releases whole huge pages.
  */
+#define _GNU_SOURCE /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,6 +25,7 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
@@ -18,20 +34,111 @@
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static size_t mem_peak;      /* largest heap + mapped size since the last reset */
+static char *mem_zero;       /* the heap reads as zeros from here up, at or above mem_brk */
+
+/* regions handed out by mem_map() */
+typedef struct map_t {
+    char *addr;
+    size_t size;
+    struct map_t *next;
+} map_t;
+static map_t *mem_maps;
+static size_t mem_mapped;    /* total size of those regions */
+static pthread_mutex_t mem_maps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int mem_pages = MEM_PAGES_BASE; /* what backs the heap */
+static size_t mem_heap_len;  /* size of the heap's reservation */
+
+static void mem_update_peak(void)
+{
+    size_t size = (size_t)(mem_brk - mem_start_brk) + mem_mapped;
+
+    if (size > mem_peak)
+	mem_peak = size;
+}
+
+/*
+ * give the heap pages from lo up to and including the one hi ends in
+ * back to the system, all of them past the brk; they read as zeros
+ * from then on, so mem_zero drops to lo's page if they reach it
+ */
+static void mem_release(char *lo, char *hi)
+{
+    size_t pagesize = mem_heap_pagesize();
+    char *start = (char *)(((unsigned long)lo + pagesize - 1) & ~(pagesize - 1));
+    char *end = (char *)(((unsigned long)hi + pagesize - 1) & ~(pagesize - 1));
+
+    if (end > mem_start_brk + mem_heap_len)
+	end = mem_start_brk + mem_heap_len;
+    if (start < end && madvise(start, end - start, MADV_DONTNEED) == 0 &&
+	mem_zero <= end && start < mem_zero)
+	mem_zero = start;
+}
+
+/*
+ * mem_set_pages - choose what backs the heap that mem_init() sets up:
+ *    MEM_PAGES_BASE, MEM_PAGES_THP or MEM_PAGES_HUGETLB
+ */
+void mem_set_pages(int pages)
+{
+    mem_pages = pages;
+}
+
+/* reserve len bytes of address space starting at a multiple of align */
+static char *mem_reserve(size_t len, size_t align)
+{
+    size_t pad = align - mem_pagesize();
+    char *addr, *start;
+
+    addr = mmap(NULL, len + pad, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+	return NULL;
+    start = (char *)(((unsigned long)addr + align - 1) & ~(align - 1));
+    if (start > addr)
+	munmap(addr, start - addr);
+    if (start + len < addr + len + pad)
+	munmap(start + len, addr + len + pad - (start + len));
+    return start;
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
-	exit(1);
+    /* reserve the address space we will use to model the available VM */
+    mem_heap_len = (MAX_HEAP + MEM_HUGE_PAGE - 1) & ~(MEM_HUGE_PAGE - 1);
+    mem_start_brk = NULL;
+    if (mem_pages == MEM_PAGES_HUGETLB) {
+	/* reserved up front: touching a page the pool lacks is a SIGBUS */
+	mem_start_brk = mmap(NULL, mem_heap_len, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (mem_start_brk == MAP_FAILED) {
+	    fprintf(stderr, "mem_init: no hugetlb pages (%s), using "
+		    "transparent huge pages\n", strerror(errno));
+	    mem_start_brk = NULL;
+	    mem_pages = MEM_PAGES_THP;
+	}
+    }
+    if (mem_start_brk == NULL) {
+	if (mem_pages == MEM_PAGES_BASE)
+	    mem_heap_len = MAX_HEAP;
+	mem_start_brk = mem_reserve(mem_heap_len, mem_heap_pagesize());
+	if (mem_start_brk == NULL) {
+	    fprintf(stderr, "mem_init_vm: mmap error\n");
+	    exit(1);
+	}
+	if (mem_pages == MEM_PAGES_THP && 
+	    madvise(mem_start_brk, mem_heap_len, MADV_HUGEPAGE) != 0)
+	    fprintf(stderr, "mem_init: no transparent huge pages (%s)\n",
+		    strerror(errno));
     }
 
     mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_zero = mem_start_brk;                 /* and untouched */
 }
 
 /* 
@@ -39,35 +146,149 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_start_brk, mem_heap_len);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    and drop the mappings still left from mem_map(). The heap's pages
+ *    stay resident, so that the next run does not fault them in again.
  */
 void mem_reset_brk()
 {
+    map_t *m;
+
+    while ((m = mem_maps) != NULL) {
+	mem_maps = m->next;
+	munmap(m->addr, m->size);
+	free(m);
+    }
+    mem_mapped = 0;
     mem_brk = mem_start_brk;
+    mem_peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap and releases the pages past its end.
  */
 void *mem_sbrk(int incr) 
 {
     char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ((mem_brk + incr) < mem_start_brk || (mem_brk + incr) > mem_max_addr) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
     mem_brk += incr;
+    if (incr < 0) {
+	mem_release(mem_brk, old_brk);
+    } else {
+	if (mem_brk > mem_zero)
+	    mem_zero = mem_brk;
+	mem_update_peak();
+    }
     return (void *)old_brk;
 }
 
+/*
+ * mem_map - map size bytes of fresh memory outside the heap, a multiple
+ *    of the page size, for a block of its own. Returns NULL on failure.
+ */
+void *mem_map(size_t size)
+{
+    map_t *m;
+    char *addr;
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+	return NULL;
+    if (mem_pages != MEM_PAGES_BASE && size >= MEM_HUGE_PAGE)
+	madvise(addr, size, MADV_HUGEPAGE);
+    if ((m = (map_t *)malloc(sizeof(map_t))) == NULL) {
+	munmap(addr, size);
+	return NULL;
+    }
+    m->addr = addr;
+    m->size = size;
+    pthread_mutex_lock(&mem_maps_lock);
+    m->next = mem_maps;
+    mem_maps = m;
+    mem_mapped += size;
+    mem_update_peak();
+    pthread_mutex_unlock(&mem_maps_lock);
+    return addr;
+}
+
+static map_t **mem_find_map(void *addr)
+{
+    map_t **mp;
+
+    for (mp = &mem_maps; *mp != NULL; mp = &(*mp)->next)
+	if ((*mp)->addr == addr)
+	    return mp;
+    fprintf(stderr, "ERROR: %p was not returned by mem_map\n", addr);
+    exit(1);
+}
+
+/*
+ * mem_remap - resize a mem_map() region to size bytes, moving it if it
+ *    has to. Returns its new address, or NULL and leaves it alone.
+ */
+void *mem_remap(void *addr, size_t size)
+{
+    map_t *m;
+    char *newaddr;
+
+    pthread_mutex_lock(&mem_maps_lock);
+    m = *mem_find_map(addr);
+    if ((newaddr = mremap(addr, m->size, size, MREMAP_MAYMOVE)) != MAP_FAILED) {
+	mem_mapped += size - m->size;
+	m->addr = newaddr;
+	m->size = size;
+	mem_update_peak();
+    }
+    pthread_mutex_unlock(&mem_maps_lock);
+    return (newaddr != MAP_FAILED) ? newaddr : NULL;
+}
+
+/*
+ * mem_unmap - give a mem_map() region back to the system
+ */
+void mem_unmap(void *addr)
+{
+    map_t **mp, *m;
+
+    pthread_mutex_lock(&mem_maps_lock);
+    mp = mem_find_map(addr);
+    m = *mp;
+    *mp = m->next;
+    mem_mapped -= m->size;
+    pthread_mutex_unlock(&mem_maps_lock);
+    munmap(m->addr, m->size);
+    free(m);
+}
+
+/*
+ * mem_is_mapped - is [lo, hi] inside one mem_map() region?
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    map_t *m;
+    int found = 0;
+
+    pthread_mutex_lock(&mem_maps_lock);
+    for (m = mem_maps; m != NULL && !found; m = m->next)
+	if ((char *)lo >= m->addr && (char *)hi < m->addr + m->size)
+	    found = 1;
+    pthread_mutex_unlock(&mem_maps_lock);
+    return found;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -76,6 +297,16 @@ void *mem_heap_lo()
     return (void *)mem_start_brk;
 }
 
+/*
+ * mem_heap_zero - return the lowest address from which the heap still
+ *    reads as zeros: it was never touched, or its pages were released
+ *    since. Memory that mem_sbrk() hands out above it need not be cleared.
+ */
+void *mem_heap_zero()
+{
+    return (void *)mem_zero;
+}
+
 /* 
  * mem_heap_hi - return address of last heap byte
  */
@@ -92,6 +323,52 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_mappedsize() - returns the bytes in mappings from mem_map()
+ */
+size_t mem_mappedsize()
+{
+    return mem_mapped;
+}
+
+/*
+ * mem_peaksize() - returns the largest heap plus mapped size since the
+ *    heap was last reset
+ */
+size_t mem_peaksize()
+{
+    return mem_peak;
+}
+
+/*
+ * mem_residentsize() - returns how many bytes of the heap and of the
+ *    mapped regions are backed by physical pages right now
+ */
+size_t mem_residentsize()
+{
+    size_t pagesize = mem_pagesize();
+    size_t len, i, resident = 0;
+    unsigned char *vec;
+    map_t *m;
+
+    len = (size_t)(mem_brk - mem_start_brk);
+    for (m = mem_maps; m != NULL; m = m->next)
+	if (m->size > len)
+	    len = m->size;
+    if ((vec = malloc(len / pagesize + 1)) == NULL)
+	return 0;
+    len = (size_t)(mem_brk - mem_start_brk + pagesize - 1) / pagesize;
+    if (len > 0 && mincore(mem_start_brk, len * pagesize, vec) == 0)
+	for (i = 0; i < len; i++)
+	    resident += (vec[i] & 1) * pagesize;
+    for (m = mem_maps; m != NULL; m = m->next)
+	if (mincore(m->addr, m->size, vec) == 0)
+	    for (i = 0; i < m->size / pagesize; i++)
+		resident += (vec[i] & 1) * pagesize;
+    free(vec);
+    return resident;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
@@ -99,3 +376,12 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_heap_pagesize() - returns the size of the pages backing the heap,
+ *    the unit in which it takes and releases memory
+ */
+size_t mem_heap_pagesize()
+{
+    return mem_pages == MEM_PAGES_BASE ? mem_pagesize() : MEM_HUGE_PAGE;
+}
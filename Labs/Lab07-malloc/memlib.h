@@ -1,11 +1,28 @@
 #include <unistd.h>
 
+/* What backs the heap, see mem_set_pages() */
+#define MEM_PAGES_BASE    0   /* the system's base pages */
+#define MEM_PAGES_THP     1   /* transparent huge pages, through madvise() */
+#define MEM_PAGES_HUGETLB 2   /* huge pages from the hugetlb pool */
+#define MEM_HUGE_PAGE (2UL << 20)
+
+void mem_set_pages(int pages);
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_heap_zero(void);
 size_t mem_heapsize(void);
+size_t mem_mappedsize(void);
+size_t mem_peaksize(void);
+size_t mem_residentsize(void);
 size_t mem_pagesize(void);
+size_t mem_heap_pagesize(void);
+
+void *mem_map(size_t size);
+void *mem_remap(void *addr, size_t size);
+void mem_unmap(void *addr);
+int mem_is_mapped(void *lo, void *hi);
 
@@ -1,19 +1,83 @@
 /*
- * mm-naive.c - The fastest, least memory-efficient malloc package.
- * 
- * In this naive approach, a block is allocated by simply incrementing
- * the brk pointer.  A block is pure payload. There are no headers or
- * footers.  Blocks are never coalesced or reused. Realloc is
- * implemented directly using mm_malloc and mm_free.
+ * mm.c - segregated explicit free lists for small blocks, a size-ordered
+ *        splay tree for large ones.
  *
- * NOTE TO STUDENTS: Replace this header comment with your own header
- * comment that gives a high level description of your solution.
+ * Every block starts with a 4-byte header holding its size and control
+ * bits (see the layout below), placed right before an 8-byte boundary so
+ * that payloads are aligned. Allocated blocks have no footer, free blocks
+ * repeat the header in a footer and keep prev/next free-list links in
+ * their first two payload words. The links are 32-bit offsets from the
+ * start of the heap, which memlib keeps far below 4 GB, so no block is
+ * smaller than MIN_FREE_BLOCK_SZ = 16 bytes. A zero-sized allocated
+ * epilogue header ends the heap.
+ *
+ * Free blocks below TREE_MIN_SIZE are kept in NUM_CLASSES lists by size:
+ * 16-byte wide classes up to SMALL_CLASS_MAX bytes, power-of-two classes
+ * above that. Bit c of seg_bitmap is set iff list c is non-empty, so once
+ * the list of the request's own class has no fit, the first non-empty
+ * larger class, whose every block fits, is found with one
+ * count-trailing-zeros. Freed blocks are coalesced immediately and pushed
+ * on the front of their list.
+ *
+ * Free blocks of TREE_MIN_SIZE bytes and more live in a top-down splay
+ * tree keyed by (size, address), whose child links reuse the list link
+ * words. Large requests, and small ones that no list can serve, take the
+ * best fit from the tree, the lowest-addressed one among equal sizes.
+ *
+ * Requests of mmap_threshold bytes and more get a memlib mapping of their
+ * own instead, which mm_free() unmaps and mm_realloc() remaps. And when
+ * mm_free() leaves more than trim_threshold bytes free at the end of the
+ * heap, it shrinks the heap to give the pages back. Like glibc, freeing a
+ * mapped block raises mmap_threshold to its size (and trim_threshold to
+ * twice that), so a program that keeps allocating blocks of one large
+ * size soon gets them from the heap rather than mmap() and munmap()ing
+ * each of them.
+ *
+ * mm_memalign() carves a block whose payload is aligned to any power of
+ * two out of a free block, and gives the gap in front of it back to the
+ * free lists. mm_calloc() only clears the part of a block that was in
+ * use before: memlib knows from which address on its heap still reads
+ * as zeros, and mapped blocks are zeros anyway.
+ *
+ * mm_malloc_batch() serves n requests of one size from a single free
+ * block, cut into n blocks that are adjacent in memory. mm_free_batch()
+ * sorts the blocks it is given by address, and frees each run of
+ * adjacent blocks as one block, so a run is coalesced only once.
+ *
+ * Requests of up to SLAB_MAX bytes skip all that and come from slab runs:
+ * RUN_SIZE-aligned heap blocks, one object size each, with a bitmap of
+ * their free objects in a header at the start of the run. The objects
+ * themselves have no header; run_map marks the heap pages that are runs,
+ * and the run of an object is its address rounded down to RUN_SIZE.
+ *
+ * All of this state lives in an arena_t. mm_malloc() and friends use the
+ * one arena on memlib's heap. The mm_mt_*() functions at the end of the
+ * file split the heap into several arenas for multi-threaded programs.
+ *
+ * mm_check_level turns on checks of the main heap as mm_malloc() and
+ * friends run (build with -DMM_CHECK=<level> to change its default):
+ *   1  check the header and the neighbours of every block a request
+ *      is given or hands back, which costs O(1) per request
+ *   2  also audit the whole heap every mm_check_every requests
+ *   3  audit the whole heap on every request
+ * The first inconsistency found is reported and ends the program.
+ *
+ * mm_prof_hook, while it is set, is called at each profiling point of
+ * mm.h with the TSC cycles a step of the heap took, or for a search
+ * with the number of free blocks it looked at. The steps do not nest,
+ * except that a slab allocation includes the heap steps of setting up
+ * a new run. With the hook NULL every timing point costs one test, and
+ * the counting of a search one test of a local per block it looks at.
+ * Only set the hook while a single thread is in mm.c.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -39,330 +103,1836 @@ team_t team = {
 /* rounds up to the nearest multiple of ALIGNMENT */
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
 
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+#define WSIZE 4 // size of a header, a footer and a free-list link
+
+#define MIN_FREE_BLOCK_SZ 16 // header, two links and footer; minimun size of any block
 
-#define MIN_FREE_BLOCK_SZ 32 // 2 * ALIGNMENT + 2 * SIZE_T_SIZE; minimun size of free block
+#define SMALL_CLASS_MAX 128 // blocks up to this size get 16-byte wide classes
+#define TREE_MIN_SIZE 512   // free blocks at least this large go to the free tree
+#define NUM_CLASSES 10      // segregated free lists below TREE_MIN_SIZE, one bit each in seg_bitmap
+// spare room mm_realloc() keeps in a block it grows to size bytes
+#define REALLOC_RESERVE(size) ALIGN((size) >> 4)
+#define MMAP_THRESHOLD (128*1024)       // initial mmap_threshold
+#define MMAP_THRESHOLD_MAX (4*1024*1024) // freed mapped blocks raise it up to this
+#define TRIM_KEEP (64*1024)             // free bytes trim_heap() leaves at the end of the heap
+#define BATCH_ISORT_MAX 16              // mm_free_batch() insertion-sorts up to this many blocks
+#define SLAB_MAX 128                    // mm_malloc() serves requests up to this size from slabs
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT) // one per object size
+#define RUN_SIZE 4096                   // size and alignment of a slab run
+#define RUN_MAP_WORDS (RUN_SIZE / ALIGNMENT / 64) // enough bits for the smallest objects
+#define RUN_PAGES_MAX ((1ULL << 32) / RUN_SIZE)   // heap pages in 4 GB
+#ifndef MM_CHECK
+#define MM_CHECK 0                      // initial mm_check_level
+#endif
+#define MM_CHECK_EVERY 1024             // initial mm_check_every
 
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
-// get value pointed to by void pointer
-#define GET(p) (*(unsigned long *)(p))
-// set val to the location pointed to by void pointer
-#define PUT(p, val) (*(unsigned long *)(p) = (unsigned long) (val))
-// get the size of free block
-#define GET_SIZE(p) (*(size_t *)(p) & ~0x7)
+// get the word pointed to by void pointer
+#define GET(p) (*(unsigned int *)(p))
+// set val to the word pointed to by void pointer
+#define PUT(p, val) (*(unsigned int *)(p) = (unsigned int) (val))
+// get and set a whole pointer, in the payload of a block
+#define GET_PTR(p) (*(void **)(p))
+#define PUT_PTR(p, val) (*(void **)(p) = (val))
+// get the size of the block at p
+#define GET_SIZE(p) ((size_t) (GET(p) & ~0x7))
+// control bits of the block at p
+#define IS_ALLOC(p) (GET(p) & 0x1)
+#define IS_PREV_ALLOC(p) (GET(p) & 0x2)
+#define IS_MMAPPED(p) (GET(p) & 0x4)
 
 // arithmatic of void pointer
 #define VOID_ADD(p, x) ((char *)(p) + (x))
 #define VOID_DEL(p, x) ((char *)(p) - (x))
 
-void *HEADER; // head block base-address of the heap
-void *TAILER; // tail block base-address of the heap
+// links are offsets of blocks from the start of arena a's heap, 0 for NULL
+#define TO_OFFSET(a, p) ((p) == NULL ? 0 : (unsigned int) ((char *)(p) - (a)->base))
+#define TO_BLOCK(a, off) ((off) == 0 ? NULL : (void *) ((a)->base + (off)))
+
+// free-list links of free block p in arena a
+#define PREV_NODE(a, p) TO_BLOCK(a, GET(VOID_ADD(p, WSIZE)))
+#define NEXT_NODE(a, p) TO_BLOCK(a, GET(VOID_ADD(p, 2 * WSIZE)))
+#define SET_PREV_NODE(a, p, q) PUT(VOID_ADD(p, WSIZE), TO_OFFSET(a, q))
+#define SET_NEXT_NODE(a, p, q) PUT(VOID_ADD(p, 2 * WSIZE), TO_OFFSET(a, q))
+
+// children of free tree block p, stored in the list link words
+#define LEFT_NODE(a, p) PREV_NODE(a, p)
+#define RIGHT_NODE(a, p) NEXT_NODE(a, p)
+#define SET_LEFT_NODE(a, p, q) SET_PREV_NODE(a, p, q)
+#define SET_RIGHT_NODE(a, p, q) SET_NEXT_NODE(a, p, q)
+
+// free tree order: by size, then by address
+#define KEY_LESS(asz, a, bsz, b) ((asz) < (bsz) || ((asz) == (bsz) && (char *)(a) < (char *)(b)))
+
+// an independent heap with its own free lists
+typedef struct {
+    void *seg_heads[NUM_CLASSES]; // first free block of each size class, NULL if empty
+    unsigned int seg_bitmap;      // bit c is set iff seg_heads[c] != NULL
+    void *free_tree;              // root of the splay tree of large free blocks, NULL if empty
+    void *tailer;                 // epilogue block at the end of the heap
+    char *base;                   // start of the heap, free-list links are offsets from here
+    char *brk, *limit;            // heap carved out of memlib's; limit NULL: grow with mem_sbrk()
+} arena_t;
+
+static arena_t main_arena; // the arena behind mm_malloc(), mm_free() and mm_realloc()
+static size_t mmap_threshold; // mm_malloc() maps requests this large on their own
+static size_t trim_threshold; // mm_free() shrinks the heap once this much is free at its end
+
+// header of a slab run, its objects follow at RUN_OBJS
+typedef struct slab_run {
+    struct slab_run *prev, *next; // runs of this size that have free objects
+    unsigned int size;            // object size
+    unsigned int recip;           // 2^32 / size rounded up, for index = offset * recip >> 32
+    unsigned int nfree;           // number of free objects
+    unsigned int nobjs;           // number of objects
+    unsigned long long free_map[RUN_MAP_WORDS]; // bit i is set iff object i is free
+} slab_run_t;
+#define RUN_OBJS ALIGN(sizeof(slab_run_t))
+
+static slab_run_t *slab_runs[SLAB_CLASSES];      // runs with free objects, by object size
+static unsigned char run_map[RUN_PAGES_MAX / 8]; // bit p is set iff main heap page p is a run
+static size_t run_pages_hi;                      // no bit at or past this page is set
+
+int mm_check_level = MM_CHECK;       // which checks run, see the top of the file
+int mm_check_every = MM_CHECK_EVERY; // requests between audits at level 2
+static unsigned long check_ops;      // requests checked so far
+
+void (*mm_prof_hook)(int point, unsigned long long value); // profiler, see the top of the file
+
+// read the cycle counter at the start of a step, and pass what the step
+// took to the profiler at its end, as long as there is a profiler
+#define PROF_START() (mm_prof_hook != NULL ? prof_tsc() : 0)
+#define PROF_END(point, start) do { if (mm_prof_hook != NULL) mm_prof_hook(point, prof_tsc() - (start)); } while (0)
+// count a free block a search looks at, if it is being counted
+#define PROF_SCAN(scanned) do { if ((scanned) != NULL) (*(scanned))++; } while (0)
+
+// check the block a request touches, and audit the heap when it is time
+#define CHECK_OP(ptr) do { if (mm_check_level > 0) check_op(ptr); } while (0)
+#define CHECK_BLOCK(ptr) do { if (mm_check_level > 0 && (ptr) != NULL) check_block(ptr); } while (0)
 
 int mm_check_free_list(); // check function
-void rm_free_node_from_list(void *ptr);  // remove a free block node from implicit free list
-void insert_free_node_into_list(void *ptr); // insert a free block node into implicit free list, inserted node is next to HEADER
+void rm_free_node_from_list(arena_t *a, void *ptr);  // remove a free block node from its segregated free list
+void insert_free_node_into_list(arena_t *a, void *ptr); // push a free block node on the front of its segregated free list
+
+static int arena_init(arena_t *a, char *base, size_t size);
+static void *arena_malloc(arena_t *a, size_t size);
+static void *arena_malloc_aligned(arena_t *a, size_t size, size_t align);
+static void arena_free(arena_t *a, void *ptr);
+static void *arena_realloc(arena_t *a, void *ptr, size_t size);
+static void *coalesce(arena_t *a, void *ptr);
+static void *extend_heap(arena_t *a, size_t size);
+static void *place(arena_t *a, void *ptr, size_t size);
+static void shrink_block(arena_t *a, void *ptr, size_t size);
+static int grow_block(arena_t *a, void *ptr, size_t size, size_t want);
+static void *map_block(size_t size);
+static void *remap_block(void *ptr, size_t size);
+static void trim_heap(arena_t *a);
+static void *slab_malloc(size_t size);
+static void slab_free(slab_run_t *run, void *ptr);
+static slab_run_t *slab_run_of(void *ptr);
+static void *main_malloc(size_t size);
+static void *main_realloc(void *ptr, size_t size);
+static void *main_calloc(size_t size);
+static void main_free(void *ptr);
+static int main_malloc_batch(size_t size, int n, void **out);
+static int slab_malloc_batch(size_t size, int n, void **out);
+static int arena_malloc_batch(arena_t *a, size_t size, int n, void **out);
+static void check_op(void *ptr);
+static void check_block(void *ptr);
+
+// the time stamp counter, or nanoseconds where there is none
+static inline unsigned long long prof_tsc(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int hi, lo;
+
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long) hi << 32) | lo;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
 
 /* 
  * mm_init - initialize the malloc package.
  */
 int mm_init(void)
 {
-    // init heap
-    mem_init();
+    // the heap itself was set up by mem_init(), and is reset by mem_reset_brk()
+    mmap_threshold = MMAP_THRESHOLD;
+    trim_threshold = 2 * MMAP_THRESHOLD;
+    memset(slab_runs, 0, sizeof(slab_runs));
+    memset(run_map, 0, (run_pages_hi + 7) / 8);
+    run_pages_hi = 0;
+    return arena_init(&main_arena, NULL, 0);
+}
 
-    // init explicit free list, construct dummy header and tailer nodes
-    if (mem_sbrk(ALIGN(3 * SIZE_T_SIZE + 4 * ALIGNMENT)) == (void *) -1) {
-        printf("mem_sbrk fail");
-        return -1;
-    }
-    // double linked list header <=> tailer
-    void *first = mem_heap_lo();
-    void *last = mem_heap_hi();
+// grow arena a's heap by incr bytes, returns the old break or (void *) -1
+static void *arena_sbrk(arena_t *a, size_t incr)
+{
+    char *old_brk = a->brk;
+    unsigned long long start;
 
-    size_t tail_blk_sz = ALIGN(SIZE_T_SIZE + 2 * ALIGNMENT);
-    void *tailer_start = VOID_DEL(last, tail_blk_sz - 1);
-    PUT(VOID_DEL(last, ALIGNMENT - 1), 0); //init tailer node's next pointer
-    PUT(tailer_start, 0x3); // init tailer node's size to 0, and prev block is allocated
+    if (a->limit == NULL) {
+        start = PROF_START();
+        old_brk = mem_sbrk(incr);
+        PROF_END(MM_PROF_GROW, start);
+        return old_brk;
+    }
+    if (incr > (size_t) (a->limit - a->brk)) {
+        return (void *) -1;
+    }
+    a->brk += incr;
+    return old_brk;
+}
 
-    PUT(first, 0x1); // init header node's size to 0 and alloc-control-bit to 1 
-    PUT(VOID_ADD(first, SIZE_T_SIZE), 0); // init header node's prev pointer
-    PUT(VOID_ADD(first, ALIGNMENT + SIZE_T_SIZE), tailer_start); // init header node's next pointer
-    PUT(VOID_ADD(first, ALIGNMENT + 2 * SIZE_T_SIZE), 0x1); // init header node's footer
-   
-    PUT(VOID_ADD(tailer_start, SIZE_T_SIZE), first); // init tailer node's prev node pointer
-    PUT(VOID_ADD(first, ALIGNMENT + SIZE_T_SIZE), tailer_start); // init header node's next node pointer
+// set up an empty arena on size bytes at base, or on memlib's heap if base is NULL
+static int arena_init(arena_t *a, char *base, size_t size)
+{
+    int i;
 
-    HEADER = first;
-    TAILER = tailer_start;
+    a->brk = base;
+    a->limit = (base == NULL) ? NULL : base + size;
+    void *first = arena_sbrk(a, 2 * WSIZE);
+    if (first == (void *) -1) {
+        printf("mem_sbrk fail");
+        return -1;
+    }
+    // one word of padding puts every block header 4 bytes before an 8-byte boundary
+    a->base = first;
+    a->tailer = VOID_ADD(first, WSIZE);
+    PUT(a->tailer, 0x3); // epilogue: size 0, allocated, "previous block" allocated
 
+    for (i = 0; i < NUM_CLASSES; i++) {
+        a->seg_heads[i] = NULL;
+    }
+    a->seg_bitmap = 0;
+    a->free_tree = NULL;
     return 0;
 }
 
 /*
   header and footer layout:
-    +----------- 64 ------------+
+    +----------- 32 ------------+
     |     block size    | 0 0 1 |
     +---------------------------+
     the lowest 3 bits is control-bit:
     1.first bit presents if this block is allocated
     2.second bit presents if the previous block is allocated
-    3.third bit retains
+    3.third bit presents if this block is a mapping of its own (allocated
+      blocks only, the size is that of the mapping, whose first word is
+      padding)
 */
 
+// size class of a block of size bytes, size < TREE_MIN_SIZE
+static int size_class(size_t size)
+{
+    if (size <= SMALL_CLASS_MAX) {
+        return (size - MIN_FREE_BLOCK_SZ) >> 4; // [16, 24] -> 0, ..., [128] -> 7
+    }
+    // (128, 256] -> 8, (256, 512) -> 9
+    return 8 * sizeof(unsigned long) - __builtin_clzl((unsigned long) (size - 1));
+}
+
+/*
+ * tree_splay - top-down splay of the subtree t around key (size, addr):
+ *     returns the new root, the block with that key if it is in t, else
+ *     the last block visited searching for it. Adds the blocks visited
+ *     to *scanned unless it is NULL.
+ */
+static void *tree_splay(arena_t *a, void *t, size_t size, void *addr, unsigned long *scanned)
+{
+    void *l = NULL, *r = NULL;           // last blocks of the left and right side trees
+    void *l_root = NULL, *r_root = NULL; // and their roots
+    void *lt, *rt, *y;
+
+    while (1) {
+        PROF_SCAN(scanned);
+        if (KEY_LESS(size, addr, GET_SIZE(t), t)) {
+            if ((y = LEFT_NODE(a, t)) == NULL) {
+                break;
+            }
+            if (KEY_LESS(size, addr, GET_SIZE(y), y)) { // rotate right
+                SET_LEFT_NODE(a, t, RIGHT_NODE(a, y));
+                SET_RIGHT_NODE(a, y, t);
+                t = y;
+                if (LEFT_NODE(a, t) == NULL) {
+                    break;
+                }
+            }
+            // link right
+            if (r == NULL) {
+                r_root = t;
+            } else {
+                SET_LEFT_NODE(a, r, t);
+            }
+            r = t;
+            t = LEFT_NODE(a, t);
+        } else if (KEY_LESS(GET_SIZE(t), t, size, addr)) {
+            if ((y = RIGHT_NODE(a, t)) == NULL) {
+                break;
+            }
+            if (KEY_LESS(GET_SIZE(y), y, size, addr)) { // rotate left
+                SET_RIGHT_NODE(a, t, LEFT_NODE(a, y));
+                SET_LEFT_NODE(a, y, t);
+                t = y;
+                if (RIGHT_NODE(a, t) == NULL) {
+                    break;
+                }
+            }
+            // link left
+            if (l == NULL) {
+                l_root = t;
+            } else {
+                SET_RIGHT_NODE(a, l, t);
+            }
+            l = t;
+            t = RIGHT_NODE(a, t);
+        } else {
+            break;
+        }
+    }
+    // assemble
+    lt = LEFT_NODE(a, t);
+    rt = RIGHT_NODE(a, t);
+    if (l == NULL) {
+        l_root = lt;
+    } else {
+        SET_RIGHT_NODE(a, l, lt);
+    }
+    if (r == NULL) {
+        r_root = rt;
+    } else {
+        SET_LEFT_NODE(a, r, rt);
+    }
+    SET_LEFT_NODE(a, t, l_root);
+    SET_RIGHT_NODE(a, t, r_root);
+    return t;
+}
+
+static void tree_insert(arena_t *a, void *ptr)
+{
+    size_t size = GET_SIZE(ptr);
+    void *t;
+
+    if (a->free_tree == NULL) {
+        SET_LEFT_NODE(a, ptr, NULL);
+        SET_RIGHT_NODE(a, ptr, NULL);
+    } else {
+        t = tree_splay(a, a->free_tree, size, ptr, NULL);
+        if (KEY_LESS(size, ptr, GET_SIZE(t), t)) {
+            SET_LEFT_NODE(a, ptr, LEFT_NODE(a, t));
+            SET_RIGHT_NODE(a, ptr, t);
+            SET_LEFT_NODE(a, t, NULL);
+        } else {
+            SET_RIGHT_NODE(a, ptr, RIGHT_NODE(a, t));
+            SET_LEFT_NODE(a, ptr, t);
+            SET_RIGHT_NODE(a, t, NULL);
+        }
+    }
+    a->free_tree = ptr;
+}
+
+static void tree_remove(arena_t *a, void *ptr)
+{
+    size_t size = GET_SIZE(ptr);
+    void *t = tree_splay(a, a->free_tree, size, ptr, NULL); // t == ptr
+
+    if (LEFT_NODE(a, t) == NULL) {
+        a->free_tree = RIGHT_NODE(a, t);
+    } else {
+        // ptr is larger than every key on its left, so this splays up their maximum
+        a->free_tree = tree_splay(a, LEFT_NODE(a, t), size, ptr, NULL);
+        SET_RIGHT_NODE(a, a->free_tree, RIGHT_NODE(a, t));
+    }
+}
+
+// smallest free tree block of at least size bytes, lowest address first;
+// adds the blocks it looked at to *scanned unless that is NULL
+static void *tree_best_fit(arena_t *a, size_t size, unsigned long *scanned)
+{
+    void *t;
+
+    if (a->free_tree == NULL) {
+        return NULL;
+    }
+    a->free_tree = t = tree_splay(a, a->free_tree, size, NULL, scanned); // (size, NULL) sorts before every block of size
+    if (GET_SIZE(t) >= size) {
+        return t;
+    }
+    // t is the largest smaller block, the answer is its successor
+    if ((t = RIGHT_NODE(a, t)) == NULL) {
+        return NULL;
+    }
+    while (LEFT_NODE(a, t) != NULL) {
+        PROF_SCAN(scanned);
+        t = LEFT_NODE(a, t);
+    }
+    return t;
+}
+
+// find a free block of at least size bytes, NULL if there is none;
+// adds the blocks it looked at to *scanned unless that is NULL
+static void *search_fit(arena_t *a, size_t size, unsigned long *scanned)
+{
+    int c;
+    unsigned int larger;
+    void *curr;
+
+    if (size >= TREE_MIN_SIZE) {
+        return tree_best_fit(a, size, scanned);
+    }
+    // blocks in the request's own class may still be too small
+    c = size_class(size);
+    for (curr = a->seg_heads[c]; curr != NULL; curr = NEXT_NODE(a, curr)) {
+        PROF_SCAN(scanned);
+        if (size <= GET_SIZE(curr)) {
+            return curr;
+        }
+    }
+    // every block of a larger class fits, take the first non-empty one
+    larger = a->seg_bitmap & (~0u << (c + 1));
+    if (larger != 0) {
+        PROF_SCAN(scanned);
+        return a->seg_heads[__builtin_ctz(larger)];
+    }
+    return tree_best_fit(a, size, scanned);
+}
+
+// search_fit(), timed and counted for the profiler if there is one
+static void *find_fit(arena_t *a, size_t size)
+{
+    unsigned long long start;
+    unsigned long scanned = 0;
+    void *ptr;
+
+    if (mm_prof_hook == NULL) {
+        return search_fit(a, size, NULL);
+    }
+    start = prof_tsc();
+    ptr = search_fit(a, size, &scanned);
+    mm_prof_hook(MM_PROF_FIND_FIT, prof_tsc() - start);
+    mm_prof_hook(MM_PROF_SCANNED, scanned);
+    return ptr;
+}
+
 /* 
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- *     Always allocate a block whose size is a multiple of the alignment.
+ * mm_malloc - Allocate a block from the segregated free lists, growing
+ *     the heap if none fits. The block size is a multiple of the alignment.
  */
 void *mm_malloc(size_t size)
 {
-    if (size == 0) {
+    void *ptr = main_malloc(size);
+
+    CHECK_OP(ptr);
+    return ptr;
+}
+
+static void *main_malloc(size_t size)
+{
+    unsigned long long start;
+    void *ptr;
+
+    if (size - 1 < SLAB_MAX) { // 0 < size <= SLAB_MAX
+        start = PROF_START();
+        ptr = slab_malloc(size);
+        PROF_END(MM_PROF_SLAB, start);
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+    if (size >= mmap_threshold && (ptr = map_block(size)) != NULL) {
+        return ptr;
+    }
+    return arena_malloc(&main_arena, size);
+}
+
+// round a block of size bytes up to whole pages
+static size_t map_size(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+
+    return (size + pagesize - 1) & ~(pagesize - 1);
+}
+
+// give a large request a mapping of its own, NULL if there is none; like
+// in the heap, the header is the word before the 8-byte aligned payload
+static void *map_block(size_t size)
+{
+    size_t map_sz = map_size(size + ALIGNMENT);
+    void *map;
+
+    if ((map = mem_map(map_sz)) == NULL) {
         return NULL;
     }
+    PUT(VOID_ADD(map, WSIZE), map_sz | 0x5); // allocated, mapped
+    return VOID_ADD(map, ALIGNMENT);
+}
 
-    // adjust size to align ALIGNMENT bytes
-    size_t resize = MAX(MIN_FREE_BLOCK_SZ, ALIGN(size + SIZE_T_SIZE)); // allocated block has no footer, only header
-
-    // look through explicit free list
-    void *curr = HEADER;
-    while(curr != NULL) {
-        size_t curr_sz = GET_SIZE(curr);
-        if (resize <= curr_sz) {
-            // match
-            // split curr free block if necessary
-            if (resize + MIN_FREE_BLOCK_SZ <= curr_sz) { // split it and use lower-bit part as allocated block 
-                // 1.update old free block's meta-data
-                void *prev_node_ptr = (void *) GET((void *) VOID_ADD(curr, SIZE_T_SIZE)); // get previous free node pointer
-                void *next_node_ptr = (void *) GET((void *) VOID_ADD(curr, SIZE_T_SIZE + ALIGNMENT)); // get next free node pointer
-                void *old_ptr = (void *) VOID_ADD(curr, resize); // use second part as old free block
-                PUT(old_ptr, (curr_sz - resize) | 0x2); // set header
-                PUT(VOID_ADD(old_ptr, SIZE_T_SIZE), prev_node_ptr); // set previous free node pointer
-                PUT(VOID_ADD(old_ptr, SIZE_T_SIZE + ALIGNMENT), next_node_ptr); // set next free node pointer
-                PUT(VOID_ADD(old_ptr, curr_sz - resize - SIZE_T_SIZE), (curr_sz - resize) | 0x2); // set footer
-                PUT(VOID_ADD(prev_node_ptr, SIZE_T_SIZE + ALIGNMENT), old_ptr); // set previous-free-block's next pointer
-                PUT(VOID_ADD(next_node_ptr, SIZE_T_SIZE), old_ptr); // set next-free-block's prev pointer 
-
-                // 2.construct allocated block
-                unsigned long old_sz_bit_mask = (GET(curr) & 0x6); // get old 2 control bits
-                PUT(curr, (resize | old_sz_bit_mask) | 0x1); // set header's size and remain old control-bit
-
-                // 3.return the base address of payload 
-                return (void *) VOID_ADD(curr, SIZE_T_SIZE);
-            } else { // not split and use whole block as allocated block (剩余的空闲块大小不满足MIN_FREE_BLOCK_SZ条件，存不下指向前后空闲块的指针)
-                // 1.update header
-                void *next_block_ptr = (void *) VOID_ADD(curr, curr_sz);
-                PUT(next_block_ptr, GET(next_block_ptr) | 0x2); // update next block's header
-                PUT(curr, GET(curr) | 0x1); // update this block's header
-
-                // 2.remove curr block from implicit free list
-                rm_free_node_from_list(curr);
-
-                // 3.return the base address of payload 
-                return  (void *) VOID_ADD(curr, SIZE_T_SIZE);
-            }
+// resize mapped block ptr, moving it back into the heap once it is small
+static void *remap_block(void *ptr, size_t size)
+{
+    void *map = VOID_DEL(ptr, ALIGNMENT);
+    size_t map_sz = map_size(size + ALIGNMENT);
+    void *newptr;
+
+    if (size < mmap_threshold) {
+        if ((newptr = arena_malloc(&main_arena, size)) == NULL) {
+            return NULL;
+        }
+        memcpy(newptr, ptr, size); // the old payload is larger
+        mem_unmap(map);
+        return newptr;
+    }
+    if (map_sz == GET_SIZE(VOID_DEL(ptr, WSIZE))) {
+        return ptr;
+    }
+    if ((map = mem_remap(map, map_sz)) == NULL) {
+        return NULL;
+    }
+    PUT(VOID_ADD(map, WSIZE), map_sz | 0x5);
+    return VOID_ADD(map, ALIGNMENT);
+}
+
+// the slab run ptr is in, NULL if ptr is not a slab object
+static slab_run_t *slab_run_of(void *ptr)
+{
+    size_t page = (size_t) ((char *) ptr - main_arena.base) / RUN_SIZE; // huge if ptr is below the heap
+
+    if (page < run_pages_hi && (run_map[page >> 3] & (1 << (page & 7)))) {
+        return (slab_run_t *) ((unsigned long) ptr & ~(unsigned long) (RUN_SIZE - 1));
+    }
+    return NULL;
+}
+
+// set up a new run for objects of size bytes and make it the first of its class
+static slab_run_t *slab_new_run(size_t size)
+{
+    // the last word of the page is the next block's header, so runs fill whole pages
+    slab_run_t *run = arena_malloc_aligned(&main_arena, RUN_SIZE - WSIZE, RUN_SIZE);
+    size_t page;
+    int i;
+
+    if (run == NULL) {
+        return NULL;
+    }
+    run->size = size;
+    run->recip = (unsigned int) (((1ULL << 32) + size - 1) / size);
+    run->nobjs = run->nfree = (RUN_SIZE - WSIZE - RUN_OBJS) / size;
+    for (i = 0; i < RUN_MAP_WORDS; i++) {
+        if ((i + 1) * 64 <= run->nobjs) {
+            run->free_map[i] = ~0ULL;
+        } else if (i * 64 < run->nobjs) {
+            run->free_map[i] = (1ULL << (run->nobjs - i * 64)) - 1;
         } else {
-            // check next block
-            unsigned long next = GET(VOID_ADD(curr, SIZE_T_SIZE + ALIGNMENT));
-            if (next == 0) {
-                // no match blocks
-                break;
-            }
-            curr = (void *) next;
+            run->free_map[i] = 0;
+        }
+    }
+    run->prev = NULL;
+    run->next = slab_runs[size / ALIGNMENT - 1];
+    if (run->next != NULL) {
+        run->next->prev = run;
+    }
+    slab_runs[size / ALIGNMENT - 1] = run;
+
+    page = (size_t) ((char *) run - main_arena.base) / RUN_SIZE;
+    run_map[page >> 3] |= 1 << (page & 7);
+    if (page >= run_pages_hi) {
+        run_pages_hi = page + 1;
+    }
+    return run;
+}
+
+// take the lowest free object of the first run of size's class, NULL if no run can be had
+static void *slab_malloc(size_t size)
+{
+    int c = (size - 1) / ALIGNMENT;
+    slab_run_t *run = slab_runs[c];
+    int w, i;
+
+    if (run == NULL && (run = slab_new_run((c + 1) * ALIGNMENT)) == NULL) {
+        return NULL;
+    }
+    for (w = 0; run->free_map[w] == 0; w++) {
+    }
+    i = __builtin_ctzll(run->free_map[w]);
+    run->free_map[w] &= run->free_map[w] - 1;
+    if (--run->nfree == 0) { // full runs leave the list
+        slab_runs[c] = run->next;
+        if (run->next != NULL) {
+            run->next->prev = NULL;
+        }
+    }
+    return VOID_ADD(run, RUN_OBJS + (w * 64 + i) * run->size);
+}
+
+// put object ptr back in its run; an empty run goes back to the heap
+// unless it is the only one left of its class and nothing but free
+// space lies above it, where keeping it would stop trim_heap()
+static void slab_free(slab_run_t *run, void *ptr)
+{
+    int c = run->size / ALIGNMENT - 1;
+    unsigned int i = ((unsigned long long) ((char *) ptr - (char *) run - RUN_OBJS) * run->recip) >> 32;
+    void *next = VOID_ADD(run, RUN_SIZE - WSIZE); // header of the block after the run
+    size_t page;
+
+    run->free_map[i >> 6] |= 1ULL << (i & 63);
+    if (run->nfree++ == 0) { // no longer full, back to the front of the list
+        run->prev = NULL;
+        run->next = slab_runs[c];
+        if (run->next != NULL) {
+            run->next->prev = run;
         }
+        slab_runs[c] = run;
+        return;
+    }
+    if (run->nfree < run->nobjs) {
+        return;
+    }
+    if (run->prev == NULL && run->next == NULL && next != main_arena.tailer
+            && (IS_ALLOC(next) || VOID_ADD(next, GET_SIZE(next)) != main_arena.tailer)) {
+        return;
+    }
+    if (run->prev != NULL) {
+        run->prev->next = run->next;
+    } else {
+        slab_runs[c] = run->next;
+    }
+    if (run->next != NULL) {
+        run->next->prev = run->prev;
+    }
+    page = (size_t) ((char *) run - main_arena.base) / RUN_SIZE;
+    run_map[page >> 3] &= ~(1 << (page & 7));
+    arena_free(&main_arena, run);
+    trim_heap(&main_arena);
+}
+
+static void *arena_malloc(arena_t *a, size_t size)
+{
+    if (size == 0) {
+        return NULL;
+    }
+
+    // adjust size to align ALIGNMENT bytes
+    size_t resize = MAX(MIN_FREE_BLOCK_SZ, ALIGN(size + WSIZE)); // allocated block has no footer, only header
+
+    void *curr = find_fit(a, resize);
+    if (curr == NULL && (curr = extend_heap(a, resize)) == NULL) {
+        return NULL;
     }
+    return place(a, curr, resize);
+}
 
-    // no capable free block, expanding heap
-    void *p = mem_sbrk(resize);
-    if (p == (void *) -1)
-	    return NULL;
-    else {
-        // 1.move tailer block to the end of physical heap
-        void *tailer = TAILER;
-        void *last = mem_heap_hi();
-        void *new_tail = VOID_DEL(last, ALIGN(SIZE_T_SIZE + 2 * ALIGNMENT) - 1);
-        void *tailer_prev_node_ptr = (void *) GET((void *) VOID_ADD(tailer, SIZE_T_SIZE)); // tailer block's prev free node
+// allocate a block whose payload of size bytes starts at a multiple of
+// align, a power of two, carving it out of a free block so that the space
+// in front of it stays free
+static void *arena_malloc_aligned(arena_t *a, size_t size, size_t align)
+{
+    size_t block_sz = MAX(MIN_FREE_BLOCK_SZ, ALIGN(size + WSIZE));
+    size_t free_sz, front_sz;
+    void *ptr, *block_ptr, *end;
+    char *aligned;
 
-        PUT(new_tail, GET(tailer) | 0x3); // set new tailer block's control-bit and size
-        PUT(VOID_ADD(new_tail, SIZE_T_SIZE), tailer_prev_node_ptr); // set new tailer block's prev-pointer
-        PUT(VOID_ADD(new_tail, SIZE_T_SIZE + ALIGNMENT), NULL); // set new tailer block's next-pointer
+    if ((ptr = find_fit(a, block_sz + align + MIN_FREE_BLOCK_SZ)) == NULL) {
+        // grow the heap just enough, the aligned block goes where it now ends
+        end = IS_PREV_ALLOC(a->tailer) ? a->tailer : VOID_DEL(a->tailer, GET_SIZE(VOID_DEL(a->tailer, WSIZE)));
+        aligned = (char *) (((unsigned long) end + WSIZE + align - 1) & ~(unsigned long) (align - 1));
+        front_sz = aligned - WSIZE - (char *) end;
+        if (front_sz != 0 && front_sz < MIN_FREE_BLOCK_SZ) {
+            front_sz += align;
+        }
+        if (end != a->tailer && GET_SIZE(end) >= front_sz + block_sz) {
+            ptr = end; // the free block at the end is large enough already
+        } else if ((ptr = extend_heap(a, front_sz + block_sz)) == NULL) {
+            return NULL;
+        }
+    }
+    // ptr is a free block with room for an aligned block behind a gap that
+    // is either empty or large enough to stay a free block
+    free_sz = GET_SIZE(ptr);
+    aligned = (char *) (((unsigned long) ptr + WSIZE + align - 1) & ~(unsigned long) (align - 1));
+    front_sz = aligned - WSIZE - (char *) ptr;
+    if (front_sz != 0 && front_sz < MIN_FREE_BLOCK_SZ) {
+        aligned += align;
+        front_sz += align;
+    }
+    rm_free_node_from_list(a, ptr);
+    block_ptr = VOID_DEL(aligned, WSIZE);
+    if (front_sz != 0) {
+        PUT(ptr, front_sz | 0x2); // a free block's previous block is allocated
+        PUT(VOID_ADD(ptr, front_sz - WSIZE), front_sz | 0x2);
+        insert_free_node_into_list(a, ptr);
+        PUT(block_ptr, (free_sz - front_sz) | 0x1);
+    } else {
+        PUT(block_ptr, free_sz | 0x3);
+    }
+    end = VOID_ADD(ptr, free_sz);
+    PUT(end, GET(end) | 0x2);
+    shrink_block(a, block_ptr, block_sz); // free what is left behind it
+    return aligned;
+}
 
-        // 2.construct allocated block
-        unsigned long new_control_bit = GET(tailer) & 0x7;
-        new_control_bit = new_control_bit | 0x1; // set first control-bit to 1
-        PUT(tailer, resize | new_control_bit); // set allocated block's header
+// allocate size bytes at the start of free block ptr, splitting off the rest
+// if it can still form a free block; returns the payload address
+static void *place(arena_t *a, void *ptr, size_t size)
+{
+    unsigned long long start = PROF_START();
+    size_t curr_sz = GET_SIZE(ptr);
 
-        // 3.update TAILER
-        TAILER = new_tail;
+    rm_free_node_from_list(a, ptr);
+    if (size + MIN_FREE_BLOCK_SZ <= curr_sz) {
+        // split it and use lower-bit part as allocated block
+        void *rest = VOID_ADD(ptr, size);
+        PUT(rest, (curr_sz - size) | 0x2); // set header, previous block is allocated
+        PUT(VOID_ADD(rest, curr_sz - size - WSIZE), (curr_sz - size) | 0x2); // set footer
+        insert_free_node_into_list(a, rest);
+        PUT(ptr, size | (GET(ptr) & 0x2) | 0x1); // keep ptr's prev-alloc bit
+    } else {
+        // not split and use whole block as allocated block
+        void *next_block_ptr = VOID_ADD(ptr, curr_sz);
+        PUT(next_block_ptr, GET(next_block_ptr) | 0x2); // update next block's header
+        PUT(ptr, GET(ptr) | 0x1); // update this block's header
+    }
+    PROF_END(MM_PROF_PLACE, start);
+    return VOID_ADD(ptr, WSIZE);
+}
 
-        // 4.update previous free block (of tailer) 's next node pointer
-        PUT(VOID_ADD(tailer_prev_node_ptr, SIZE_T_SIZE + ALIGNMENT), new_tail);
+// grow the heap so that a free block of at least size bytes ends it, and
+// return that block; a free block at the old heap end is reused
+static void *extend_heap(arena_t *a, size_t size)
+{
+    size_t incr = size;
+    void *ptr;
 
-        // 5.return the address of payload
-        return (void *) VOID_ADD(tailer, SIZE_T_SIZE);
+    if (!IS_PREV_ALLOC(a->tailer)) {
+        incr -= GET_SIZE(VOID_DEL(a->tailer, WSIZE)); // the last block is free and will be merged
     }
+    if (arena_sbrk(a, incr) == (void *) -1) {
+        return NULL;
+    }
+    // the old epilogue becomes the new block's header
+    ptr = a->tailer;
+    PUT(ptr, incr | (GET(ptr) & 0x2));
+    PUT(VOID_ADD(ptr, incr - WSIZE), incr | (GET(ptr) & 0x2));
+    a->tailer = VOID_ADD(ptr, incr);
+    PUT(a->tailer, 0x1); // new epilogue, its previous block is free
+    return coalesce(a, ptr);
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * mm_free - Free a block and coalesce it with its free neighbours.
  */
 void mm_free(void *ptr)
 {
-    // mm_check_free_list();
+    CHECK_OP(ptr);
+    main_free(ptr);
+}
+
+static void main_free(void *ptr)
+{
+    slab_run_t *run;
+    size_t size;
+
+    if ((run = slab_run_of(ptr)) != NULL) {
+        slab_free(run, ptr);
+        return;
+    }
+    if (ptr != NULL && IS_MMAPPED(VOID_DEL(ptr, WSIZE))) {
+        size = GET_SIZE(VOID_DEL(ptr, WSIZE)) - ALIGNMENT;
+        if (size > mmap_threshold && size <= MMAP_THRESHOLD_MAX) {
+            mmap_threshold = size;
+            trim_threshold = 2 * size;
+        }
+        mem_unmap(VOID_DEL(ptr, ALIGNMENT));
+        return;
+    }
+    arena_free(&main_arena, ptr);
+    trim_heap(&main_arena);
+}
+
+// shrink a's heap to TRIM_KEEP free bytes at its end if more than
+// trim_threshold are free there; memlib releases the pages
+static void trim_heap(arena_t *a)
+{
+    unsigned long long start;
+    size_t last_sz;
+    void *last;
+
+    if (IS_PREV_ALLOC(a->tailer)) {
+        return;
+    }
+    last_sz = GET_SIZE(VOID_DEL(a->tailer, WSIZE)); // footer of the last block
+    if (last_sz < trim_threshold) {
+        return;
+    }
+    last = VOID_DEL(a->tailer, last_sz);
+    rm_free_node_from_list(a, last);
+    PUT(last, TRIM_KEEP | 0x2);
+    PUT(VOID_ADD(last, TRIM_KEEP - WSIZE), TRIM_KEEP | 0x2);
+    insert_free_node_into_list(a, last);
+    a->tailer = VOID_ADD(last, TRIM_KEEP);
+    PUT(a->tailer, 0x1); // new epilogue, its previous block is free
+    start = PROF_START();
+    mem_sbrk(-(int) (last_sz - TRIM_KEEP));
+    PROF_END(MM_PROF_SHRINK, start);
+}
 
+static void arena_free(arena_t *a, void *ptr)
+{
     if (ptr == NULL) 
         return;
     
-    void *block_ptr = VOID_DEL(ptr, SIZE_T_SIZE); // block pointer
-    unsigned long pre_blk_alloc = GET(block_ptr) & 0x2; // flag presenting if physically previous block is allocated 
-    unsigned long block_sz = GET_SIZE(block_ptr); // block size
-    void *next_block_ptr = (void *) VOID_ADD(block_ptr, block_sz); // next block's pointer
-    unsigned long nxt_blk_alloc = GET(next_block_ptr) & 0x1; // flag presenting if physically next block is allocated
-
-    // check if block ptr can be coalesced and merge consecutive free blocks
-    void *new_block_ptr = block_ptr;
-    size_t new_block_size = (size_t) GET_SIZE(block_ptr);
+    void *block_ptr = VOID_DEL(ptr, WSIZE); // block pointer
+    size_t block_sz = GET_SIZE(block_ptr); // block size
+
+    PUT(block_ptr, block_sz | (GET(block_ptr) & 0x2)); // clear allocated bit
+    PUT(VOID_ADD(block_ptr, block_sz - WSIZE), GET(block_ptr)); // set footer
+    coalesce(a, block_ptr);
+}
+
+// merge free block ptr (header and footer set, not in any list) with its
+// free neighbours and insert the result into its free list
+static void *coalesce(arena_t *a, void *ptr)
+{
+    unsigned long long start = PROF_START();
+    unsigned long pre_blk_alloc = IS_PREV_ALLOC(ptr); // flag presenting if physically previous block is allocated 
+    size_t new_block_size = GET_SIZE(ptr);
+    void *next_block_ptr = VOID_ADD(ptr, new_block_size); // next block's pointer
+    unsigned long nxt_blk_alloc = IS_ALLOC(next_block_ptr); // flag presenting if physically next block is allocated
+    void *prev_block_ptr;
+
     if (pre_blk_alloc) {
         if (nxt_blk_alloc) {
             // case 1: prev block and next block are both allocated
-            PUT(new_block_ptr, new_block_size | 0x2); // set header of new free block
-            PUT(VOID_ADD(new_block_ptr, new_block_size-SIZE_T_SIZE), new_block_size | 0x2); // set footer of new free block
-            PUT(next_block_ptr, GET(next_block_ptr) & ~0x2); // set next block's control bit, cause its prev block is free
-
-            insert_free_node_into_list(new_block_ptr); // insert new_block_ptr to the implicit free list
         } else {
             // case 2: prev block is allocated, next block is free
-            void *nxt_prev_node_ptr = (void *) GET(VOID_ADD(next_block_ptr, SIZE_T_SIZE)); // get next block's prev node
-            void *nxt_next_node_ptr = (void *) GET(VOID_ADD(next_block_ptr, SIZE_T_SIZE + ALIGNMENT)); // get next block's next node
-            
-            PUT(VOID_ADD(nxt_prev_node_ptr, SIZE_T_SIZE + ALIGNMENT), (unsigned long) new_block_ptr); // set prev node's next node
-            PUT(VOID_ADD(nxt_next_node_ptr, SIZE_T_SIZE), (unsigned long) new_block_ptr); // set next node's prev node
-
+            rm_free_node_from_list(a, next_block_ptr);
             new_block_size += GET_SIZE(next_block_ptr);
-            
-            PUT(VOID_ADD(new_block_ptr, SIZE_T_SIZE), (unsigned long) nxt_prev_node_ptr); // set prev node of new free block
-            PUT(VOID_ADD(new_block_ptr, SIZE_T_SIZE + ALIGNMENT), (unsigned long) nxt_next_node_ptr); // set next node of new free block
-            PUT(new_block_ptr, new_block_size | 0x2); // set header
-            PUT(VOID_ADD(new_block_ptr, new_block_size-SIZE_T_SIZE), new_block_size | 0x2); // set footer
         }
     } else {
+        prev_block_ptr = VOID_DEL(ptr, GET_SIZE(VOID_DEL(ptr, WSIZE))); // previous block's address from its footer
+        rm_free_node_from_list(a, prev_block_ptr);
         if (nxt_blk_alloc) {
             // case 3: prev block is free, next block is allocated
-            void *prev_block_footer = (void *) VOID_DEL(new_block_ptr, SIZE_T_SIZE);
-            void *prev_block_ptr = (void *) VOID_DEL(new_block_ptr, GET_SIZE(prev_block_footer)); // previous block's address
-            void *new_block_footer = (void *) VOID_DEL(next_block_ptr, SIZE_T_SIZE); // new block's new footer
-
-            new_block_ptr = prev_block_ptr; // change block pointer
             new_block_size += GET_SIZE(prev_block_ptr);
-
-            unsigned long prev_block_control_bit = GET(prev_block_ptr) & 0x6; // get previous block's address
-            PUT(prev_block_ptr, new_block_size | prev_block_control_bit); // update new block's header
-            PUT(new_block_footer, new_block_size | prev_block_control_bit); // update new block's footer
-
-            PUT(next_block_ptr, GET(next_block_ptr) & ~0x2); // update next block's header
         } else {
             // case 4: prev is free, next is free
-            void *prev_block_footer = (void *) VOID_DEL(new_block_ptr, SIZE_T_SIZE);
-            void *prev_block_ptr = (void *) VOID_DEL(new_block_ptr, GET_SIZE(prev_block_footer)); // previous block's address
-            void *next_block_ptr = (void *) VOID_ADD(new_block_ptr, new_block_size); // next block's address
-            void *next_block_footer = (void *) VOID_ADD(next_block_ptr, GET_SIZE(next_block_ptr) - SIZE_T_SIZE); // new block's footer
-
-            rm_free_node_from_list(prev_block_ptr); // remove free block node
-            rm_free_node_from_list(next_block_ptr); // remove free block node
+            rm_free_node_from_list(a, next_block_ptr);
+            new_block_size += GET_SIZE(prev_block_ptr) + GET_SIZE(next_block_ptr);
+        }
+        ptr = prev_block_ptr;
+    }
 
-            new_block_ptr = prev_block_ptr; // change block pointer
-            new_block_size += (GET_SIZE(prev_block_ptr) + GET_SIZE(next_block_ptr));
+    // a free block's physically previous block is always allocated
+    PUT(ptr, new_block_size | 0x2); // set header
+    PUT(VOID_ADD(ptr, new_block_size - WSIZE), new_block_size | 0x2); // set footer
+    next_block_ptr = VOID_ADD(ptr, new_block_size);
+    PUT(next_block_ptr, GET(next_block_ptr) & ~0x2); // next block's previous block is free now
+    insert_free_node_into_list(a, ptr);
+    PROF_END(MM_PROF_COALESCE1 + (!nxt_blk_alloc) + 2 * (!pre_blk_alloc), start);
+    return ptr;
+}
 
-            unsigned long prev_block_control_bit = GET(prev_block_ptr) & 0x6; // get previous block's address
-            PUT(prev_block_ptr, new_block_size | prev_block_control_bit); // update new block's header
-            PUT(next_block_footer, new_block_size | prev_block_control_bit); // update new block's footer
+// cut allocated block ptr down to size bytes, freeing the tail if it can
+// form a free block on its own
+static void shrink_block(arena_t *a, void *ptr, size_t size)
+{
+    size_t old_sz = GET_SIZE(ptr);
+    void *rest;
 
-            insert_free_node_into_list(new_block_ptr); // insert into free list
-        }
+    if (old_sz < size + MIN_FREE_BLOCK_SZ) {
+        return;
     }
+    PUT(ptr, size | (GET(ptr) & 0x3));
+    rest = VOID_ADD(ptr, size);
+    PUT(rest, (old_sz - size) | 0x2); // set header, previous block is allocated
+    PUT(VOID_ADD(rest, old_sz - size - WSIZE), (old_sz - size) | 0x2); // set footer
+    coalesce(a, rest);
+}
+
+// try to grow allocated block ptr to at least size and at most want bytes
+// without moving it, by absorbing a free successor and, at the end of the
+// heap, growing the heap; returns 0 if the block has to move
+static int grow_block(arena_t *a, void *ptr, size_t size, size_t want)
+{
+    size_t avail = GET_SIZE(ptr);
+    void *next = VOID_ADD(ptr, avail);
+    void *end = next;
 
+    if (!IS_ALLOC(next)) {
+        avail += GET_SIZE(next);
+        end = VOID_ADD(next, GET_SIZE(next));
+    }
+    if (avail < size && end != a->tailer) {
+        return 0;
+    }
+    if (avail < size && arena_sbrk(a, want - avail) == (void *) -1) {
+        return 0;
+    }
+    if (!IS_ALLOC(next)) {
+        rm_free_node_from_list(a, next);
+    }
+    if (avail < size) {
+        // the heap grew by the difference, move the epilogue to its new end
+        avail = want;
+        a->tailer = VOID_ADD(ptr, want);
+        PUT(a->tailer, 0x3);
+    } else {
+        PUT(end, GET(end) | 0x2); // block after the absorbed successor
+    }
+    PUT(ptr, avail | (GET(ptr) & 0x3));
+    shrink_block(a, ptr, want); // give back what wasn't needed
+    return 1;
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * mm_realloc - Resize in place when possible: shrink by splitting off the
+ *     tail, grow into a free successor or past the end of the heap, and
+ *     only otherwise move the block. A block that grows gets up to
+ *     REALLOC_RESERVE spare bytes, which shrinking leaves alone, so a
+ *     buffer that keeps growing rarely needs mem_sbrk() or a copy.
+ *     Blocks in the heap stay there however large they grow, mapped ones
+ *     are remapped.
  */
 void *mm_realloc(void *ptr, size_t size)
 {
-    void *oldptr = ptr;
+    CHECK_OP(ptr);
+    ptr = main_realloc(ptr, size);
+    CHECK_BLOCK(ptr);
+    return ptr;
+}
+
+static void *main_realloc(void *ptr, size_t size)
+{
+    slab_run_t *run;
     void *newptr;
-    
-    if (size == 0) {
-        mm_free(ptr);
-        return (void *) 0;
-    }
 
-    if (oldptr == NULL) {
+    if (ptr == NULL) {
         return mm_malloc(size);
     }
-    
-    // check if the ptr block has enough payload for size
-    size_t new_sz = MAX(MIN_FREE_BLOCK_SZ, ALIGN(size + SIZE_T_SIZE));
-    size_t old_sz = GET_SIZE((void *) VOID_DEL(ptr, SIZE_T_SIZE));
-    if (old_sz >= new_sz) {
-        return ptr;
+    if (size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+    if ((run = slab_run_of(ptr)) != NULL) {
+        if (size <= run->size) {
+            return ptr;
+        }
+        if ((newptr = mm_malloc(size)) == NULL) {
+            return NULL;
+        }
+        memcpy(newptr, ptr, run->size);
+        slab_free(run, ptr);
+        return newptr;
+    }
+    if (IS_MMAPPED(VOID_DEL(ptr, WSIZE))) {
+        return remap_block(ptr, size);
+    }
+    newptr = arena_realloc(&main_arena, ptr, size);
+    trim_heap(&main_arena);
+    return newptr;
+}
+
+static void *arena_realloc(arena_t *a, void *ptr, size_t size)
+{
+    void *oldptr = ptr;
+    void *newptr;
+    
+    if (size == 0) {
+        arena_free(a, ptr);
+        return (void *) 0;
+    }
+
+    if (oldptr == NULL) {
+        return arena_malloc(a, size);
+    }
+    
+    void *block_ptr = VOID_DEL(ptr, WSIZE);
+    size_t new_sz = MAX(MIN_FREE_BLOCK_SZ, ALIGN(size + WSIZE));
+    size_t old_sz = GET_SIZE(block_ptr);
+    size_t want = new_sz + REALLOC_RESERVE(new_sz);
+    if (old_sz >= new_sz) {
+        shrink_block(a, block_ptr, want);
+        return ptr;
+    }
+    if (grow_block(a, block_ptr, new_sz, want)) {
+        return ptr;
     }
     
     // get a new free block 
-    newptr = mm_malloc(size);
+    newptr = arena_malloc(a, want - WSIZE);
     if (newptr == NULL)
       return NULL;
     
-    memcpy(newptr, oldptr, old_sz);
-    mm_free(oldptr);
+    memcpy(newptr, oldptr, old_sz - WSIZE); // payload only
+    arena_free(a, oldptr);
     return newptr;
 }
 
-void rm_free_node_from_list(void *ptr) {
-    void *prev_node_ptr = (void *) GET(VOID_ADD(ptr, SIZE_T_SIZE));
-    void *next_node_ptr = (void *) GET(VOID_ADD(ptr, SIZE_T_SIZE + ALIGNMENT));
+/*
+ * mm_memalign - Allocate size bytes whose payload starts at a multiple of
+ *     align, a power of two. The padding in front of the block stays a
+ *     free block of its own, so it is not lost to the alignment.
+ */
+void *mm_memalign(size_t align, size_t size)
+{
+    void *ptr;
 
-    PUT(VOID_ADD(prev_node_ptr, SIZE_T_SIZE + ALIGNMENT), (unsigned long) next_node_ptr);
-    PUT(VOID_ADD(next_node_ptr, SIZE_T_SIZE), (unsigned long) prev_node_ptr);
+    if (align == 0 || (align & (align - 1)) != 0) {
+        return NULL;
+    }
+    if (align <= ALIGNMENT) {
+        return mm_malloc(size);
+    }
+    // slab objects and mapped blocks have a fixed offset, only the heap can align
+    ptr = (size == 0) ? NULL : arena_malloc_aligned(&main_arena, size, align);
+    CHECK_OP(ptr);
+    return ptr;
 }
 
-void insert_free_node_into_list(void *ptr) {
-    void *head_ptr = HEADER;
-    void *head_next_node_ptr = (void *) GET(VOID_ADD(head_ptr, SIZE_T_SIZE + ALIGNMENT));
+/*
+ * mm_calloc - Allocate nmemb elements of size bytes each, cleared to
+ *     zero. Mapped blocks are fresh pages and heap memory that mem_sbrk()
+ *     has just handed out reads as zeros, so only what was used before is
+ *     cleared.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if (size != 0 && nmemb > (size_t) -1 / size) {
+        return NULL;
+    }
+    ptr = main_calloc(nmemb * size);
+    CHECK_OP(ptr);
+    return ptr;
+}
 
-    PUT(VOID_ADD(head_ptr, SIZE_T_SIZE + ALIGNMENT), (unsigned long) ptr); // set header block's next node
-    PUT(VOID_ADD(head_next_node_ptr, SIZE_T_SIZE), (unsigned long) ptr); // set prev node
-    
-    PUT(VOID_ADD(ptr, SIZE_T_SIZE), (unsigned long) head_ptr); // set prev node of new free block
-    PUT(VOID_ADD(ptr, SIZE_T_SIZE + ALIGNMENT), (unsigned long) head_next_node_ptr); // set next node of new free block
+static void *main_calloc(size_t size)
+{
+    char *zero = mem_heap_zero(); // before the heap grows for this block
+    char *ptr;
+
+    if (size - 1 < SLAB_MAX && (ptr = slab_malloc(size)) != NULL) { // 0 < size <= SLAB_MAX
+        memset(ptr, 0, size);
+        return ptr;
+    }
+    if (size >= mmap_threshold && (ptr = map_block(size)) != NULL) {
+        return ptr;
+    }
+    if ((ptr = arena_malloc(&main_arena, size)) == NULL) {
+        return NULL;
+    }
+    // above zero the block may only hold the links and the footer it had
+    // as a free block, in the first and the last words of the payload
+    if (ptr + size <= zero || size <= 2 * MIN_FREE_BLOCK_SZ) {
+        memset(ptr, 0, size);
+    } else {
+        memset(ptr, 0, (zero > ptr + MIN_FREE_BLOCK_SZ) ? (size_t) (zero - ptr) : MIN_FREE_BLOCK_SZ);
+        memset(ptr + size - MIN_FREE_BLOCK_SZ, 0, MIN_FREE_BLOCK_SZ);
+    }
+    return ptr;
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes each into out[],
+ *     returns how many it could allocate, none for size 0 as mm_malloc
+ *     returns NULL then. Blocks of the heap are cut from one free
+ *     block, so they lie next to each other in order.
+ */
+int mm_malloc_batch(size_t size, int n, void **out)
+{
+    int i, k = main_malloc_batch(size, n, out);
+
+    for (i = 0; i < k; i++) {
+        CHECK_OP(out[i]);
+    }
+    return k;
+}
+
+static int main_malloc_batch(size_t size, int n, void **out)
+{
+    int k = 0;
+
+    if (size == 0) {
+        return 0;
+    }
+    if (size - 1 < SLAB_MAX) { // 0 < size <= SLAB_MAX
+        k = slab_malloc_batch(size, n, out);
+    } else if (size < mmap_threshold) {
+        k = arena_malloc_batch(&main_arena, size, n, out);
+    }
+    // whatever is left, mappings and requests the fast paths couldn't serve
+    for (; k < n && (out[k] = main_malloc(size)) != NULL; k++) {
+    }
+    return k;
+}
+
+// take up to n objects of size's class, run by run, returns how many
+static int slab_malloc_batch(size_t size, int n, void **out)
+{
+    int c = (size - 1) / ALIGNMENT;
+    slab_run_t *run;
+    int k = 0, w, i;
+
+    while (k < n) {
+        if ((run = slab_runs[c]) == NULL && (run = slab_new_run((c + 1) * ALIGNMENT)) == NULL) {
+            break;
+        }
+        for (w = 0; k < n && run->nfree > 0; w++) {
+            while (k < n && run->free_map[w] != 0) {
+                i = __builtin_ctzll(run->free_map[w]);
+                run->free_map[w] &= run->free_map[w] - 1;
+                run->nfree--;
+                out[k++] = VOID_ADD(run, RUN_OBJS + (w * 64 + i) * run->size);
+            }
+        }
+        if (run->nfree == 0) { // full runs leave the list
+            slab_runs[c] = run->next;
+            if (run->next != NULL) {
+                run->next->prev = NULL;
+            }
+        }
+    }
+    return k;
+}
+
+// cut n blocks for size bytes each out of one free block of a, returns n,
+// or 0 if there is no such block and the heap cannot grow
+static int arena_malloc_batch(arena_t *a, size_t size, int n, void **out)
+{
+    size_t block_sz = MAX(MIN_FREE_BLOCK_SZ, ALIGN(size + WSIZE));
+    size_t total, last_sz;
+    void *ptr;
+    int i;
+
+    if (n <= 0 || block_sz > (1u << 30) / n) { // the total must fit in a header
+        return 0;
+    }
+    total = block_sz * n;
+    if ((ptr = find_fit(a, total)) == NULL && (ptr = extend_heap(a, total)) == NULL) {
+        return 0;
+    }
+    ptr = VOID_DEL(place(a, ptr, total), WSIZE);
+    last_sz = GET_SIZE(ptr) - (n - 1) * block_sz; // the last block keeps any slack
+    PUT(ptr, (n == 1 ? last_sz : block_sz) | (GET(ptr) & 0x2) | 0x1);
+    out[0] = VOID_ADD(ptr, WSIZE);
+    for (i = 1; i < n; i++) {
+        ptr = VOID_ADD(ptr, block_sz);
+        PUT(ptr, (i == n - 1 ? last_sz : block_sz) | 0x3);
+        out[i] = VOID_ADD(ptr, WSIZE);
+    }
+    return n;
+}
+
+static int ptr_cmp(const void *x, const void *y)
+{
+    char *p = *(char **) x, *q = *(char **) y;
+
+    return (p > q) - (p < q);
+}
+
+/*
+ * mm_free_batch - Free the n blocks in ptrs[], reordering ptrs[]. Slab
+ *     objects and mapped blocks are freed one by one; the blocks of the
+ *     heap are sorted by address, and each run of them that lie next to
+ *     each other is freed as one block.
+ */
+void mm_free_batch(void **ptrs, int n)
+{
+    void *block_ptr, *end, *ptr;
+    int i, j, m = 0;
+
+    for (i = 0; i < n; i++) {
+        CHECK_OP(ptrs[i]);
+        if (ptrs[i] == NULL) {
+            continue;
+        }
+        if (slab_run_of(ptrs[i]) != NULL || IS_MMAPPED(VOID_DEL(ptrs[i], WSIZE))) {
+            main_free(ptrs[i]);
+        } else {
+            ptrs[m++] = ptrs[i];
+        }
+    }
+    // batches hold few heap blocks as a rule, too few to pay for qsort()
+    if (m > BATCH_ISORT_MAX) {
+        qsort(ptrs, m, sizeof(void *), ptr_cmp);
+    } else {
+        for (i = 1; i < m; i++) {
+            ptr = ptrs[i];
+            for (j = i; j > 0 && (char *) ptrs[j - 1] > (char *) ptr; j--) {
+                ptrs[j] = ptrs[j - 1];
+            }
+            ptrs[j] = ptr;
+        }
+    }
+    for (i = 0; i < m; i = j) {
+        block_ptr = VOID_DEL(ptrs[i], WSIZE);
+        end = VOID_ADD(block_ptr, GET_SIZE(block_ptr));
+        for (j = i + 1; j < m && ptrs[j] == VOID_ADD(end, WSIZE); j++) {
+            end = VOID_ADD(end, GET_SIZE(end));
+        }
+        PUT(block_ptr, ((char *) end - (char *) block_ptr) | (GET(block_ptr) & 0x2));
+        PUT(VOID_DEL(end, WSIZE), GET(block_ptr));
+        coalesce(&main_arena, block_ptr);
+    }
+    trim_heap(&main_arena);
+}
+
+void rm_free_node_from_list(arena_t *a, void *ptr) {
+    void *prev_node_ptr = PREV_NODE(a, ptr);
+    void *next_node_ptr = NEXT_NODE(a, ptr);
+
+    if (GET_SIZE(ptr) >= TREE_MIN_SIZE) {
+        tree_remove(a, ptr);
+        return;
+    }
+    if (prev_node_ptr != NULL) {
+        SET_NEXT_NODE(a, prev_node_ptr, next_node_ptr);
+    } else {
+        int c = size_class(GET_SIZE(ptr));
+        a->seg_heads[c] = next_node_ptr; // ptr was the head of its list
+        if (next_node_ptr == NULL) {
+            a->seg_bitmap &= ~(1u << c);
+        }
+    }
+    if (next_node_ptr != NULL) {
+        SET_PREV_NODE(a, next_node_ptr, prev_node_ptr);
+    }
+}
+
+void insert_free_node_into_list(arena_t *a, void *ptr) {
+    int c;
+    void *head_ptr;
+
+    if (GET_SIZE(ptr) >= TREE_MIN_SIZE) {
+        tree_insert(a, ptr);
+        return;
+    }
+    c = size_class(GET_SIZE(ptr));
+    head_ptr = a->seg_heads[c];
+
+    SET_PREV_NODE(a, ptr, NULL); // set prev node of new free block
+    SET_NEXT_NODE(a, ptr, head_ptr); // set next node of new free block
+    if (head_ptr != NULL) {
+        SET_PREV_NODE(a, head_ptr, ptr);
+    }
+    a->seg_heads[c] = ptr;
+    a->seg_bitmap |= 1u << c;
+}
+
+// report an inconsistency at block ptr (NULL if at none in particular) and exit
+static void check_fail(void *ptr, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "mm_check: ");
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    if (ptr != NULL) {
+        fprintf(stderr, " (block %p, heap %p..%p)", ptr, (void *) main_arena.base, main_arena.tailer);
+    }
+    fprintf(stderr, " after %lu requests\n", check_ops);
+    exit(-1);
+}
+
+// check that block ptr of the main heap has a sane size and lies in the heap
+static void check_bounds(void *ptr)
+{
+    size_t sz = GET_SIZE(ptr);
+
+    if ((char *) ptr < main_arena.base + WSIZE || (char *) ptr >= (char *) main_arena.tailer) {
+        check_fail(ptr, "block outside the heap");
+    }
+    if (sz < MIN_FREE_BLOCK_SZ || sz % ALIGNMENT != 0 ||
+        sz > (size_t) ((char *) main_arena.tailer - (char *) ptr)) {
+        check_fail(ptr, "bad block size %lu", (unsigned long) sz);
+    }
+}
+
+// check free block ptr and its neighbours, exit on error
+static void check_free_block(void *ptr) {
+    size_t sz = GET_SIZE(ptr);
+    if (IS_ALLOC(ptr)) {
+        check_fail(ptr, "non-free node in free list");
+    }
+    if (GET(VOID_ADD(ptr, sz - WSIZE)) != GET(ptr)) {
+        check_fail(ptr, "free block's header and footer differ");
+    }
+    if (!IS_PREV_ALLOC(ptr)) {
+        check_fail(ptr, "free block's prev block is free and not coalesced");
+    }
+    if (!IS_ALLOC(VOID_ADD(ptr, sz))) {
+        check_fail(ptr, "free block's next block is free and not coalesced");
+    }
+}
+
+// check that ptr is an allocated object of slab run run
+static void check_slab_object(slab_run_t *run, void *ptr)
+{
+    size_t off = (char *) ptr - (char *) run - RUN_OBJS;
+    size_t i = off / run->size;
+
+    if ((char *) ptr < (char *) run + RUN_OBJS || off % run->size != 0 || i >= run->nobjs) {
+        check_fail(ptr, "pointer into slab run %p is not one of its objects", (void *) run);
+    }
+    if (run->free_map[i >> 6] & (1ULL << (i & 63))) {
+        check_fail(ptr, "slab object is free");
+    }
+}
+
+/*
+ * check_block - the O(1) check of payload ptr, which a request is about
+ *     to hand back or was just given: the block must be allocated, and
+ *     its neighbours' headers and footers must agree with it.
+ */
+static void check_block(void *ptr)
+{
+    void *block_ptr = VOID_DEL(ptr, WSIZE), *next, *prev;
+    slab_run_t *run;
+
+    if ((unsigned long) ptr % ALIGNMENT != 0) {
+        check_fail(ptr, "misaligned payload");
+    }
+    if ((run = slab_run_of(ptr)) != NULL) {
+        check_slab_object(run, ptr);
+        return;
+    }
+    if (IS_MMAPPED(block_ptr)) {
+        if (!IS_ALLOC(block_ptr) || GET_SIZE(block_ptr) % mem_pagesize() != 0) {
+            check_fail(ptr, "bad header of a mapped block");
+        }
+        return;
+    }
+    check_bounds(block_ptr);
+    if (!IS_ALLOC(block_ptr)) {
+        check_fail(ptr, "block is not allocated");
+    }
+    next = VOID_ADD(block_ptr, GET_SIZE(block_ptr));
+    if (!IS_PREV_ALLOC(next)) {
+        check_fail(next, "next block's prev-alloc bit is clear, but the block before it is allocated");
+    }
+    if (next != main_arena.tailer && !IS_ALLOC(next)) {
+        check_bounds(next);
+        check_free_block(next);
+    }
+    if (!IS_PREV_ALLOC(block_ptr)) {
+        prev = VOID_DEL(block_ptr, GET_SIZE(VOID_DEL(block_ptr, WSIZE))); // from its footer
+        check_bounds(prev);
+        check_free_block(prev);
+        if (VOID_ADD(prev, GET_SIZE(prev)) != block_ptr) {
+            check_fail(ptr, "previous free block's footer doesn't lead back to its header");
+        }
+    }
+}
+
+// check ptr, if any, and audit the whole heap if mm_check_level asks for it now
+static void check_op(void *ptr)
+{
+    check_ops++;
+    if (ptr != NULL) {
+        check_block(ptr);
+    }
+    if (mm_check_level >= 3 || (mm_check_level == 2 && check_ops % mm_check_every == 0)) {
+        mm_check_heap();
+    }
 }
 
+// check the free subtree t, all of whose keys lie between lo and hi; returns its block count
+static int check_free_tree(arena_t *a, void *t, void *lo, void *hi) {
+    if (t == NULL) {
+        return 0;
+    }
+    check_free_block(t);
+    if (GET_SIZE(t) < TREE_MIN_SIZE) {
+        check_fail(t, "free block of size %lu in the free tree", (unsigned long) GET_SIZE(t));
+    }
+    if ((lo != NULL && !KEY_LESS(GET_SIZE(lo), lo, GET_SIZE(t), t)) ||
+        (hi != NULL && !KEY_LESS(GET_SIZE(t), t, GET_SIZE(hi), hi))) {
+        check_fail(t, "free tree is out of order");
+    }
+    return 1 + check_free_tree(a, LEFT_NODE(a, t), lo, t) + check_free_tree(a, RIGHT_NODE(a, t), t, hi);
+}
+
+// check every free list and the free tree; returns the number of blocks in them
 int mm_check_free_list() {
-    void *curr = HEADER;
-    curr = (void *) GET(VOID_ADD(curr, SIZE_T_SIZE + ALIGNMENT)); // skip HEADER
-    while(curr != NULL && curr != TAILER) {
-        size_t sz = GET_SIZE(curr);
-        unsigned long is_alloc = GET(curr) & 0x1;
-        if (sz > 0 && is_alloc) {
-            printf("non-free node in implicit free list\n");
-            exit(-1);
-        }
-        unsigned long is_pre_alloc = GET(curr) & 0x2;
-        if (!is_pre_alloc) {
-            unsigned long pre_sz = GET_SIZE(VOID_DEL(curr, SIZE_T_SIZE));
-            if (pre_sz > 0) {
-                printf("free block's prev block is free and not coalesced\n");
-                return -1;
+    int c, n;
+    void *curr, *prev;
+    arena_t *a = &main_arena;
+
+    n = check_free_tree(a, a->free_tree, NULL, NULL);
+
+    for (c = 0; c < NUM_CLASSES; c++) {
+        if (!(a->seg_bitmap & (1u << c)) != (a->seg_heads[c] == NULL)) {
+            check_fail(NULL, "bitmap bit %d doesn't match its free list", c);
+        }
+        prev = NULL;
+        for (curr = a->seg_heads[c]; curr != NULL; curr = NEXT_NODE(a, curr)) {
+            size_t sz = GET_SIZE(curr);
+            check_bounds(curr);
+            check_free_block(curr);
+            if (sz >= TREE_MIN_SIZE || size_class(sz) != c) {
+                check_fail(curr, "free block of size %lu in list of class %d", (unsigned long) sz, c);
+            }
+            if (PREV_NODE(a, curr) != prev) {
+                check_fail(curr, "free list's prev link is wrong");
             }
+            prev = curr;
+            n++;
         }
-        unsigned long is_nxt_alloc = GET(VOID_ADD(curr, sz)) &0x1;
-        if (!is_nxt_alloc) {
-            unsigned long nxt_sz = GET_SIZE(VOID_ADD(curr, sz));
-            if (nxt_sz > 0) {
-                printf("free block's next block is free and not coalesced\n");
-                exit(-1);
+    }
+    return n;
+}
+
+// check slab run run, whose block is block_ptr
+static void check_slab_run(slab_run_t *run, void *block_ptr)
+{
+    unsigned int nfree = 0;
+    int i, used;
+
+    if (VOID_ADD(block_ptr, WSIZE) != (void *) run || GET_SIZE(block_ptr) != RUN_SIZE) {
+        check_fail(block_ptr, "slab run page is not a run");
+    }
+    if (run->size == 0 || run->size > SLAB_MAX || run->size % ALIGNMENT != 0 ||
+        run->nobjs != (RUN_SIZE - WSIZE - RUN_OBJS) / run->size) {
+        check_fail(block_ptr, "slab run of %u-byte objects has a bad header", run->size);
+    }
+    for (i = 0; i < RUN_MAP_WORDS; i++) {
+        nfree += __builtin_popcountll(run->free_map[i]);
+        used = (int) run->nobjs - i * 64; // objects with a bit in this word, if below 64
+        if (used < 64 && (used <= 0 ? run->free_map[i] : run->free_map[i] >> used) != 0) {
+            check_fail(block_ptr, "slab run's free map has bits past its last object");
+        }
+    }
+    if (nfree != run->nfree) {
+        check_fail(block_ptr, "slab run counts %u free objects, its map %u", run->nfree, nfree);
+    }
+}
+
+/*
+ * mm_check_heap - audit the main heap: walk every block in address order
+ *     checking sizes, control bits and slab runs, then check that the free
+ *     lists and the free tree hold exactly the free blocks, and the slab
+ *     lists exactly the runs with free objects. Returns 0, or reports the
+ *     first inconsistency and exits.
+ */
+int mm_check_heap(void)
+{
+    arena_t *a = &main_arena;
+    int nfree = 0, nruns = 0, npartial = 0, listed = 0, prev_alloc = 1, c;
+    size_t page, sz;
+    slab_run_t *run;
+    void *p;
+
+    for (p = VOID_ADD(a->base, WSIZE); p != a->tailer; p = VOID_ADD(p, sz)) {
+        check_bounds(p);
+        sz = GET_SIZE(p);
+        if (!IS_PREV_ALLOC(p) != !prev_alloc) {
+            check_fail(p, "prev-alloc bit is wrong");
+        }
+        if (IS_MMAPPED(p)) {
+            check_fail(p, "block in the heap marked as mapped");
+        }
+        prev_alloc = IS_ALLOC(p);
+        if (!IS_ALLOC(p)) {
+            check_free_block(p);
+            nfree++;
+        } else if ((run = slab_run_of(VOID_ADD(p, WSIZE))) != NULL) {
+            check_slab_run(run, p);
+            nruns++;
+            npartial += run->nfree > 0;
+        }
+    }
+    if (GET(a->tailer) != (prev_alloc ? 0x3u : 0x1u)) {
+        check_fail(a->tailer, "bad epilogue");
+    }
+    if ((listed = mm_check_free_list()) != nfree) {
+        check_fail(NULL, "free lists hold %d blocks, the heap has %d free ones", listed, nfree);
+    }
+
+    for (page = 0, listed = 0; page < run_pages_hi; page++) {
+        listed += (run_map[page >> 3] >> (page & 7)) & 1;
+    }
+    if (listed != nruns) {
+        check_fail(NULL, "run_map marks %d pages, the heap has %d slab runs", listed, nruns);
+    }
+    for (c = 0, listed = 0; c < SLAB_CLASSES; c++) {
+        for (run = slab_runs[c]; run != NULL; run = run->next) {
+            if (slab_run_of(run) != run || run->size != (c + 1) * ALIGNMENT || run->nfree == 0 ||
+                (run->next != NULL && run->next->prev != run) ||
+                (run->prev == NULL) != (run == slab_runs[c])) {
+                check_fail(VOID_DEL(run, WSIZE), "bad run in the slab list of %d-byte objects",
+                           (c + 1) * ALIGNMENT);
             }
+            listed++;
+        }
+    }
+    if (listed != npartial) {
+        check_fail(NULL, "slab lists hold %d runs, the heap has %d with free objects", listed, npartial);
+    }
+    return 0;
+}
+
+// number of blocks in the free subtree t
+static int tree_count(arena_t *a, void *t)
+{
+    if (t == NULL) {
+        return 0;
+    }
+    return 1 + tree_count(a, LEFT_NODE(a, t)) + tree_count(a, RIGHT_NODE(a, t));
+}
+
+// print one entry of mm_snapshot()'s map line, with its repeat count
+static void snapshot_block(FILE *fp, size_t size, char kind, int reps)
+{
+    fprintf(fp, reps > 1 ? " %lu%c*%d" : " %lu%c", (unsigned long) size, kind, reps);
+}
+
+/*
+ * mm_snapshot - describe the heap behind mm_malloc() in four lines:
+ *     heap <heap bytes> <allocated> <free> <largest free> <free blocks>
+ *          <slab runs> <free bytes in slab runs> <bytes in own mappings>
+ *     lists <blocks in each size-class list> <blocks in the tree>
+ *     hist <free blocks of [16,32) bytes> <of [32,64)> ... <of the largest>
+ *     map <blocks in address order as <size>a, <size>f or <size>s for a
+ *         slab run, followed by *<n> if n blocks in a row are the same>
+ *     Blocks with mappings of their own only count in the last number.
+ */
+void mm_snapshot(FILE *fp)
+{
+    arena_t *a = &main_arena;
+    size_t alloc_sz = 0, free_sz = 0, largest = 0, slab_free_sz = 0;
+    size_t sz, last_sz = 0;
+    unsigned long hist[32] = {0};
+    int nfree = 0, nruns = 0, nhist = 0, reps = 0;
+    int c, n;
+    char kind, last_kind = 0;
+    slab_run_t *run;
+    void *p;
+
+    for (p = VOID_ADD(a->base, WSIZE); p != a->tailer; p = VOID_ADD(p, sz)) {
+        sz = GET_SIZE(p);
+        if (IS_ALLOC(p)) {
+            alloc_sz += sz;
+            if ((run = slab_run_of(VOID_ADD(p, WSIZE))) != NULL) {
+                nruns++;
+                slab_free_sz += (size_t) run->nfree * run->size;
+            }
+            continue;
+        }
+        free_sz += sz;
+        largest = MAX(largest, sz);
+        nfree++;
+        c = 8 * sizeof(unsigned long) - 1 - __builtin_clzl((unsigned long) sz) - 4; // [16,32) -> 0
+        hist[c]++;
+        nhist = MAX(nhist, c + 1);
+    }
+    fprintf(fp, "heap %lu %lu %lu %lu %d %d %lu %lu\n",
+            (unsigned long) ((char *) a->tailer + WSIZE - a->base), (unsigned long) alloc_sz,
+            (unsigned long) free_sz, (unsigned long) largest, nfree, nruns,
+            (unsigned long) slab_free_sz, (unsigned long) mem_mappedsize());
+
+    fprintf(fp, "lists");
+    for (c = 0; c < NUM_CLASSES; c++) {
+        for (n = 0, p = a->seg_heads[c]; p != NULL; p = NEXT_NODE(a, p)) {
+            n++;
+        }
+        fprintf(fp, " %d", n);
+    }
+    fprintf(fp, " %d\nhist", tree_count(a, a->free_tree));
+    for (c = 0; c < nhist; c++) {
+        fprintf(fp, " %lu", hist[c]);
+    }
+
+    fprintf(fp, "\nmap");
+    for (p = VOID_ADD(a->base, WSIZE); p != a->tailer; p = VOID_ADD(p, sz)) {
+        sz = GET_SIZE(p);
+        kind = !IS_ALLOC(p) ? 'f' : slab_run_of(VOID_ADD(p, WSIZE)) != NULL ? 's' : 'a';
+        if (sz == last_sz && kind == last_kind) {
+            reps++;
+            continue;
+        }
+        if (reps > 0) {
+            snapshot_block(fp, last_sz, last_kind, reps);
+        }
+        last_sz = sz;
+        last_kind = kind;
+        reps = 1;
+    }
+    if (reps > 0) {
+        snapshot_block(fp, last_sz, last_kind, reps);
+    }
+    fprintf(fp, "\n");
+}
+
+/*
+ * Thread-safe multi-arena mode.
+ *
+ * mm_mt_init() carves narenas equal arenas out of memlib's heap, so the
+ * owner of a block follows from its address. Threads are assigned arenas
+ * round-robin on their first call, and take the arena's lock for every
+ * operation on it, which is uncontended as long as there are no more
+ * threads than arenas.
+ *
+ * Two paths avoid the lock. Each thread caches up to TCACHE_COUNT freed
+ * blocks of every size up to TCACHE_MAX_SIZE from its own arena, and
+ * serves mallocs of exactly that block size from them; cached blocks stay
+ * allocated as far as the arena is concerned. A block freed by a thread
+ * of another arena is pushed onto its owner's remote_frees stack with a
+ * compare-and-swap, and the owner frees the whole stack next time it
+ * holds its lock. Both link blocks through their first payload word.
+ */
+#define MT_MAX_ARENAS 64
+#define TCACHE_MAX_SIZE 256 // largest block size kept in thread caches
+#define TCACHE_CLASSES ((TCACHE_MAX_SIZE - MIN_FREE_BLOCK_SZ) / ALIGNMENT + 1) // one per block size
+#define TCACHE_COUNT 32     // blocks kept per thread cache class
+
+typedef struct {
+    arena_t arena;
+    pthread_mutex_t lock; // protects arena
+    void *remote_frees;   // blocks freed by threads of other arenas, NULL-terminated stack
+} mt_arena_t;
+
+static mt_arena_t mt_arenas[MT_MAX_ARENAS];
+static int mt_narenas;
+static char *mt_base;    // arena i owns [mt_base + i * mt_span, mt_base + (i+1) * mt_span)
+static size_t mt_span;
+static int mt_next;      // next arena to hand out
+
+static __thread mt_arena_t *my_arena;            // this thread's arena, NULL until first use
+static __thread void *tcache[TCACHE_CLASSES];    // this thread's cached free blocks, by size
+static __thread int tcache_cnt[TCACHE_CLASSES];
+
+/*
+ * mm_mt_init - set up narenas arenas of arena_size bytes each on memlib's
+ *     heap. Threads that used a previous setup must have called
+ *     mm_mt_thread_exit() before. Arenas of a heap page or more are cut
+ *     down to whole heap pages and start on a page boundary, so no huge
+ *     page is shared by two arenas.
+ */
+int mm_mt_init(int narenas, size_t arena_size)
+{
+    size_t pagesize = mem_heap_pagesize();
+    size_t pad;
+    int i;
+
+    if (narenas < 1 || narenas > MT_MAX_ARENAS) {
+        return -1;
+    }
+    arena_size = ALIGN(arena_size);
+    pad = 0;
+    if (arena_size >= pagesize) {
+        arena_size &= ~(pagesize - 1);
+        pad = -(unsigned long) mem_sbrk(0) & (pagesize - 1);
+    }
+    if ((mt_base = mem_sbrk(pad + narenas * arena_size)) == (void *) -1) {
+        return -1;
+    }
+    mt_base += pad;
+    for (i = 0; i < mt_narenas; i++) {
+        pthread_mutex_destroy(&mt_arenas[i].lock);
+    }
+    mt_narenas = narenas;
+    mt_span = arena_size;
+    mt_next = 0;
+    for (i = 0; i < narenas; i++) {
+        if (arena_init(&mt_arenas[i].arena, mt_base + i * arena_size, arena_size) < 0) {
+            return -1;
+        }
+        pthread_mutex_init(&mt_arenas[i].lock, NULL);
+        mt_arenas[i].remote_frees = NULL;
+    }
+    return 0;
+}
+
+static mt_arena_t *mt_my_arena(void)
+{
+    if (my_arena == NULL) {
+        my_arena = &mt_arenas[__atomic_fetch_add(&mt_next, 1, __ATOMIC_RELAXED) % mt_narenas];
+    }
+    return my_arena;
+}
+
+static mt_arena_t *mt_owner(void *ptr)
+{
+    return &mt_arenas[((char *) ptr - mt_base) / mt_span];
+}
+
+// free the blocks other threads handed back to m. Caller holds m->lock
+static void mt_drain_remote(mt_arena_t *m)
+{
+    void *ptr = __atomic_exchange_n(&m->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    void *next;
+
+    while (ptr != NULL) {
+        next = GET_PTR(ptr);
+        arena_free(&m->arena, ptr);
+        ptr = next;
+    }
+}
+
+void *mm_mt_malloc(size_t size)
+{
+    mt_arena_t *m = mt_my_arena();
+    size_t resize;
+    void *ptr;
+    int c;
+
+    if (size == 0) {
+        return NULL;
+    }
+    resize = MAX(MIN_FREE_BLOCK_SZ, ALIGN(size + WSIZE));
+    if (resize <= TCACHE_MAX_SIZE) {
+        c = (resize - MIN_FREE_BLOCK_SZ) / ALIGNMENT;
+        if ((ptr = tcache[c]) != NULL) { // fast path, no lock
+            tcache[c] = GET_PTR(ptr);
+            tcache_cnt[c]--;
+            return ptr;
+        }
+    }
+
+    pthread_mutex_lock(&m->lock);
+    if (m->remote_frees != NULL) {
+        mt_drain_remote(m);
+    }
+    ptr = arena_malloc(&m->arena, size);
+    pthread_mutex_unlock(&m->lock);
+    return ptr;
+}
+
+void mm_mt_free(void *ptr)
+{
+    mt_arena_t *m = mt_my_arena(), *owner;
+    size_t size;
+    void *head;
+    int c;
+
+    if (ptr == NULL) {
+        return;
+    }
+    owner = mt_owner(ptr);
+    if (owner != m) {
+        // hand the block back to its arena without taking its lock
+        head = __atomic_load_n(&owner->remote_frees, __ATOMIC_RELAXED);
+        do {
+            PUT_PTR(ptr, head);
+        } while (!__atomic_compare_exchange_n(&owner->remote_frees, &head, ptr, 1,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return;
+    }
+    size = GET_SIZE(VOID_DEL(ptr, WSIZE));
+    if (size <= TCACHE_MAX_SIZE) {
+        c = (size - MIN_FREE_BLOCK_SZ) / ALIGNMENT;
+        if (tcache_cnt[c] < TCACHE_COUNT) { // fast path, no lock
+            PUT_PTR(ptr, tcache[c]);
+            tcache[c] = ptr;
+            tcache_cnt[c]++;
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&m->lock);
+    if (m->remote_frees != NULL) {
+        mt_drain_remote(m);
+    }
+    arena_free(&m->arena, ptr);
+    pthread_mutex_unlock(&m->lock);
+}
+
+void *mm_mt_realloc(void *ptr, size_t size)
+{
+    mt_arena_t *m = mt_my_arena();
+    size_t old_sz;
+    void *newptr;
+
+    if (ptr == NULL) {
+        return mm_mt_malloc(size);
+    }
+    if (size == 0) {
+        mm_mt_free(ptr);
+        return NULL;
+    }
+    if (mt_owner(ptr) == m) {
+        pthread_mutex_lock(&m->lock);
+        newptr = arena_realloc(&m->arena, ptr, size);
+        pthread_mutex_unlock(&m->lock);
+        return newptr;
+    }
+    // a block of another arena moves into ours
+    old_sz = GET_SIZE(VOID_DEL(ptr, WSIZE)) - WSIZE;
+    if ((newptr = mm_mt_malloc(size)) == NULL) {
+        return NULL;
+    }
+    memcpy(newptr, ptr, old_sz < size ? old_sz : size);
+    mm_mt_free(ptr);
+    return newptr;
+}
+
+/*
+ * mm_mt_memalign - size bytes aligned to align, a power of two, from the
+ *     calling thread's arena, carved out as mm_memalign() does; NULL if
+ *     align is not a power of two
+ */
+void *mm_mt_memalign(size_t align, size_t size)
+{
+    mt_arena_t *m;
+    void *ptr;
+
+    if (align == 0 || (align & (align - 1)) != 0) {
+        return NULL;
+    }
+    if (align <= ALIGNMENT) {
+        return mm_mt_malloc(size);
+    }
+    if (size == 0) {
+        return NULL;
+    }
+    m = mt_my_arena();
+    pthread_mutex_lock(&m->lock);
+    if (m->remote_frees != NULL) {
+        mt_drain_remote(m);
+    }
+    ptr = arena_malloc_aligned(&m->arena, size, align);
+    pthread_mutex_unlock(&m->lock);
+    return ptr;
+}
+
+/*
+ * mm_mt_usable_size - payload bytes of a block from mm_mt_malloc(),
+ *     mm_mt_realloc() or mm_mt_memalign(), at least the size asked for
+ */
+size_t mm_mt_usable_size(void *ptr)
+{
+    return GET_SIZE(VOID_DEL(ptr, WSIZE)) - WSIZE;
+}
+
+/*
+ * mm_mt_thread_exit - give the calling thread's cached blocks back to its
+ *     arena; call it before the thread exits
+ */
+void mm_mt_thread_exit(void)
+{
+    mt_arena_t *m = my_arena;
+    void *ptr;
+    int c;
+
+    if (m == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&m->lock);
+    for (c = 0; c < TCACHE_CLASSES; c++) {
+        while ((ptr = tcache[c]) != NULL) {
+            tcache[c] = GET_PTR(ptr);
+            arena_free(&m->arena, ptr);
         }
-        // next node
-        curr = (void *) GET(VOID_ADD(curr, SIZE_T_SIZE + ALIGNMENT));
+        tcache_cnt[c] = 0;
     }
-    return -1;
+    mt_drain_remote(m);
+    pthread_mutex_unlock(&m->lock);
+    my_arena = NULL;
 }
@@ -4,6 +4,42 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t align, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+/* Returns how many of the n blocks it allocated, 0 if size is 0 */
+extern int mm_malloc_batch(size_t size, int n, void **out);
+extern void mm_free_batch(void **ptrs, int n);
+extern void mm_snapshot(FILE *fp);
+
+/* Heap checks, see the top of mm.c */
+extern int mm_check_level;
+extern int mm_check_every;
+extern int mm_check_heap(void);
+
+/* Profiling points of the main heap, see the top of mm.c */
+enum {
+    MM_PROF_FIND_FIT,  /* cycles of a free-list or free-tree search */
+    MM_PROF_SCANNED,   /* free blocks that search looked at */
+    MM_PROF_PLACE,     /* cycles of placing a block, splitting off the rest */
+    MM_PROF_COALESCE1, /* cycles of coalescing a block with neither neighbour free */
+    MM_PROF_COALESCE2, /* ... with the next one free */
+    MM_PROF_COALESCE3, /* ... with the previous one free */
+    MM_PROF_COALESCE4, /* ... with both free */
+    MM_PROF_GROW,      /* cycles of mem_sbrk() growing the heap */
+    MM_PROF_SHRINK,    /* cycles of mem_sbrk() trimming it */
+    MM_PROF_SLAB,      /* cycles of a slab allocation */
+    MM_PROF_POINTS
+};
+extern void (*mm_prof_hook)(int point, unsigned long long value);
+
+/* Thread-safe multi-arena interface */
+extern int mm_mt_init(int narenas, size_t arena_size);
+extern void *mm_mt_malloc(size_t size);
+extern void mm_mt_free(void *ptr);
+extern void *mm_mt_realloc(void *ptr, size_t size);
+extern void *mm_mt_memalign(size_t align, size_t size);
+extern void mm_mt_thread_exit(void);
+extern size_t mm_mt_usable_size(void *ptr);
 
 
 /* 
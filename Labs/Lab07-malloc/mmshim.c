@@ -0,0 +1,235 @@
+/*
+ * mmshim.c - Makes mm.c the malloc of any program through LD_PRELOAD
+ *
+ * libmm.so exports the malloc family on top of the thread-safe mm_mt_*()
+ * interface, with memlib's heap as a MAX_HEAP mmap reservation that
+ * takes pages only as they are touched:
+ *
+ *     unix> make libmm.so
+ *     unix> LD_PRELOAD=./libmm.so ../Lab08-proxy/proxy 15214
+ *
+ * The heap is set up on the first call. SHIM_ARENAS arenas of
+ * SHIM_ARENA_SIZE bytes each are handed to threads round-robin; a
+ * thread's cached blocks go back to its arena when it exits.
+ *
+ * mm.c returns 8-byte aligned payloads, while programs may rely on the
+ * 16 bytes glibc guarantees. So the shim asks for room to spare and,
+ * when the payload is misaligned, returns an address further in. Such a
+ * shifted address q has its distance from the payload at q - 8 and a
+ * zero at q - 4, where an unshifted one has mm.c's block header, which
+ * is never zero for an allocated block. The same scheme serves the
+ * memalign family for any power-of-two alignment.
+ *
+ * Pointers outside the heap, such as the few the dynamic linker
+ * allocates before the shim is in place, are never freed.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define SHIM_ARENAS 8
+#define SHIM_ARENA_SIZE (128 << 20) // SHIM_ARENAS of these must fit in MAX_HEAP
+#define SHIM_ALIGN 16               // alignof(max_align_t) on x86-64
+#define MM_ALIGN 8                  // alignment of mm.c's payloads
+
+static pthread_once_t shim_once = PTHREAD_ONCE_INIT;
+static pthread_key_t shim_key;    // its destructor flushes a thread's cache
+static __thread int shim_thread_seen;
+
+static void shim_thread_exit(void *arg)
+{
+    mm_mt_thread_exit();
+}
+
+static void shim_init(void)
+{
+    static const char msg[] = "libmm.so: cannot set up the heap\n";
+
+    mem_init();
+    if (mm_mt_init(SHIM_ARENAS, SHIM_ARENA_SIZE) < 0) {
+        write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        abort();
+    }
+    pthread_key_create(&shim_key, shim_thread_exit);
+}
+
+static void shim_enter(void)
+{
+    if (!shim_thread_seen) {
+        pthread_once(&shim_once, shim_init);
+        shim_thread_seen = 1;
+        pthread_setspecific(shim_key, (void *) 1);
+    }
+}
+
+// whether q is in the heap, which is empty until shim_init() has run
+static int shim_ours(void *q)
+{
+    return mem_heap_lo() != NULL && (char *) q >= (char *) mem_heap_lo() &&
+           (char *) q <= (char *) mem_heap_hi();
+}
+
+// the payload mm.c returned for the address q the shim handed out
+static char *shim_base(void *q)
+{
+    unsigned int *w = (unsigned int *) q;
+
+    return w[-1] == 0 ? (char *) q - w[-2] : (char *) q;
+}
+
+static void *shim_place(char *p, size_t align)
+{
+    char *q = (char *) (((uintptr_t) p + align - 1) & ~(uintptr_t) (align - 1));
+
+    if (q != p) {
+        ((unsigned int *) q)[-2] = q - p;
+        ((unsigned int *) q)[-1] = 0;
+    }
+    return q;
+}
+
+// size bytes aligned to align, a power of two of at least SHIM_ALIGN
+static void *shim_alloc(size_t align, size_t size)
+{
+    char *p;
+
+    if (size > SIZE_MAX - align) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    shim_enter();
+    if ((p = mm_mt_malloc(size + align - MM_ALIGN)) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return shim_place(p, align);
+}
+
+void *malloc(size_t size)
+{
+    return shim_alloc(SHIM_ALIGN, size);
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || !shim_ours(ptr)) {
+        return;
+    }
+    shim_enter();
+    mm_mt_free(shim_base(ptr));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    char *p;
+
+    if (ptr == NULL || !shim_ours(ptr)) {
+        return 0;
+    }
+    p = shim_base(ptr);
+    return mm_mt_usable_size(p) - ((char *) ptr - p);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    static const char msg[] = "libmm.so: realloc of a block from before the shim\n";
+    char *p, *newp;
+    size_t old_sz;
+
+    if (ptr == NULL) {
+        return shim_alloc(SHIM_ALIGN, size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (!shim_ours(ptr)) {
+        write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        abort();
+    }
+    shim_enter();
+    p = shim_base(ptr);
+    if (p == ptr && size <= SIZE_MAX - SHIM_ALIGN) {
+        // let mm.c resize in place, then realign if the block moved
+        if ((newp = mm_mt_realloc(p, size + SHIM_ALIGN - MM_ALIGN)) == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        if ((uintptr_t) newp % SHIM_ALIGN != 0) {
+            memmove(newp + SHIM_ALIGN - MM_ALIGN, newp, size);
+        }
+        return shim_place(newp, SHIM_ALIGN);
+    }
+    if ((newp = shim_alloc(SHIM_ALIGN, size)) == NULL) {
+        return NULL;
+    }
+    old_sz = malloc_usable_size(ptr);
+    memcpy(newp, ptr, old_sz < size ? old_sz : size);
+    mm_mt_free(p);
+    return newp;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    size_t total;
+    void *ptr;
+
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    // not malloc(), which gcc would turn into a call to calloc() here
+    if ((ptr = shim_alloc(SHIM_ALIGN, total)) != NULL) {
+        memset(ptr, 0, total);
+    }
+    return ptr;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return shim_alloc(alignment < SHIM_ALIGN ? SHIM_ALIGN : alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr;
+
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    if ((ptr = memalign(alignment, size)) == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+
+    return memalign(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
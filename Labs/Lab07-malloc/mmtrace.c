@@ -0,0 +1,513 @@
+/*
+ * mmtrace.c - Records the malloc requests of any program for mdriver
+ *
+ * libmmtrace.so wraps the C library's malloc family through LD_PRELOAD
+ * and logs every request to <prefix>.<pid>.cap, where the prefix is
+ * $MMTRACE ("mmtrace" if unset). traceconv turns the capture into a
+ * trace that mdriver replays:
+ *
+ *     unix> make libmmtrace.so
+ *     unix> LD_PRELOAD=./libmmtrace.so MMTRACE=/tmp/proxy ../Lab08-proxy/proxy 15214
+ *     unix> traceconv /tmp/proxy.<pid>.cap proxy.bin
+ *
+ * Each thread fills a buffer of CAP_BUF_RECS records of its own and
+ * hands it to a writer thread when it is full, so recording a request
+ * costs a few stores and an atomic increment of the sequence number that
+ * orders the requests of all threads. What is left in the buffers is
+ * written when the program exits, or is killed by SIGINT or SIGTERM
+ * while it leaves them at their default action.
+ *
+ * With MMTRACE_SITES=<depth>, every allocation is also tagged with a
+ * hash of the <depth> innermost return addresses of its caller's stack.
+ * The first time a site is seen, its stack goes to <prefix>.<pid>.sites.
+ *
+ * The tracer's own allocations, and those of the C library on its
+ * behalf, are not recorded.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+
+#define CAP_BUF_RECS  4096      // records in each thread's buffer
+#define CAP_MAX_BUFS  1024      // buffers there can be at once
+#define CAP_SITES     (1 << 14) // slots in the table of sites seen
+#define CAP_MAX_DEPTH 32        // most return addresses hashed per site
+
+// the C library's allocator, under the names glibc also exports it as
+extern void *__libc_malloc(size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+
+enum {CAP_IDLE, CAP_FILLING, CAP_FULL};
+
+typedef struct {
+    int n;        // records filled in, bumped only once a record is complete
+    int state;    // CAP_IDLE, CAP_FILLING by one thread, or CAP_FULL
+    caprec_t rec[CAP_BUF_RECS];
+} capbuf_t;
+
+static pthread_once_t cap_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t cap_lock = PTHREAD_MUTEX_INITIALIZER;   // guards the buffers
+static pthread_cond_t cap_full = PTHREAD_COND_INITIALIZER;     // a buffer is CAP_FULL
+static pthread_cond_t cap_idle = PTHREAD_COND_INITIALIZER;     // a buffer is CAP_IDLE
+static pthread_mutex_t cap_sites_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cap_key;   // its destructor hands in a thread's buffer
+static pthread_t cap_writer;
+static int cap_writer_running, cap_stopping;
+static capbuf_t *cap_bufs[CAP_MAX_BUFS];
+static int cap_nbufs;
+static int cap_fd = -1, cap_sites_fd = -1;   // opened on first use
+static int cap_depth;                        // $MMTRACE_SITES
+static int cap_off;                          // stop recording
+static unsigned long long cap_seq;
+static unsigned int cap_site_seen[CAP_SITES];
+static const char *cap_prefix = "mmtrace";
+
+static __thread capbuf_t *cap_mine;          // the buffer this thread fills
+static __thread int cap_busy;                // in the tracer, don't record
+
+static void cap_thread_exit(void *arg);
+static void cap_child(void);
+static void cap_signal(int sig);
+
+static void cap_init(void)
+{
+    static const int sigs[] = {SIGINT, SIGTERM};
+    struct sigaction sa, old;
+    char *s;
+    int i;
+
+    if ((s = getenv("MMTRACE")) != NULL && *s != '\0') {
+        cap_prefix = s;
+    }
+    if ((s = getenv("MMTRACE_SITES")) != NULL) {
+        cap_depth = atoi(s);
+        cap_depth = cap_depth < 0 ? 0 : cap_depth > CAP_MAX_DEPTH ? CAP_MAX_DEPTH : cap_depth;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = cap_signal;
+    sa.sa_flags = SA_RESETHAND;
+    for (i = 0; i < 2; i++) {
+        if (sigaction(sigs[i], NULL, &old) == 0 && old.sa_handler == SIG_DFL) {
+            sigaction(sigs[i], &sa, NULL);
+        }
+    }
+    pthread_key_create(&cap_key, cap_thread_exit);
+    pthread_atfork(NULL, NULL, cap_child);
+}
+
+// whether to record the request being made; if so, cap_busy is set
+static int cap_enter(void)
+{
+    if (cap_busy || cap_off) {
+        return 0;
+    }
+    cap_busy = 1;
+    pthread_once(&cap_once, cap_init);
+    if (cap_off) {
+        cap_busy = 0;
+        return 0;
+    }
+    return 1;
+}
+
+static void cap_write_all(int fd, const void *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf = (const char *) buf + n;
+        len -= n;
+    }
+}
+
+// open <prefix>.<pid>.<suffix>; async-signal-safe apart from snprintf()
+static int cap_open(const char *suffix)
+{
+    char path[4096];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s.%d.%s", cap_prefix, (int) getpid(), suffix);
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) {
+        cap_off = 1;
+    }
+    return fd;
+}
+
+static void cap_open_capture(void)
+{
+    if (cap_fd < 0 && (cap_fd = cap_open("cap")) >= 0) {
+        cap_write_all(cap_fd, CAPTURE_MAGIC, 8);
+    }
+}
+
+static void *cap_write(void *arg)
+{
+    capbuf_t *b;
+    int i;
+
+    cap_busy = 1;
+    pthread_mutex_lock(&cap_lock);
+    while (1) {
+        for (b = NULL, i = 0; i < cap_nbufs && b == NULL; i++) {
+            if (cap_bufs[i]->state == CAP_FULL) {
+                b = cap_bufs[i];
+            }
+        }
+        if (b == NULL) {
+            if (cap_stopping) {
+                break;
+            }
+            pthread_cond_wait(&cap_full, &cap_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&cap_lock);
+        cap_write_all(cap_fd, b->rec, b->n * sizeof(caprec_t));
+        pthread_mutex_lock(&cap_lock);
+        b->n = 0;
+        b->state = CAP_IDLE;
+        pthread_cond_broadcast(&cap_idle);
+    }
+    pthread_mutex_unlock(&cap_lock);
+    return NULL;
+}
+
+// hand in b, if any, and get an empty buffer for this thread; cap_lock is not held
+static capbuf_t *cap_next(capbuf_t *b)
+{
+    capbuf_t *nb = NULL;
+    int i;
+
+    pthread_mutex_lock(&cap_lock);
+    if (b != NULL) {
+        b->state = CAP_FULL;
+        cap_open_capture();
+        if (!cap_writer_running && cap_fd >= 0) {
+            cap_writer_running = pthread_create(&cap_writer, NULL, cap_write, NULL) == 0;
+        }
+        if (!cap_writer_running) {
+            cap_off = 1;
+        }
+        pthread_cond_signal(&cap_full);
+    }
+    while (nb == NULL && !cap_off) {
+        for (i = 0; i < cap_nbufs && nb == NULL; i++) {
+            if (cap_bufs[i]->state == CAP_IDLE) {
+                nb = cap_bufs[i];
+            }
+        }
+        if (nb == NULL && cap_nbufs < CAP_MAX_BUFS) {
+            nb = mmap(NULL, sizeof(capbuf_t), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (nb == MAP_FAILED) {
+                nb = NULL;
+                cap_off = 1;
+                break;
+            }
+            cap_bufs[cap_nbufs++] = nb;
+        }
+        if (nb == NULL) {
+            // every buffer is waiting for the writer
+            pthread_cond_wait(&cap_idle, &cap_lock);
+        }
+    }
+    if (nb != NULL) {
+        nb->state = CAP_FILLING;
+    }
+    pthread_mutex_unlock(&cap_lock);
+    return nb;
+}
+
+// hand in this thread's buffer when the thread exits
+static void cap_thread_exit(void *arg)
+{
+    capbuf_t *b = cap_mine;
+
+    cap_busy = 1;
+    cap_mine = NULL;
+    if (b != NULL && b->n > 0) {
+        b = cap_next(b);
+    }
+    if (b != NULL) {
+        pthread_mutex_lock(&cap_lock);
+        b->state = CAP_IDLE;
+        pthread_cond_broadcast(&cap_idle);
+        pthread_mutex_unlock(&cap_lock);
+    }
+    cap_busy = 0;
+}
+
+static void cap_record(int type, void *ptr, void *old, size_t size, unsigned int site)
+{
+    capbuf_t *b = cap_mine;
+    caprec_t *r;
+
+    if (b == NULL || b->n == CAP_BUF_RECS) {
+        if (b == NULL) {
+            pthread_setspecific(cap_key, (void *) 1);
+        }
+        if ((b = cap_mine = cap_next(b)) == NULL) {
+            return;
+        }
+    }
+    r = &b->rec[b->n];
+    r->seq = __atomic_fetch_add(&cap_seq, 1, __ATOMIC_RELAXED);
+    r->ptr = (uintptr_t) ptr;
+    r->old = (uintptr_t) old;
+    r->size = size > UINT32_MAX ? UINT32_MAX : size;
+    r->type = type;
+    r->site = site;
+    __atomic_store_n(&b->n, b->n + 1, __ATOMIC_RELEASE);
+}
+
+static void cap_site_write(unsigned int h, void **frames, int n)
+{
+    char line[32];
+
+    pthread_mutex_lock(&cap_sites_lock);
+    if (cap_sites_fd < 0) {
+        cap_sites_fd = cap_open("sites");
+    }
+    if (cap_sites_fd >= 0) {
+        cap_write_all(cap_sites_fd, line, snprintf(line, sizeof(line), "site %08x\n", h));
+        backtrace_symbols_fd(frames, n, cap_sites_fd);
+    }
+    pthread_mutex_unlock(&cap_sites_lock);
+}
+
+// hash of the caller's stack, skipping this function and the wrapper
+static __attribute__((noinline)) unsigned int cap_site(void)
+{
+    void *frames[CAP_MAX_DEPTH + 2];
+    unsigned int h = 2166136261u, seen;
+    uintptr_t a;
+    int i, j, n;
+
+    n = backtrace(frames, cap_depth + 2);
+    for (i = 2; i < n; i++) {
+        a = (uintptr_t) frames[i];
+        for (j = 0; j < (int) sizeof(a); j++, a >>= 8) {
+            h = (h ^ (a & 0xff)) * 16777619u;   // FNV-1a
+        }
+    }
+    h = h == 0 ? 1 : h;
+    for (i = 0, j = h & (CAP_SITES - 1); i < CAP_SITES; i++, j = (j + 1) & (CAP_SITES - 1)) {
+        seen = 0;
+        if (__atomic_compare_exchange_n(&cap_site_seen[j], &seen, h, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            cap_site_write(h, frames + 2, n - 2);
+            break;
+        }
+        if (seen == h) {
+            break;
+        }
+    }
+    return h;
+}
+
+// write out every record not yet written; may run in a signal handler
+static void cap_flush_all(void)
+{
+    capbuf_t *b;
+    int i;
+
+    cap_open_capture();
+    if (cap_fd < 0) {
+        return;
+    }
+    for (i = 0; i < cap_nbufs; i++) {
+        b = cap_bufs[i];
+        // the writer may be writing a full buffer too; traceconv drops repeats
+        if (b->state != CAP_IDLE && b->n > 0) {
+            cap_write_all(cap_fd, b->rec, b->n * sizeof(caprec_t));
+        }
+    }
+}
+
+static void cap_signal(int sig)
+{
+    cap_off = 1;
+    cap_flush_all();
+    raise(sig);   // SA_RESETHAND restored the default action
+}
+
+static __attribute__((destructor)) void cap_exit(void)
+{
+    int running;
+
+    cap_busy = 1;
+    pthread_mutex_lock(&cap_lock);
+    cap_stopping = 1;
+    running = cap_writer_running;
+    pthread_cond_signal(&cap_full);
+    pthread_mutex_unlock(&cap_lock);
+    if (running) {
+        pthread_join(cap_writer, NULL);
+    }
+    cap_off = 1;
+    if (cap_nbufs > 0) {
+        cap_flush_all();
+    }
+}
+
+// the child of fork() starts a capture of its own, with no writer yet
+static void cap_child(void)
+{
+    int i;
+
+    pthread_mutex_init(&cap_lock, NULL);
+    pthread_mutex_init(&cap_sites_lock, NULL);
+    cap_writer_running = 0;
+    for (i = 0; i < cap_nbufs; i++) {
+        cap_bufs[i]->n = 0;
+        cap_bufs[i]->state = CAP_IDLE;
+    }
+    if (cap_mine != NULL) {
+        cap_mine->state = CAP_FILLING;
+    }
+    if (cap_fd >= 0) {
+        close(cap_fd);
+        cap_fd = -1;
+    }
+    if (cap_sites_fd >= 0) {
+        close(cap_sites_fd);
+        cap_sites_fd = -1;
+    }
+    memset(cap_site_seen, 0, sizeof(cap_site_seen));
+}
+
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+
+    if (p != NULL && cap_enter()) {
+        cap_record(ALLOC, p, NULL, size, cap_depth ? cap_site() : 0);
+        cap_busy = 0;
+    }
+    return p;
+}
+
+void free(void *ptr)
+{
+    // recorded first, so that it comes before any reuse of the block
+    if (ptr != NULL && cap_enter()) {
+        cap_record(FREE, ptr, NULL, 0, 0);
+        cap_busy = 0;
+    }
+    __libc_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr != NULL && size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    p = __libc_realloc(ptr, size);
+    if (p != NULL && cap_enter()) {
+        if (ptr == NULL) {
+            cap_record(ALLOC, p, NULL, size, cap_depth ? cap_site() : 0);
+        } else {
+            cap_record(REALLOC, p, ptr, size, cap_depth ? cap_site() : 0);
+        }
+        cap_busy = 0;
+    }
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+
+    if (p != NULL && cap_enter()) {
+        cap_record(ALLOC, p, NULL, nmemb * size, cap_depth ? cap_site() : 0);
+        cap_busy = 0;
+    }
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *p = __libc_memalign(alignment, size);
+
+    if (p != NULL && cap_enter()) {
+        cap_record(ALLOC, p, NULL, size, cap_depth ? cap_site() : 0);
+        cap_busy = 0;
+    }
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    if ((p = __libc_memalign(alignment, size)) == NULL) {
+        return ENOMEM;
+    }
+    if (cap_enter()) {
+        cap_record(ALLOC, p, NULL, size, cap_depth ? cap_site() : 0);
+        cap_busy = 0;
+    }
+    *memptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    void *p = __libc_memalign(alignment, size);
+
+    if (p != NULL && cap_enter()) {
+        cap_record(ALLOC, p, NULL, size, cap_depth ? cap_site() : 0);
+        cap_busy = 0;
+    }
+    return p;
+}
+
+void *valloc(size_t size)
+{
+    void *p = __libc_valloc(size);
+
+    if (p != NULL && cap_enter()) {
+        cap_record(ALLOC, p, NULL, size, cap_depth ? cap_site() : 0);
+        cap_busy = 0;
+    }
+    return p;
+}
+
+void *pvalloc(size_t size)
+{
+    void *p = __libc_pvalloc(size);
+
+    if (p != NULL && cap_enter()) {
+        cap_record(ALLOC, p, NULL, size, cap_depth ? cap_site() : 0);
+        cap_busy = 0;
+    }
+    return p;
+}
@@ -0,0 +1,465 @@
+/*
+ * mtdriver.c - Replays the malloc traces on several threads at once
+ *     through the thread-safe mm_mt_*() interface in mm.c and reports how
+ *     throughput scales with the number of threads.
+ *
+ * Every thread replays its own copy of the trace, repeated until it has
+ * done at least the requested number of operations. With -r each thread
+ * hands the blocks it would free to its neighbour instead, so that every
+ * free is done by a thread of another arena. With -l the same runs are
+ * timed for libc malloc for comparison. Memaligns are replayed with
+ * mm_mt_memalign() (posix_memalign() for libc), and callocs as a malloc
+ * followed by clearing the block.
+ *
+ * usage: mtdriver [-hlr] [-n <max threads>] [-o <ops per thread>]
+ *                 [-t <tracedir>] [-f <tracefile>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+#include "trace.h"
+
+#define MAXLINE     1024   /* max string size */
+#define MAX_THREADS 64     /* same as MT_MAX_ARENAS in mm.c */
+#define INBOX_SIZE  1024   /* slots in each thread's remote-free inbox */
+
+typedef struct {
+    int num_ids;
+    int num_ops;
+    traceop_t *ops;
+} trace_t;
+
+/* Allocator under test */
+typedef struct {
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void *(*memalign)(size_t align, size_t size);
+    void (*thread_exit)(void);
+} allocator_t;
+
+/* Single-producer single-consumer ring of blocks for another thread to free */
+typedef struct {
+    void *slots[INBOX_SIZE];
+    unsigned head;         /* next slot to take, written by the consumer */
+    unsigned tail;         /* next slot to fill, written by the producer */
+} inbox_t;
+
+typedef struct {
+    int id;                /* thread number */
+    int nthreads;
+    int reps;              /* times to replay the trace */
+    pthread_t tid;
+} worker_t;
+
+/* Global state shared by the workers of one run */
+static trace_t *trace;
+static allocator_t *alloc;
+static int remote;                     /* -r: neighbours free each other's blocks */
+static inbox_t inboxes[MAX_THREADS];
+static pthread_barrier_t start_barrier;
+static int finished;                   /* workers done with their replays */
+static int errors;
+
+static void libc_thread_exit(void) {}
+
+static void *libc_memalign(size_t align, size_t size)
+{
+    void *p;
+
+    if (align < sizeof(void *)) { // posix_memalign's least alignment
+        align = sizeof(void *);
+    }
+    return posix_memalign(&p, align, size) == 0 ? p : NULL;
+}
+
+static allocator_t mm_allocator = {mm_mt_malloc, mm_mt_free, mm_mt_realloc, mm_mt_memalign,
+                                   mm_mt_thread_exit};
+static allocator_t libc_allocator = {malloc, free, realloc, libc_memalign, libc_thread_exit};
+
+static trace_t *read_trace(char *tracedir, char *filename);
+static void free_trace(trace_t *trace);
+static double run(int nthreads, int min_ops);
+static void *worker(void *vargp);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    char tracedir[MAXLINE] = TRACEDIR;
+    char *default_tracefiles[] = {DEFAULT_TRACEFILES, NULL};
+    char **tracefiles = default_tracefiles;
+    char *onefile[2] = {NULL, NULL};
+    int max_threads = 4, min_ops = 100000, libc = 0;
+    int i, n, c;
+    double base, kops, libc_base = 0, libc_kops;
+
+    while ((c = getopt(argc, argv, "f:t:n:o:lrh")) != EOF) {
+        switch (c) {
+        case 'f':
+            onefile[0] = optarg;
+            tracefiles = onefile;
+            strcpy(tracedir, "./");
+            break;
+        case 't':
+            strncpy(tracedir, optarg, MAXLINE - 2);
+            if (tracedir[strlen(tracedir) - 1] != '/') {
+                strcat(tracedir, "/");
+            }
+            break;
+        case 'n':
+            max_threads = atoi(optarg);
+            break;
+        case 'o':
+            min_ops = atoi(optarg);
+            break;
+        case 'l':
+            libc = 1;
+            break;
+        case 'r':
+            remote = 1;
+            break;
+        case 'h':
+        default:
+            usage();
+            exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if (max_threads < 1 || max_threads > MAX_THREADS) {
+        fprintf(stderr, "mtdriver: -n must be between 1 and %d\n", MAX_THREADS);
+        exit(1);
+    }
+
+    mem_init();
+    printf("%-22s %7s %10s %8s", "trace", "threads", "mm Kops", "speedup");
+    if (libc) {
+        printf(" %10s %8s", "libc Kops", "speedup");
+    }
+    printf("\n");
+    for (i = 0; tracefiles[i] != NULL; i++) {
+        trace = read_trace(tracedir, tracefiles[i]);
+        for (n = 1; ; n = n * 2 < max_threads ? n * 2 : max_threads) {
+            alloc = &mm_allocator;
+            mem_reset_brk();
+            if (mm_mt_init(n, MAX_HEAP / n) < 0) {
+                fprintf(stderr, "mtdriver: mm_mt_init(%d) failed\n", n);
+                exit(1);
+            }
+            kops = run(n, min_ops);
+            if (n == 1) {
+                base = kops;
+            }
+            printf("%-22s %7d %10.0f %8.2f", tracefiles[i], n, kops, kops / base);
+            if (libc) {
+                alloc = &libc_allocator;
+                libc_kops = run(n, min_ops);
+                if (n == 1) {
+                    libc_base = libc_kops;
+                }
+                printf(" %10.0f %8.2f", libc_kops, libc_kops / libc_base);
+            }
+            printf("\n");
+            fflush(stdout);
+            if (n == max_threads) {
+                break;
+            }
+        }
+        free_trace(trace);
+    }
+    mem_deinit();
+    if (errors) {
+        fprintf(stderr, "mtdriver: %d errors\n", errors);
+    }
+    exit(errors ? 1 : 0);
+}
+
+/*
+ * run - replay the trace on nthreads threads; return thousands of
+ *     operations per second over all threads
+ */
+static double run(int nthreads, int min_ops)
+{
+    worker_t workers[MAX_THREADS];
+    struct timeval start, end;
+    double secs;
+    int i, reps = (min_ops + trace->num_ops - 1) / trace->num_ops;
+
+    memset(inboxes, 0, sizeof(inboxes));
+    finished = 0;
+    pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+        workers[i].id = i;
+        workers[i].nthreads = nthreads;
+        workers[i].reps = reps;
+        pthread_create(&workers[i].tid, NULL, worker, &workers[i]);
+    }
+    pthread_barrier_wait(&start_barrier);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].tid, NULL);
+    }
+    gettimeofday(&end, NULL);
+    pthread_barrier_destroy(&start_barrier);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    return (double) nthreads * reps * trace->num_ops / secs / 1e3;
+}
+
+static int inbox_put(inbox_t *q, void *ptr)
+{
+    unsigned tail = q->tail;
+
+    if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == INBOX_SIZE) {
+        return 0;
+    }
+    q->slots[tail % INBOX_SIZE] = ptr;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static void *inbox_get(inbox_t *q)
+{
+    unsigned head = q->head;
+    void *ptr;
+
+    if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    ptr = q->slots[head % INBOX_SIZE];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return ptr;
+}
+
+/* free whatever the neighbour has handed to this thread */
+static void drain_inbox(inbox_t *q)
+{
+    void *ptr;
+
+    while ((ptr = inbox_get(q)) != NULL) {
+        alloc->free(ptr);
+    }
+}
+
+/*
+ * check - the first and last payload bytes hold the low byte of the
+ *     block's id, which catches blocks handed out twice or overlapping
+ */
+static int check(worker_t *w, char *p, int size, int id, char *what)
+{
+    if (p[0] != (char) id || p[size - 1] != (char) id) {
+        fprintf(stderr, "mtdriver: thread %d: block %d corrupted before %s\n", w->id, id, what);
+        __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return 0;
+}
+
+static void *worker(void *vargp)
+{
+    worker_t *w = vargp;
+    inbox_t *mine = &inboxes[w->id], *next = &inboxes[(w->id + 1) % w->nthreads];
+    char **blocks = calloc(trace->num_ids, sizeof(char *));
+    int *sizes = calloc(trace->num_ids, sizeof(int));
+    traceop_t *op;
+    char *p = NULL;
+    int rep, i, id, size;
+
+    pthread_barrier_wait(&start_barrier);
+    for (rep = 0; rep < w->reps; rep++) {
+        for (i = 0; i < trace->num_ops; i++) {
+            op = &trace->ops[i];
+            id = op->index;
+            size = op->size;
+            switch (op->type) {
+            case ALLOC:
+                if ((p = alloc->malloc(size)) == NULL) {
+                    fprintf(stderr, "mtdriver: thread %d: malloc(%d) failed\n", w->id, size);
+                    __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+                    goto out;
+                }
+                break;
+            case XALLOC:
+                size = XALLOC_SIZE(op->size);
+                if (op->size & XALLOC_CALLOC) {
+                    if ((p = alloc->malloc(size)) != NULL) {
+                        memset(p, 0, size);
+                    }
+                } else if ((p = alloc->memalign(XALLOC_ALIGN(op->size), size)) != NULL &&
+                           (unsigned long) p % XALLOC_ALIGN(op->size) != 0) {
+                    fprintf(stderr, "mtdriver: thread %d: memalign(%u, %d) misaligned\n",
+                            w->id, XALLOC_ALIGN(op->size), size);
+                    __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+                    alloc->free(p);
+                    goto out;
+                }
+                if (p == NULL) {
+                    fprintf(stderr, "mtdriver: thread %d: %s(%d) failed\n", w->id,
+                            (op->size & XALLOC_CALLOC) ? "calloc" : "memalign", size);
+                    __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+                    goto out;
+                }
+                break;
+            case REALLOC:
+                if (sizes[id] > 0 && check(w, blocks[id], sizes[id], id, "realloc") < 0) {
+                    goto out;
+                }
+                if ((p = alloc->realloc(blocks[id], size)) == NULL) {
+                    fprintf(stderr, "mtdriver: thread %d: realloc(%d) failed\n", w->id, size);
+                    __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+                    goto out;
+                }
+                break;
+            case FREE:
+                p = blocks[id];
+                if (sizes[id] > 0 && check(w, p, sizes[id], id, "free") < 0) {
+                    goto out;
+                }
+                if (remote) {
+                    while (!inbox_put(next, p)) {
+                        drain_inbox(mine); // avoid deadlock when both rings are full
+                        sched_yield();
+                    }
+                } else {
+                    alloc->free(p);
+                }
+                blocks[id] = NULL;
+                sizes[id] = 0;
+                continue;
+            }
+            if (size > 0) {
+                p[0] = p[size - 1] = (char) id;
+            }
+            blocks[id] = p;
+            sizes[id] = size;
+        }
+        if (remote) {
+            drain_inbox(mine);
+        }
+    }
+
+out:
+    // traces are balanced, this only frees what an aborted replay left behind
+    for (id = 0; id < trace->num_ids; id++) {
+        alloc->free(blocks[id]);
+    }
+    // keep draining until no thread can hand over more blocks
+    __atomic_fetch_add(&finished, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&finished, __ATOMIC_ACQUIRE) < w->nthreads) {
+        drain_inbox(mine);
+        sched_yield();
+    }
+    drain_inbox(mine);
+    alloc->thread_exit();
+    free(blocks);
+    free(sizes);
+    return NULL;
+}
+
+/*
+ * read_trace - read a text trace file (see trace.h): a, r and f lines,
+ *     and m (memalign) and c (calloc) ones. Binary traces are refused,
+ *     traceconv turns them into text.
+ */
+static trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *fp;
+    trace_t *t;
+    char path[MAXLINE], type[MAXLINE], magic[sizeof(TRACE_MAGIC) - 1];
+    int sugg_heapsize, weight, op_index = 0;
+    unsigned int index, size, align;
+
+    snprintf(path, sizeof(path), "%s%s", tracedir, filename);
+    if ((fp = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "mtdriver: could not open %s\n", path);
+        exit(1);
+    }
+    if (fread(magic, sizeof(magic), 1, fp) == 1 && !memcmp(magic, TRACE_MAGIC, sizeof(magic))) {
+        fprintf(stderr, "mtdriver: %s is a binary trace, which mtdriver does not read; "
+                "convert it to text with traceconv\n", path);
+        exit(1);
+    }
+    rewind(fp);
+    t = malloc(sizeof(trace_t));
+    if (fscanf(fp, "%d %d %d %d", &sugg_heapsize, &t->num_ids, &t->num_ops, &weight) != 4 ||
+        t->num_ids <= 0 || t->num_ids > TRACE_MAX_IDS || t->num_ops < 0) {
+        fprintf(stderr, "mtdriver: bad header in %s\n", path);
+        exit(1);
+    }
+    if ((t->ops = malloc(t->num_ops * sizeof(traceop_t))) == NULL && t->num_ops > 0) {
+        fprintf(stderr, "mtdriver: out of memory for %d requests\n", t->num_ops);
+        exit(1);
+    }
+    while (op_index < t->num_ops && fscanf(fp, "%s", type) == 1) {
+        switch (type[0]) {
+        case 'a':
+        case 'r':
+            if (fscanf(fp, "%u %u", &index, &size) != 2 || index >= (unsigned int) t->num_ids) {
+                goto bad;
+            }
+            t->ops[op_index].type = type[0] == 'a' ? ALLOC : REALLOC;
+            t->ops[op_index].index = index;
+            t->ops[op_index].size = size;
+            break;
+        case 'm':
+        case 'c':
+            align = 1;
+            if ((type[0] == 'm' ? fscanf(fp, "%u %u %u", &index, &size, &align) != 3
+                                : fscanf(fp, "%u %u", &index, &size) != 2) ||
+                index >= (unsigned int) t->num_ids || size > XALLOC_SIZE_MAX ||
+                align == 0 || (align & (align - 1)) != 0) {
+                goto bad;
+            }
+            t->ops[op_index].type = XALLOC;
+            t->ops[op_index].index = index;
+            t->ops[op_index].size = type[0] == 'm' ? XALLOC_MEMALIGN(size, __builtin_ctz(align))
+                                                   : XALLOC_CALLOC_OF(size);
+            break;
+        case 'f':
+            if (fscanf(fp, "%u", &index) != 1 || index >= (unsigned int) t->num_ids) {
+                goto bad;
+            }
+            t->ops[op_index].type = FREE;
+            t->ops[op_index].index = index;
+            t->ops[op_index].size = 0;
+            break;
+        default:
+            goto bad;
+        }
+        op_index++;
+    }
+    fclose(fp);
+    t->num_ops = op_index;
+    return t;
+
+bad:
+    fprintf(stderr, "mtdriver: bad request %d in %s\n", op_index, path);
+    exit(1);
+}
+
+static void free_trace(trace_t *t)
+{
+    free(t->ops);
+    free(t);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtdriver [-hlr] [-n <max threads>] [-o <ops per thread>]\n");
+    fprintf(stderr, "                [-t <tracedir>] [-f <tracefile>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-n <n>     Run on 1, 2, 4, ... up to <n> threads (default 4).\n");
+    fprintf(stderr, "\t-o <ops>   Replay each trace until a thread has done <ops> requests.\n");
+    fprintf(stderr, "\t-r         Free every block on the neighbouring thread.\n");
+    fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+}
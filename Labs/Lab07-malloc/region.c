@@ -0,0 +1,229 @@
+/*
+ * region.c - Region allocator: bump-pointer allocation from chunks that
+ *            memlib maps, all of it freed at once.
+ *
+ * region_alloc() hands out 16-byte aligned pieces of its current chunk
+ * by bumping a pointer, and maps a new chunk of chunk_size bytes with
+ * mem_map() once that one is full. A request too large for an ordinary
+ * chunk gets a chunk of its own, and later pieces still come from the
+ * chunk before. Pieces are never freed one by one: region_reset()
+ * starts over at the beginning of the first chunk, which holds the
+ * region_t itself, unmaps the chunks of single pieces and keeps the
+ * ordinary ones as spares to grow into again, so a region that is reset
+ * after every request maps nothing once it has seen its largest one.
+ * region_destroy() unmaps them all.
+ *
+ * A region created with a fallback maps no chunks. Every region_alloc()
+ * is a malloc of the fallback's, mm_malloc() or libc's malloc() say,
+ * linked into a list through a header so that region_reset() can free
+ * them all. Code written against regions can thus run on a general
+ * allocator, to compare the two or to let mm.c's heap checks see every
+ * piece.
+ *
+ * Different threads may use different regions at once, but each region
+ * must only be used by one thread at a time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "memlib.h"
+#include "region.h"
+
+#define REGION_ALIGN 16 // alignment of every piece, as with glibc's malloc()
+#define REGION_ROUND(size) (((size) + (REGION_ALIGN - 1)) & ~(size_t) (REGION_ALIGN - 1))
+
+// header of a chunk, its pieces follow at CHUNK_HDR
+typedef struct chunk {
+    struct chunk *next; // chunk mapped before this one
+    size_t size;        // bytes mapped, this header included
+} chunk_t;
+#define CHUNK_HDR REGION_ROUND(sizeof(chunk_t))
+
+// room a fallback block needs for its link and a REGION_ALIGN aligned piece
+#define FALLBACK_HDR (sizeof(void *) + REGION_ALIGN - 1)
+
+struct region {
+    chunk_t *first;       // chunk holding this region_t, NULL in fallback mode
+    chunk_t *chunks;      // chunks taken since the last reset, newest first
+    chunk_t *spares;      // ordinary chunks left over from before the last reset
+    char *cur, *end;      // free space left in the chunk pieces come from
+    char *start;          // where pieces of the first chunk begin
+    size_t chunk_size;    // size of an ordinary chunk, a multiple of the page size
+    size_t footprint;     // bytes in chunks, or in fallback mallocs
+    region_fallback_t fallback; // malloc is NULL unless in fallback mode
+    void *pieces;         // fallback mode: pieces handed out, newest first
+};
+
+// round size up to whole pages
+static size_t page_round(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+
+    return (size + pagesize - 1) & ~(pagesize - 1);
+}
+
+/*
+ * region_create - make an empty region whose chunks have chunk_size
+ *     bytes, or one passing every request to fallback if that is not
+ *     NULL. Returns NULL if there is no memory for it.
+ */
+region_t *region_create(size_t chunk_size, const region_fallback_t *fallback)
+{
+    chunk_t *c;
+    region_t *r;
+
+    if (fallback != NULL) {
+        if ((r = fallback->malloc(sizeof(region_t))) == NULL) {
+            return NULL;
+        }
+        r->first = r->chunks = r->spares = NULL;
+        r->cur = r->end = r->start = NULL;
+        r->chunk_size = 0;
+        r->footprint = 0;
+        r->fallback = *fallback;
+        r->pieces = NULL;
+        return r;
+    }
+    if (chunk_size < CHUNK_HDR + REGION_ROUND(sizeof(region_t)) + REGION_ALIGN) {
+        chunk_size = CHUNK_HDR + REGION_ROUND(sizeof(region_t)) + REGION_ALIGN;
+    }
+    chunk_size = page_round(chunk_size);
+    if ((c = mem_map(chunk_size)) == NULL) {
+        return NULL;
+    }
+    c->next = NULL;
+    c->size = chunk_size;
+    r = (region_t *) ((char *) c + CHUNK_HDR);
+    r->first = c;
+    r->chunks = r->spares = NULL;
+    r->start = r->cur = (char *) r + REGION_ROUND(sizeof(region_t));
+    r->end = (char *) c + chunk_size;
+    r->chunk_size = chunk_size;
+    r->footprint = chunk_size;
+    r->fallback.malloc = NULL;
+    r->fallback.free = NULL;
+    r->pieces = NULL;
+    return r;
+}
+
+// take a spare chunk or map a new one for a piece of size bytes and
+// return the piece, NULL if there is no memory for it
+static void *region_grow(region_t *r, size_t size)
+{
+    size_t chunk_size = r->chunk_size;
+    chunk_t *c;
+
+    if (CHUNK_HDR + size > chunk_size) {
+        chunk_size = page_round(CHUNK_HDR + size);
+    }
+    if (chunk_size == r->chunk_size && r->spares != NULL) {
+        c = r->spares;
+        r->spares = c->next;
+    } else if ((c = mem_map(chunk_size)) == NULL) {
+        return NULL;
+    } else {
+        c->size = chunk_size;
+        r->footprint += chunk_size;
+    }
+    c->next = r->chunks;
+    r->chunks = c;
+    // a piece with a chunk of its own leaves the free space of the chunk
+    // pieces come from for later ones
+    if (chunk_size == r->chunk_size) {
+        r->cur = (char *) c + CHUNK_HDR + size;
+        r->end = (char *) c + chunk_size;
+    }
+    return (char *) c + CHUNK_HDR;
+}
+
+/*
+ * region_alloc - allocate size bytes, 16-byte aligned, that live until
+ *     the region is reset. Returns NULL if there is no memory for them.
+ */
+void *region_alloc(region_t *r, size_t size)
+{
+    char *p;
+
+    if (size > SIZE_MAX / 2) {
+        return NULL;
+    }
+    size = size == 0 ? REGION_ALIGN : REGION_ROUND(size);
+    if (r->fallback.malloc != NULL) {
+        // the fallback's block starts with a link to the one before, and
+        // the piece follows at the next REGION_ALIGN boundary, as the
+        // block may be less aligned than that (mm_malloc()'s are 8-byte)
+        if ((p = r->fallback.malloc(FALLBACK_HDR + size)) == NULL) {
+            return NULL;
+        }
+        *(void **) p = r->pieces;
+        r->pieces = p;
+        r->footprint += FALLBACK_HDR + size;
+        return (char *) REGION_ROUND((uintptr_t) p + sizeof(void *));
+    }
+    if (size <= (size_t) (r->end - r->cur)) {
+        p = r->cur;
+        r->cur += size;
+        return p;
+    }
+    return region_grow(r, size);
+}
+
+/*
+ * region_reset - free everything allocated from r at once
+ */
+void region_reset(region_t *r)
+{
+    chunk_t *c, *next;
+    void *p, *q;
+
+    for (p = r->pieces; p != NULL; p = q) {
+        q = *(void **) p;
+        r->fallback.free(p);
+    }
+    r->pieces = NULL;
+    if (r->first == NULL) {
+        r->footprint = 0;
+    }
+    for (c = r->chunks; c != NULL; c = next) {
+        next = c->next;
+        if (c->size == r->chunk_size) {
+            c->next = r->spares;
+            r->spares = c;
+        } else {
+            r->footprint -= c->size;
+            mem_unmap(c);
+        }
+    }
+    r->chunks = NULL;
+    r->cur = r->start;
+    r->end = (r->first != NULL) ? (char *) r->first + r->first->size : NULL;
+}
+
+/*
+ * region_destroy - free everything allocated from r, and r itself
+ */
+void region_destroy(region_t *r)
+{
+    chunk_t *c, *next;
+
+    region_reset(r);
+    for (c = r->spares; c != NULL; c = next) {
+        next = c->next;
+        mem_unmap(c);
+    }
+    if (r->first != NULL) {
+        mem_unmap(r->first);
+    } else {
+        r->fallback.free(r);
+    }
+}
+
+/*
+ * region_footprint - bytes r holds in chunks, spares included, or in
+ *     fallback mallocs
+ */
+size_t region_footprint(region_t *r)
+{
+    return r->footprint;
+}
@@ -0,0 +1,23 @@
+#ifndef __REGION_H_
+#define __REGION_H_
+
+/*
+ * region.h - Region allocator on top of memlib, see region.c
+ */
+#include <stddef.h>
+
+typedef struct region region_t;
+
+/* General allocator a region in fallback mode passes every request to */
+typedef struct {
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+} region_fallback_t;
+
+region_t *region_create(size_t chunk_size, const region_fallback_t *fallback);
+void *region_alloc(region_t *r, size_t size);
+void region_reset(region_t *r);
+void region_destroy(region_t *r);
+size_t region_footprint(region_t *r);
+
+#endif /* __REGION_H_ */
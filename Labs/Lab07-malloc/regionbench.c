@@ -0,0 +1,227 @@
+/*
+ * regionbench.c - Times request-scoped allocation with mm.c, with a
+ *     region and with libc malloc.
+ *
+ * Every simulated request allocates a random number of objects of
+ * random sizes, writes to each, and then frees all of them at once, as
+ * a server does with what it parses out of one request. The same
+ * requests are replayed:
+ *
+ *     mm           mm_malloc() each object, mm_free() each at the end
+ *     mm batch     mm_malloc() each object, one mm_free_batch() at the end
+ *     region       region_alloc() each object, region_reset() at the end
+ *     region/mm    the same, with the region falling back to mm_malloc()
+ *     libc         malloc() each object, free() each at the end
+ *
+ * and for each the best of a few runs is printed in thousands of
+ * objects per second, with the largest footprint the objects took.
+ *
+ * usage: regionbench [-h] [-n <requests>] [-k <objects>] [-z <lo>:<hi>]
+ *                    [-c <chunk bytes>] [-s <seed>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "region.h"
+
+#define RUNS      3     /* times each mode runs, the best counts */
+#define MAX_OBJS  4096  /* most objects in one request */
+
+enum {MODE_MM, MODE_MM_BATCH, MODE_REGION, MODE_REGION_MM, MODE_LIBC, NUM_MODES};
+
+static char *mode_names[NUM_MODES] = {"mm", "mm batch", "region", "region/mm", "libc"};
+
+static int nreqs = 20000;          /* requests to replay */
+static int *nobjs;                 /* objects of each request */
+static unsigned int *sizes;        /* sizes of all the objects, request by request */
+static long total_objs;
+static size_t chunk_size = 16384;  /* chunk size of the regions */
+
+static region_fallback_t mm_fallback = {mm_malloc, mm_free};
+
+static void gen_requests(int objs, unsigned int lo, unsigned int hi, unsigned int seed);
+static double run(int mode, size_t *footprint);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    int objs = 32, c, mode, r;
+    unsigned int lo = 16, hi = 512, seed = 1;
+    double kops, best;
+    size_t footprint;
+
+    while ((c = getopt(argc, argv, "n:k:z:c:s:h")) != EOF) {
+        switch (c) {
+        case 'n':
+            nreqs = atoi(optarg);
+            break;
+        case 'k':
+            objs = atoi(optarg);
+            break;
+        case 'z':
+            if (sscanf(optarg, "%u:%u", &lo, &hi) != 2 || lo < 1 || hi < lo) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'c':
+            chunk_size = atol(optarg);
+            break;
+        case 's':
+            seed = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            usage();
+            exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if (nreqs < 1 || objs < 1 || 2 * objs > MAX_OBJS) {
+        fprintf(stderr, "regionbench: need -n >= 1 and 1 <= -k <= %d\n", MAX_OBJS / 2);
+        exit(1);
+    }
+
+    gen_requests(objs, lo, hi, seed);
+    mem_init();
+    printf("%d requests, %ld objects of %u to %u bytes, %zu-byte chunks\n",
+           nreqs, total_objs, lo, hi, chunk_size);
+    printf("%-10s %10s %14s\n", "mode", "Kops", "footprint KB");
+    for (mode = 0; mode < NUM_MODES; mode++) {
+        best = 0;
+        for (r = 0; r < RUNS; r++) {
+            if ((kops = run(mode, &footprint)) > best) {
+                best = kops;
+            }
+        }
+        printf("%-10s %10.0f ", mode_names[mode], best);
+        if (mode == MODE_LIBC) {
+            printf("%14s\n", "-");
+        } else {
+            printf("%14zu\n", footprint / 1024);
+        }
+    }
+    mem_deinit();
+    return 0;
+}
+
+/*
+ * gen_requests - draw each request's number of objects uniformly from
+ *     1 to 2 * objs - 1, and each object's size from lo to hi
+ */
+static void gen_requests(int objs, unsigned int lo, unsigned int hi, unsigned int seed)
+{
+    long i;
+
+    srandom(seed);
+    if ((nobjs = malloc(nreqs * sizeof(int))) == NULL) {
+        fprintf(stderr, "regionbench: out of memory\n");
+        exit(1);
+    }
+    total_objs = 0;
+    for (i = 0; i < nreqs; i++) {
+        nobjs[i] = 1 + random() % (2 * objs - 1);
+        total_objs += nobjs[i];
+    }
+    if ((sizes = malloc(total_objs * sizeof(unsigned int))) == NULL) {
+        fprintf(stderr, "regionbench: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < total_objs; i++) {
+        sizes[i] = lo + random() % (hi - lo + 1);
+    }
+}
+
+/*
+ * run - replay every request in one mode; return thousands of objects
+ *     per second, and set footprint to the most memory they took
+ */
+static double run(int mode, size_t *footprint)
+{
+    static void *ptrs[MAX_OBJS];
+    struct timeval start, end;
+    region_t *region = NULL;
+    unsigned int *size = sizes;
+    int i, j;
+    char *p;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "regionbench: mm_init failed\n");
+        exit(1);
+    }
+    if (mode == MODE_REGION || mode == MODE_REGION_MM) {
+        region = region_create(chunk_size, mode == MODE_REGION_MM ? &mm_fallback : NULL);
+    }
+    *footprint = 0;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nreqs; i++) {
+        for (j = 0; j < nobjs[i]; j++, size++) {
+            switch (mode) {
+            case MODE_MM:
+            case MODE_MM_BATCH:
+                p = mm_malloc(*size);
+                break;
+            case MODE_REGION:
+            case MODE_REGION_MM:
+                p = region_alloc(region, *size);
+                break;
+            default:
+                p = malloc(*size);
+            }
+            if (p == NULL) {
+                fprintf(stderr, "regionbench: %s ran out of memory\n", mode_names[mode]);
+                exit(1);
+            }
+            p[0] = p[*size - 1] = (char) j;
+            ptrs[j] = p;
+        }
+        if (region != NULL && region_footprint(region) > *footprint) {
+            *footprint = region_footprint(region);
+        }
+        switch (mode) {
+        case MODE_MM:
+            for (j = 0; j < nobjs[i]; j++) {
+                mm_free(ptrs[j]);
+            }
+            break;
+        case MODE_MM_BATCH:
+            mm_free_batch(ptrs, nobjs[i]);
+            break;
+        case MODE_REGION:
+        case MODE_REGION_MM:
+            region_reset(region);
+            break;
+        default:
+            for (j = 0; j < nobjs[i]; j++) {
+                free(ptrs[j]);
+            }
+        }
+    }
+    gettimeofday(&end, NULL);
+    if (region != NULL) {
+        region_destroy(region);
+    }
+    if (mode == MODE_MM || mode == MODE_MM_BATCH || mode == MODE_REGION_MM) {
+        *footprint = mem_peaksize();
+    }
+    return total_objs / ((end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6) / 1e3;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: regionbench [-h] [-n <requests>] [-k <objects>] [-z <lo>:<hi>]\n");
+    fprintf(stderr, "                   [-c <chunk bytes>] [-s <seed>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-c <n>     Give the regions chunks of <n> bytes (16384).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-k <n>     Allocate 1 to 2<n>-1 objects per request, <n> on average (32).\n");
+    fprintf(stderr, "\t-n <n>     Replay <n> requests (20000).\n");
+    fprintf(stderr, "\t-s <seed>  Random seed (1).\n");
+    fprintf(stderr, "\t-z <lo>:<hi> Draw object sizes from <lo> to <hi> bytes (16:512).\n");
+}
@@ -0,0 +1,48 @@
+#!/bin/bash
+#
+# shimbench.sh - Runs the proxy load test once with libc malloc and once
+#     with mm.c preloaded through libmm.so into both tiny and the proxy,
+#     and prints loadgen.py's throughput and the servers' peak RSS for each.
+#
+# usage: ./shimbench.sh [concurrency] [requests] [path]
+#
+# tiny listens on $TINY_PORT (15213) and the proxy on $PROXY_PORT (15214).
+#
+
+cd "$(dirname "$0")"
+CONC=${1:-16}
+REQS=${2:-20000}
+URLPATH=${3:-/home.html}
+TINY_PORT=${TINY_PORT:-15213}
+PROXY_PORT=${PROXY_PORT:-15214}
+PROXYDIR=../Lab08-proxy
+SHIM=$(pwd)/libmm.so
+
+make -s libmm.so || exit 1
+make -s -C $PROXYDIR proxy || exit 1
+make -s -C $PROXYDIR/tiny tiny || exit 1
+
+# peak_rss <pid> - the most memory <pid> has had resident, in KB
+peak_rss() {
+    awk '/^VmHWM/ {print $2}' /proc/$1/status
+}
+
+for malloc in libc mm; do
+    preload=""
+    if [ $malloc = mm ]; then
+        preload=$SHIM
+    fi
+    (cd $PROXYDIR/tiny && LD_PRELOAD=$preload exec ./tiny $TINY_PORT) > /dev/null 2>&1 &
+    tiny_pid=$!
+    (cd $PROXYDIR && LD_PRELOAD=$preload exec ./proxy $PROXY_PORT) > /dev/null 2>&1 &
+    proxy_pid=$!
+    sleep 1
+
+    echo "== $malloc malloc"
+    $PROXYDIR/loadgen.py --proxy localhost:$PROXY_PORT localhost $TINY_PORT \
+        $URLPATH $CONC $REQS
+    echo "peak RSS: proxy $(peak_rss $proxy_pid) KB, tiny $(peak_rss $tiny_pid) KB"
+
+    kill $proxy_pid $tiny_pid
+    wait $proxy_pid $tiny_pid 2> /dev/null
+done
@@ -0,0 +1,67 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - Binary trace format read by mdriver and written by traceconv
+ *
+ * A binary trace is a tracehdr_t followed by num_ops traceop_t records,
+ * stored as they are laid out in memory so that mdriver can mmap the
+ * file and replay the records in place. Text (.rep) traces hold the same
+ * fields: the four header numbers, then one "a id size", "r id size",
+ * "f id", "m id size align" (memalign) or "c id size" (calloc) line per
+ * request.
+ *
+ * A capture, written by libmmtrace.so from a running program, is the
+ * 8 bytes of CAPTURE_MAGIC followed by caprec_t records in the order
+ * threads handed in their buffers; traceconv turns it into a trace.
+ */
+
+#define TRACE_MAGIC "MMTRACE1" /* first 8 bytes of every binary trace */
+#define TRACE_MAX_IDS (1 << 30) /* ids must fit in traceop_t.index */
+#define CAPTURE_MAGIC "MMCAPTR1" /* first 8 bytes of every capture */
+
+/* Request types; XALLOC is a memalign or a calloc */
+enum {ALLOC, FREE, REALLOC, XALLOC};
+
+/*
+ * An XALLOC request packs what it asks for into traceop_t.size: the
+ * byte size in the low XALLOC_SIZE_BITS bits, log2 of the alignment in
+ * the five bits above them (0 for a calloc), and XALLOC_CALLOC in the
+ * top bit for a calloc.
+ */
+#define XALLOC_SIZE_BITS 26
+#define XALLOC_SIZE_MAX ((1U << XALLOC_SIZE_BITS) - 1)
+#define XALLOC_CALLOC (1U << 31)
+#define XALLOC_SIZE(s) ((s) & XALLOC_SIZE_MAX)
+#define XALLOC_ALIGN(s) (1U << (((s) >> XALLOC_SIZE_BITS) & 31))
+#define XALLOC_MEMALIGN(size, log) ((size) | ((unsigned int)(log) << XALLOC_SIZE_BITS))
+#define XALLOC_CALLOC_OF(size) ((size) | XALLOC_CALLOC)
+
+/* Characterizes a single trace operation (allocator request) in 8 bytes */
+typedef struct {
+    unsigned int type : 2;    /* ALLOC, FREE, REALLOC or XALLOC */
+    unsigned int index : 30;  /* id of the block, for free() to use later */
+    unsigned int size;        /* byte size of alloc/realloc request, packed for XALLOC */
+} traceop_t;
+
+/* Header of a binary trace file */
+typedef struct {
+    char magic[8];       /* TRACE_MAGIC, not NUL terminated */
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+} tracehdr_t;
+
+/* One request recorded by libmmtrace.so, the same size on 32 and 64 bits */
+typedef struct {
+    unsigned long long seq;  /* order of the request among all threads' */
+    unsigned long long ptr;  /* block returned, or freed */
+    unsigned long long old;  /* block passed to realloc */
+    unsigned int size;       /* byte size of alloc/realloc request */
+    unsigned int type;       /* ALLOC, FREE or REALLOC */
+    unsigned int site;       /* hash of the allocation site, 0 if not kept */
+    unsigned int pad;
+} caprec_t;
+
+#endif /* __TRACE_H_ */
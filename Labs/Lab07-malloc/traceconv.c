@@ -0,0 +1,498 @@
+/*
+ * traceconv.c - Converts malloc traces between the text (.rep) format
+ *     and the binary format of trace.h, in whichever direction the input
+ *     calls for: a binary input is written out as text, anything else is
+ *     parsed as text and written out as binary.
+ *
+ *     A capture from libmmtrace.so is turned into a trace, written as
+ *     text if <outfile> ends in ".rep" and as binary otherwise.
+ *
+ * usage: traceconv <infile> <outfile>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define OPS_BUF 4096 /* requests buffered per fwrite */
+#define TOP_SITES 10 /* allocation sites listed for a capture */
+
+/* The live blocks of a capture by address, in an open-addressing table */
+typedef struct {
+    unsigned long long *addr;  /* 0 for an empty slot */
+    int *id;
+    long size;                 /* slots, a power of two */
+    long count;
+} blockmap_t;
+
+/* A capture being turned into a trace */
+typedef struct {
+    traceop_t *ops;
+    long nops, ops_cap;
+    int *free_ids;             /* ids of freed blocks, to reuse */
+    long nfree_ids, free_cap;
+    unsigned int *id_size;     /* size of the block each id has now */
+    long size_cap;
+    int num_ids;
+    long long live, peak;      /* bytes requested by the live blocks */
+    blockmap_t blocks;
+} capconv_t;
+
+/* Allocations a capture made from one site */
+typedef struct {
+    unsigned int site;
+    long count;
+    long long bytes;
+} site_t;
+
+static void usage(void);
+static void conv_error(char *path, long opnum, char *msg);
+static void text_to_binary(FILE *in, char *inpath, FILE *out);
+static void binary_to_text(FILE *in, char *inpath, tracehdr_t *hdr, FILE *out);
+static void capture_to_trace(FILE *in, char *inpath, FILE *out, int text);
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    tracehdr_t hdr;
+    size_t n, len;
+
+    if (argc != 3) {
+        usage();
+        exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL) {
+        perror(argv[1]);
+        exit(1);
+    }
+    if ((out = fopen(argv[2], "w")) == NULL) {
+        perror(argv[2]);
+        exit(1);
+    }
+
+    n = fread(&hdr, 1, sizeof(hdr), in);
+    if (n == sizeof(hdr) && !memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic))) {
+        binary_to_text(in, argv[1], &hdr, out);
+    } else if (n >= sizeof(hdr.magic) &&
+               !memcmp(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic))) {
+        fseek(in, sizeof(hdr.magic), SEEK_SET);
+        len = strlen(argv[2]);
+        capture_to_trace(in, argv[1], out, len >= 4 && !strcmp(argv[2] + len - 4, ".rep"));
+    } else {
+        rewind(in);
+        text_to_binary(in, argv[1], out);
+    }
+
+    fclose(in);
+    if (fclose(out) != 0) {
+        perror(argv[2]);
+        exit(1);
+    }
+    return 0;
+}
+
+/*
+ * text_to_binary - parse a .rep trace and write it out in binary,
+ *     checking it the way mdriver's read_trace() does
+ */
+static void text_to_binary(FILE *in, char *inpath, FILE *out)
+{
+    tracehdr_t hdr;
+    traceop_t ops[OPS_BUF];
+    char type[2];
+    unsigned index, size, align;
+    long op_index = 0;
+    int n = 0;
+
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    if (fscanf(in, "%d %d %d %d", &hdr.sugg_heapsize, &hdr.num_ids,
+               &hdr.num_ops, &hdr.weight) != 4) {
+        conv_error(inpath, -1, "bad header");
+    }
+    if (hdr.num_ids <= 0 || hdr.num_ids > TRACE_MAX_IDS || hdr.num_ops < 0) {
+        conv_error(inpath, -1, "bad header");
+    }
+    fwrite(&hdr, sizeof(hdr), 1, out);
+
+    while (fscanf(in, "%1s", type) == 1) {
+        if (op_index == hdr.num_ops) {
+            conv_error(inpath, op_index, "more requests than the header says");
+        }
+        switch (type[0]) {
+        case 'a':
+        case 'r':
+            if (fscanf(in, "%u %u", &index, &size) != 2) {
+                conv_error(inpath, op_index, "bad request");
+            }
+            ops[n].type = type[0] == 'a' ? ALLOC : REALLOC;
+            ops[n].size = size;
+            break;
+        case 'f':
+            if (fscanf(in, "%u", &index) != 1) {
+                conv_error(inpath, op_index, "bad request");
+            }
+            ops[n].type = FREE;
+            ops[n].size = 0;
+            break;
+        case 'm':
+            if (fscanf(in, "%u %u %u", &index, &size, &align) != 3 ||
+                size > XALLOC_SIZE_MAX || align == 0 || (align & (align - 1)) != 0) {
+                conv_error(inpath, op_index, "bad request");
+            }
+            ops[n].type = XALLOC;
+            ops[n].size = XALLOC_MEMALIGN(size, __builtin_ctz(align));
+            break;
+        case 'c':
+            if (fscanf(in, "%u %u", &index, &size) != 2 || size > XALLOC_SIZE_MAX) {
+                conv_error(inpath, op_index, "bad request");
+            }
+            ops[n].type = XALLOC;
+            ops[n].size = XALLOC_CALLOC_OF(size);
+            break;
+        default:
+            conv_error(inpath, op_index, "bogus type character");
+        }
+        if (index >= (unsigned) hdr.num_ids) {
+            conv_error(inpath, op_index, "id out of range");
+        }
+        ops[n].index = index;
+        op_index++;
+        if (++n == OPS_BUF) {
+            fwrite(ops, sizeof(traceop_t), n, out);
+            n = 0;
+        }
+    }
+    fwrite(ops, sizeof(traceop_t), n, out);
+    if (op_index != hdr.num_ops) {
+        conv_error(inpath, op_index, "fewer requests than the header says");
+    }
+}
+
+/*
+ * binary_to_text - write the binary trace whose header is hdr out as a
+ *     .rep trace
+ */
+static void binary_to_text(FILE *in, char *inpath, tracehdr_t *hdr, FILE *out)
+{
+    traceop_t ops[OPS_BUF];
+    long op_index = 0;
+    size_t n, i;
+
+    fprintf(out, "%d\n%d\n%d\n%d\n", hdr->sugg_heapsize, hdr->num_ids,
+            hdr->num_ops, hdr->weight);
+    while ((n = fread(ops, sizeof(traceop_t), OPS_BUF, in)) > 0) {
+        for (i = 0; i < n; i++, op_index++) {
+            switch (ops[i].type) {
+            case ALLOC:
+                fprintf(out, "a %u %u\n", ops[i].index, ops[i].size);
+                break;
+            case REALLOC:
+                fprintf(out, "r %u %u\n", ops[i].index, ops[i].size);
+                break;
+            case FREE:
+                fprintf(out, "f %u\n", ops[i].index);
+                break;
+            case XALLOC:
+                if (ops[i].size & XALLOC_CALLOC) {
+                    fprintf(out, "c %u %u\n", ops[i].index, XALLOC_SIZE(ops[i].size));
+                } else {
+                    fprintf(out, "m %u %u %u\n", ops[i].index, XALLOC_SIZE(ops[i].size),
+                            XALLOC_ALIGN(ops[i].size));
+                }
+                break;
+            default:
+                conv_error(inpath, op_index, "bogus request type");
+            }
+        }
+    }
+    if (op_index != hdr->num_ops) {
+        conv_error(inpath, op_index, "length does not match the header");
+    }
+}
+
+static void *grow(void *p, long *cap, long need, size_t elem)
+{
+    if (need > *cap) {
+        *cap = need > 2 * *cap ? need : 2 * *cap;
+        if ((p = realloc(p, *cap * elem)) == NULL) {
+            fprintf(stderr, "traceconv: out of memory\n");
+            exit(1);
+        }
+    }
+    return p;
+}
+
+static long blockmap_home(blockmap_t *m, unsigned long long addr)
+{
+    return (long) ((addr >> 4) * 0x9e3779b97f4a7c15ULL >> 24) & (m->size - 1);
+}
+
+/* the slot holding addr, or the empty slot it would go in */
+static long blockmap_slot(blockmap_t *m, unsigned long long addr)
+{
+    long i = blockmap_home(m, addr);
+
+    while (m->addr[i] != 0 && m->addr[i] != addr) {
+        i = (i + 1) & (m->size - 1);
+    }
+    return i;
+}
+
+/* id of the live block at addr, or -1 */
+static int blockmap_find(blockmap_t *m, unsigned long long addr)
+{
+    long i;
+
+    if (m->size == 0) {
+        return -1;
+    }
+    i = blockmap_slot(m, addr);
+    return m->addr[i] == addr ? m->id[i] : -1;
+}
+
+static void blockmap_insert(blockmap_t *m, unsigned long long addr, int id)
+{
+    blockmap_t old = *m;
+    long i, j;
+
+    if (2 * (m->count + 1) > m->size) {
+        m->size = m->size ? 2 * m->size : 1024;
+        m->addr = calloc(m->size, sizeof(*m->addr));
+        m->id = malloc(m->size * sizeof(*m->id));
+        if (m->addr == NULL || m->id == NULL) {
+            fprintf(stderr, "traceconv: out of memory\n");
+            exit(1);
+        }
+        for (i = 0; i < old.size; i++) {
+            if (old.addr[i] != 0) {
+                j = blockmap_slot(m, old.addr[i]);
+                m->addr[j] = old.addr[i];
+                m->id[j] = old.id[i];
+            }
+        }
+        free(old.addr);
+        free(old.id);
+    }
+    i = blockmap_slot(m, addr);
+    m->addr[i] = addr;
+    m->id[i] = id;
+    m->count++;
+}
+
+/* remove addr, moving back the entries after it that probed past its slot */
+static void blockmap_remove(blockmap_t *m, unsigned long long addr)
+{
+    long i = blockmap_slot(m, addr), j, home;
+
+    m->addr[i] = 0;
+    m->count--;
+    for (j = (i + 1) & (m->size - 1); m->addr[j] != 0; j = (j + 1) & (m->size - 1)) {
+        home = blockmap_home(m, m->addr[j]);
+        if (((j - home) & (m->size - 1)) >= ((j - i) & (m->size - 1))) {
+            m->addr[i] = m->addr[j];
+            m->id[i] = m->id[j];
+            m->addr[j] = 0;
+            i = j;
+        }
+    }
+}
+
+/* free the live block with the given id at addr */
+static void capconv_free(capconv_t *c, unsigned long long addr, int id)
+{
+    c->ops = grow(c->ops, &c->ops_cap, c->nops + 1, sizeof(traceop_t));
+    c->ops[c->nops].type = FREE;
+    c->ops[c->nops].index = id;
+    c->ops[c->nops++].size = 0;
+    c->free_ids = grow(c->free_ids, &c->free_cap, c->nfree_ids + 1, sizeof(int));
+    c->free_ids[c->nfree_ids++] = id;
+    c->live -= c->id_size[id];
+    blockmap_remove(&c->blocks, addr);
+}
+
+/* resize block id to size bytes at addr, or allocate them for a new id if id < 0 */
+static void capconv_alloc(capconv_t *c, char *inpath, long recnum, int id,
+                          unsigned long long addr, unsigned int size)
+{
+    c->ops = grow(c->ops, &c->ops_cap, c->nops + 1, sizeof(traceop_t));
+    if (id >= 0) {
+        c->ops[c->nops].type = REALLOC;
+        c->live -= c->id_size[id];
+    } else {
+        c->ops[c->nops].type = ALLOC;
+        if (c->nfree_ids > 0) {
+            id = c->free_ids[--c->nfree_ids];
+        } else if (c->num_ids < TRACE_MAX_IDS) {
+            id = c->num_ids++;
+            c->id_size = grow(c->id_size, &c->size_cap, c->num_ids, sizeof(*c->id_size));
+        } else {
+            conv_error(inpath, recnum, "too many blocks live at once");
+        }
+    }
+    c->ops[c->nops].index = id;
+    c->ops[c->nops++].size = size > 0 ? size : 1;
+    blockmap_insert(&c->blocks, addr, id);
+    c->id_size[id] = size;
+    c->live += size;
+    c->peak = c->live > c->peak ? c->live : c->peak;
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+    const caprec_t *x = a, *y = b;
+
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static int cmp_site(const void *a, const void *b)
+{
+    const caprec_t *x = a, *y = b;
+
+    return x->site < y->site ? -1 : x->site > y->site;
+}
+
+static int cmp_bytes(const void *a, const void *b)
+{
+    const site_t *x = a, *y = b;
+
+    return x->bytes > y->bytes ? -1 : x->bytes < y->bytes;
+}
+
+/*
+ * print_sites - list the sites that asked for the most bytes; their
+ *     stacks are in the .sites file libmmtrace.so wrote with the capture
+ */
+static void print_sites(caprec_t *recs, long nrecs)
+{
+    site_t *sites = NULL;
+    long i, nsites = 0, cap = 0;
+
+    qsort(recs, nrecs, sizeof(caprec_t), cmp_site);
+    for (i = 0; i < nrecs; i++) {
+        if (recs[i].site == 0 || recs[i].type == FREE) {
+            continue;
+        }
+        if (nsites == 0 || sites[nsites - 1].site != recs[i].site) {
+            sites = grow(sites, &cap, nsites + 1, sizeof(site_t));
+            sites[nsites].site = recs[i].site;
+            sites[nsites].count = 0;
+            sites[nsites].bytes = 0;
+            nsites++;
+        }
+        sites[nsites - 1].count++;
+        sites[nsites - 1].bytes += recs[i].size;
+    }
+    qsort(sites, nsites, sizeof(site_t), cmp_bytes);
+    for (i = 0; i < nsites && i < TOP_SITES; i++) {
+        printf("site %08x: %ld allocations, %lld bytes\n",
+               sites[i].site, sites[i].count, sites[i].bytes);
+    }
+    free(sites);
+}
+
+/*
+ * capture_to_trace - turn a capture from libmmtrace.so into a trace
+ *
+ * The records are put back in the order of their sequence numbers,
+ * dropping the repeats of a program killed by a signal, and addresses
+ * are mapped to ids, an id being reused once its block is freed. Frees
+ * of blocks from before the capture started are left out, and a block
+ * whose address comes back from malloc before it was seen to be freed
+ * gets the free it is missing. Requests for 0 bytes become requests
+ * for 1, since mm_malloc(0) fails.
+ */
+static void capture_to_trace(FILE *in, char *inpath, FILE *out, int text)
+{
+    caprec_t *recs = NULL, *r;
+    capconv_t c;
+    tracehdr_t hdr;
+    long nrecs = 0, recs_cap = 0, i, n, dropped = 0, added = 0;
+    int id, other;
+
+    do {
+        recs = grow(recs, &recs_cap, nrecs + OPS_BUF, sizeof(caprec_t));
+        n = fread(recs + nrecs, sizeof(caprec_t), OPS_BUF, in);
+        nrecs += n;
+    } while (n == OPS_BUF);
+    qsort(recs, nrecs, sizeof(caprec_t), cmp_seq);
+
+    memset(&c, 0, sizeof(c));
+    for (i = 0; i < nrecs; i++) {
+        r = &recs[i];
+        if (i > 0 && r->seq == recs[i - 1].seq) {
+            continue;
+        }
+        switch (r->type) {
+        case FREE:
+            if ((id = blockmap_find(&c.blocks, r->ptr)) >= 0) {
+                capconv_free(&c, r->ptr, id);
+            } else {
+                dropped++;
+            }
+            break;
+        case ALLOC:
+        case REALLOC:
+            id = -1;
+            if (r->type == REALLOC && (id = blockmap_find(&c.blocks, r->old)) >= 0) {
+                blockmap_remove(&c.blocks, r->old);
+            }
+            if ((other = blockmap_find(&c.blocks, r->ptr)) >= 0) {
+                capconv_free(&c, r->ptr, other);
+                added++;
+            }
+            capconv_alloc(&c, inpath, i, id, r->ptr, r->size);
+            break;
+        default:
+            conv_error(inpath, i, "bogus request type");
+        }
+    }
+    if (c.nops > 0x7fffffff) {
+        conv_error(inpath, -1, "too many requests for one trace");
+    }
+
+    hdr.sugg_heapsize = c.peak > 0x7fffffff ? 0x7fffffff : (int) c.peak;
+    hdr.num_ids = c.num_ids > 0 ? c.num_ids : 1;
+    hdr.num_ops = c.nops;
+    hdr.weight = 1;
+    if (text) {
+        fprintf(out, "%d\n%d\n%d\n%d\n", hdr.sugg_heapsize, hdr.num_ids,
+                hdr.num_ops, hdr.weight);
+        for (i = 0; i < c.nops; i++) {
+            if (c.ops[i].type == FREE) {
+                fprintf(out, "f %u\n", c.ops[i].index);
+            } else {
+                fprintf(out, "%c %u %u\n", c.ops[i].type == ALLOC ? 'a' : 'r',
+                        c.ops[i].index, c.ops[i].size);
+            }
+        }
+    } else {
+        memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+        fwrite(&hdr, sizeof(hdr), 1, out);
+        fwrite(c.ops, sizeof(traceop_t), c.nops, out);
+    }
+
+    printf("%ld requests, %d ids, %lld bytes live at the peak; left out %ld frees "
+           "of blocks from before the capture, added %ld missing frees\n",
+           c.nops, hdr.num_ids, c.peak, dropped, added);
+    print_sites(recs, nrecs);
+}
+
+static void conv_error(char *path, long opnum, char *msg)
+{
+    if (opnum < 0) {
+        fprintf(stderr, "%s: %s\n", path, msg);
+    } else {
+        fprintf(stderr, "%s: request %ld: %s\n", path, opnum, msg);
+    }
+    exit(1);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: traceconv <infile> <outfile>\n");
+    fprintf(stderr, "Converts a .rep trace to the binary format mdriver maps,\n");
+    fprintf(stderr, "or a binary trace back to a .rep trace.\n");
+    fprintf(stderr, "A capture from libmmtrace.so becomes a binary trace, or a\n");
+    fprintf(stderr, ".rep trace if <outfile> ends in .rep.\n");
+}
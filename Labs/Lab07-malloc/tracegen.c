@@ -0,0 +1,500 @@
+/*
+ * tracegen.c - Generates synthetic malloc traces from a workload model
+ *
+ * The model mixes three kinds of objects, the way a long running server
+ * allocates:
+ *
+ *   cache    long-lived objects, each freed after a lifetime drawn from
+ *            the lifetime distribution (-l)
+ *   request  bursts of objects allocated back to back and freed together
+ *            when the burst's request ends
+ *   buffer   objects grown with realloc along a growth curve (-g) and
+ *            freed after their last growth step
+ *
+ * Object sizes come from the size distribution (-z). A new object's kind
+ * is drawn with the weights of -w. With -p the trace is split into phases
+ * and every phase perturbs the weights and scales the sizes, so that the
+ * mix drifts the way it does when a program changes what it is doing.
+ * Lifetimes and the gaps between growth steps are counted in requests.
+ * With -a some of the new objects are allocated with memalign (aligned
+ * as -A says) or calloc instead of malloc.
+ *
+ * A distribution is written name:param[:param], one of
+ *   const:V  uniform:LO:HI  exp:MEAN  lognormal:MEDIAN:SIGMA  pareto:MIN:ALPHA
+ *
+ * The same seed always gives the same trace. Once -n requests have been
+ * written, every block still live is freed, so traces are balanced.
+ *
+ * usage: tracegen [-b] [-n <ops>] [-s <seed>] [-w <cache,request,buffer>]
+ *                 [-z <dist>] [-Z <max size>] [-l <dist>] [-r <burst>]
+ *                 [-g geom:F|linear:STEP] [-k <steps>] [-e <gap>]
+ *                 [-p <phases>] [-a <memalign,calloc>] [-A <align>] <outfile>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define OPS_BUF 4096   /* binary requests buffered per fwrite */
+#define KINDS   3      /* cache, request, buffer */
+
+enum {CACHE, REQUEST, BUFFER};
+
+/* A distribution parsed from name:param[:param] */
+typedef struct {
+    enum {CONST, UNIFORM, EXP, LOGNORMAL, PARETO} type;
+    double a, b;
+} dist_t;
+
+/* A scheduled free or growth step of a live block */
+typedef struct {
+    unsigned long long time; /* request number it is due at */
+    unsigned int id;
+    unsigned int size;       /* current size of the block */
+    int steps;               /* growth steps left; 0 means free it */
+} event_t;
+
+/* Where the generated requests go */
+typedef struct {
+    FILE *fp;
+    int binary;
+    traceop_t ops[OPS_BUF];  /* binary requests not yet written */
+    int n;
+    long long num_ops;
+    unsigned int num_ids;
+    unsigned long long live_bytes;
+    unsigned long long peak_bytes;
+} writer_t;
+
+static unsigned long long rng_state;
+
+static event_t *events;        /* min-heap on time */
+static long num_events;
+static long max_events;
+
+static void usage(void);
+static double rng_double(void);
+static double rng_normal(void);
+static void parse_dist(char *spec, dist_t *d);
+static double draw(dist_t *d);
+static void push_event(unsigned long long time, unsigned int id,
+                       unsigned int size, int steps);
+static event_t pop_event(void);
+static void emit(writer_t *w, int type, unsigned int id, unsigned int size,
+                 unsigned int oldsize);
+static void write_header(writer_t *w);
+
+int main(int argc, char **argv)
+{
+    writer_t w;
+    dist_t size_dist = {LOGNORMAL, 64, 1.0};
+    dist_t life_dist = {EXP, 20000, 0};
+    double base_weights[KINDS] = {30, 60, 10};
+    double weights[KINDS];
+    double growth = 1.5;       /* factor, or step if linear_growth */
+    int linear_growth = 0;
+    double burst_mean = 16;
+    double steps_mean = 8;
+    double gap_mean = 100;
+    double scale = 1.0;        /* size scale of the current phase */
+    double memalign_frac = 0;  /* of new objects, the share memalign'd... */
+    double calloc_frac = 0;    /* ... and calloc'd */
+    unsigned int align = 64;
+    double total, u;
+    long long ops = 100000;
+    long long phase_len;
+    unsigned long long seed = 1;
+    unsigned long long now;
+    unsigned long long burst_end = 0;
+    unsigned int max_size = 1 << 20;
+    unsigned int id, size;
+    long burst_left = 0;
+    int phases = 1;
+    int phase = -1;
+    int c, i, kind, steps, type;
+    event_t e;
+    char *p;
+
+    memset(&w, 0, sizeof(w));
+    while ((c = getopt(argc, argv, "bn:s:w:z:Z:l:r:g:k:e:p:a:A:h")) != -1) {
+        switch (c) {
+        case 'b':
+            w.binary = 1;
+            break;
+        case 'n':
+            ops = atoll(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            p = optarg;
+            for (i = 0; i < KINDS; i++) {
+                base_weights[i] = strtod(p, &p);
+                if (base_weights[i] < 0 || (i < KINDS - 1 && *p++ != ',')) {
+                    usage();
+                    exit(1);
+                }
+            }
+            break;
+        case 'z':
+            parse_dist(optarg, &size_dist);
+            break;
+        case 'Z':
+            max_size = atoi(optarg);
+            break;
+        case 'l':
+            parse_dist(optarg, &life_dist);
+            break;
+        case 'r':
+            burst_mean = atof(optarg);
+            break;
+        case 'g':
+            if (!strncmp(optarg, "geom:", 5)) {
+                growth = atof(optarg + 5);
+            } else if (!strncmp(optarg, "linear:", 7)) {
+                growth = atof(optarg + 7);
+                linear_growth = 1;
+            } else {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'k':
+            steps_mean = atof(optarg);
+            break;
+        case 'e':
+            gap_mean = atof(optarg);
+            break;
+        case 'p':
+            phases = atoi(optarg);
+            break;
+        case 'a':
+            if (sscanf(optarg, "%lf,%lf", &memalign_frac, &calloc_frac) != 2) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'A':
+            align = atoi(optarg);
+            break;
+        default:
+            usage();
+            exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if (optind != argc - 1 || ops <= 0 || phases <= 0 || max_size == 0 ||
+        burst_mean < 1 || base_weights[0] + base_weights[1] + base_weights[2] <= 0 ||
+        memalign_frac < 0 || calloc_frac < 0 || memalign_frac + calloc_frac > 1 ||
+        align == 0 || (align & (align - 1)) != 0) {
+        usage();
+        exit(1);
+    }
+    if ((w.fp = fopen(argv[optind], "w")) == NULL) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    setvbuf(w.fp, NULL, _IOFBF, 1 << 20);
+    write_header(&w);
+
+    rng_state = seed;
+    phase_len = (ops + phases - 1) / phases;
+    for (now = 0; (long long) now < ops; now++) {
+        if (now / phase_len != (unsigned long long) phase) {
+            phase = now / phase_len;
+            total = 0;
+            for (i = 0; i < KINDS; i++) {
+                weights[i] = base_weights[i];
+                if (phase > 0) {
+                    weights[i] *= exp(0.75 * rng_normal());
+                }
+                total += weights[i];
+            }
+            for (i = 0; i < KINDS; i++) {
+                weights[i] /= total;
+            }
+            scale = phase > 0 ? exp(1.4 * rng_double() - 0.7) : 1.0;
+        }
+
+        // due frees and growth steps come first
+        if (num_events > 0 && events[0].time <= now) {
+            e = pop_event();
+            if (e.steps == 0) {
+                emit(&w, FREE, e.id, 0, e.size);
+                continue;
+            }
+            size = linear_growth ? e.size + (unsigned int) growth
+                                 : (unsigned int) ceil(e.size * growth);
+            size = size > max_size ? max_size : size;
+            emit(&w, REALLOC, e.id, size, e.size);
+            push_event(now + 1 + (unsigned long long) (-gap_mean * log(1 - rng_double())),
+                       e.id, size, e.steps - 1);
+            continue;
+        }
+
+        if (burst_left > 0) {
+            kind = REQUEST;
+            burst_left--;
+        } else {
+            u = rng_double();
+            for (kind = 0; kind < KINDS - 1 && u >= weights[kind]; kind++) {
+                u -= weights[kind];
+            }
+            if (kind == REQUEST) {
+                // a request allocates its objects, works a while, frees them
+                burst_left = (long) floor(log(1 - rng_double()) / log(1 - 1 / burst_mean));
+                burst_end = now + 1 + burst_left +
+                    (unsigned long long) (-burst_mean * log(1 - rng_double()));
+            }
+        }
+
+        id = w.num_ids;
+        size = (unsigned int) fmin(fmax(draw(&size_dist) * scale, 1), max_size);
+        type = ALLOC;
+        if (memalign_frac + calloc_frac > 0 && size <= XALLOC_SIZE_MAX) {
+            u = rng_double();
+            type = (u < memalign_frac + calloc_frac) ? XALLOC : ALLOC;
+        }
+        if (type == XALLOC) {
+            emit(&w, XALLOC, id, (u < memalign_frac) ? XALLOC_MEMALIGN(size, __builtin_ctz(align))
+                                                     : XALLOC_CALLOC_OF(size), 0);
+        } else {
+            emit(&w, ALLOC, id, size, 0);
+        }
+        switch (kind) {
+        case CACHE:
+            push_event(now + 1 + (unsigned long long) fmax(draw(&life_dist), 0),
+                       id, size, 0);
+            break;
+        case REQUEST:
+            push_event(burst_end, id, size, 0);
+            break;
+        case BUFFER:
+            steps = (int) floor(log(1 - rng_double()) / log(1 - 1 / fmax(steps_mean + 1, 1.01)));
+            push_event(now + 1 + (unsigned long long) (-gap_mean * log(1 - rng_double())),
+                       id, size, steps);
+            break;
+        }
+    }
+
+    // free whatever is still live, oldest deadline first
+    while (num_events > 0) {
+        e = pop_event();
+        emit(&w, FREE, e.id, 0, e.size);
+    }
+    if (w.binary && w.n > 0) {
+        fwrite(w.ops, sizeof(traceop_t), w.n, w.fp);
+    }
+    if (w.num_ids == 0 || w.num_ids > TRACE_MAX_IDS || w.num_ops > 0x7fffffff) {
+        fprintf(stderr, "tracegen: %lld requests, %u ids do not fit a trace\n",
+                w.num_ops, w.num_ids);
+        exit(1);
+    }
+    rewind(w.fp);
+    write_header(&w);
+    if (fclose(w.fp) != 0) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    fprintf(stderr, "%lld requests, %u blocks, peak %llu live bytes\n",
+            w.num_ops, w.num_ids, w.peak_bytes);
+    return 0;
+}
+
+/*
+ * write_header - write the trace header; the first call writes a
+ *     placeholder of the same length that the last call overwrites
+ */
+static void write_header(writer_t *w)
+{
+    tracehdr_t hdr;
+
+    if (w->binary) {
+        memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+        hdr.sugg_heapsize = w->peak_bytes > 0x7fffffff ? 0x7fffffff : w->peak_bytes;
+        hdr.num_ids = w->num_ids;
+        hdr.num_ops = w->num_ops;
+        hdr.weight = 1;
+        fwrite(&hdr, sizeof(hdr), 1, w->fp);
+    } else {
+        // fixed width, so that rewriting it does not move the requests
+        fprintf(w->fp, "%-10llu\n%-10u\n%-10lld\n1\n",
+                w->peak_bytes > 0x7fffffff ? 0x7fffffff : w->peak_bytes,
+                w->num_ids, w->num_ops);
+    }
+}
+
+/*
+ * emit - write one request; the size of an XALLOC request is packed as
+ *     trace.h says
+ */
+static void emit(writer_t *w, int type, unsigned int id, unsigned int size,
+                 unsigned int oldsize)
+{
+    if (w->binary) {
+        w->ops[w->n].type = type;
+        w->ops[w->n].index = id;
+        w->ops[w->n].size = size;
+        if (++w->n == OPS_BUF) {
+            fwrite(w->ops, sizeof(traceop_t), w->n, w->fp);
+            w->n = 0;
+        }
+    } else if (type == FREE) {
+        fprintf(w->fp, "f %u\n", id);
+    } else if (type == XALLOC && (size & XALLOC_CALLOC)) {
+        fprintf(w->fp, "c %u %u\n", id, XALLOC_SIZE(size));
+    } else if (type == XALLOC) {
+        fprintf(w->fp, "m %u %u %u\n", id, XALLOC_SIZE(size), XALLOC_ALIGN(size));
+    } else {
+        fprintf(w->fp, "%c %u %u\n", type == ALLOC ? 'a' : 'r', id, size);
+    }
+    w->num_ops++;
+    if (type == XALLOC) {
+        size = XALLOC_SIZE(size);
+    }
+    if (type == ALLOC || type == XALLOC) {
+        w->num_ids++;
+    }
+    w->live_bytes += (unsigned long long) size - oldsize;
+    if (w->live_bytes > w->peak_bytes) {
+        w->peak_bytes = w->live_bytes;
+    }
+}
+
+static void push_event(unsigned long long time, unsigned int id,
+                       unsigned int size, int steps)
+{
+    long i = num_events++;
+
+    if (num_events > max_events) {
+        max_events = max_events ? 2 * max_events : 1024;
+        if ((events = realloc(events, max_events * sizeof(event_t))) == NULL) {
+            perror("tracegen");
+            exit(1);
+        }
+    }
+    for (; i > 0 && events[(i - 1) / 2].time > time; i = (i - 1) / 2) {
+        events[i] = events[(i - 1) / 2];
+    }
+    events[i].time = time;
+    events[i].id = id;
+    events[i].size = size;
+    events[i].steps = steps;
+}
+
+static event_t pop_event(void)
+{
+    event_t top = events[0];
+    event_t last = events[--num_events];
+    long i = 0, child;
+
+    while ((child = 2 * i + 1) < num_events) {
+        if (child + 1 < num_events && events[child + 1].time < events[child].time) {
+            child++;
+        }
+        if (last.time <= events[child].time) {
+            break;
+        }
+        events[i] = events[child];
+        i = child;
+    }
+    events[i] = last;
+    return top;
+}
+
+/*
+ * rng_double - uniform in [0, 1) from splitmix64, which gives the same
+ *     sequence for a seed on every machine, unlike rand()
+ */
+static double rng_double(void)
+{
+    unsigned long long z = (rng_state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / (1ULL << 53));
+}
+
+static double rng_normal(void)
+{
+    return sqrt(-2 * log(1 - rng_double())) * cos(2 * M_PI * rng_double());
+}
+
+static double draw(dist_t *d)
+{
+    switch (d->type) {
+    case CONST:
+        return d->a;
+    case UNIFORM:
+        return d->a + (d->b - d->a) * rng_double();
+    case EXP:
+        return -d->a * log(1 - rng_double());
+    case LOGNORMAL:
+        return d->a * exp(d->b * rng_normal());
+    case PARETO:
+        return d->a / pow(1 - rng_double(), 1 / d->b);
+    }
+    return 0;
+}
+
+static void parse_dist(char *spec, dist_t *d)
+{
+    static struct {
+        char *name;
+        int type;
+        int nparams;
+    } names[] = {
+        {"const", CONST, 1}, {"uniform", UNIFORM, 2}, {"exp", EXP, 1},
+        {"lognormal", LOGNORMAL, 2}, {"pareto", PARETO, 2},
+    };
+    size_t i, len;
+    char *p;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        len = strlen(names[i].name);
+        if (strncmp(spec, names[i].name, len) || spec[len] != ':') {
+            continue;
+        }
+        d->type = names[i].type;
+        d->a = strtod(spec + len + 1, &p);
+        d->b = 0;
+        if (names[i].nparams == 2 && *p == ':') {
+            d->b = strtod(p + 1, &p);
+        } else if (names[i].nparams == 2) {
+            break;
+        }
+        if (*p != '\0' || (d->type == PARETO && d->b <= 0)) {
+            break;
+        }
+        return;
+    }
+    fprintf(stderr, "tracegen: bad distribution %s\n", spec);
+    exit(1);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: tracegen [-b] [-n <ops>] [-s <seed>] [-w <cache,request,buffer>]\n");
+    fprintf(stderr, "                [-z <dist>] [-Z <max size>] [-l <dist>] [-r <burst>]\n");
+    fprintf(stderr, "                [-g geom:F|linear:STEP] [-k <steps>] [-e <gap>]\n");
+    fprintf(stderr, "                [-p <phases>] [-a <memalign,calloc>] [-A <align>] <outfile>\n");
+    fprintf(stderr, "\t-b        Write a binary trace instead of a .rep trace.\n");
+    fprintf(stderr, "\t-n <ops>  Requests before the live blocks are freed (100000).\n");
+    fprintf(stderr, "\t-s <seed> Random seed (1).\n");
+    fprintf(stderr, "\t-w <w,w,w> Weights of new cache, request and buffer objects (30,60,10).\n");
+    fprintf(stderr, "\t-z <dist> Object sizes in bytes (lognormal:64:1).\n");
+    fprintf(stderr, "\t-Z <size> Largest object (1048576).\n");
+    fprintf(stderr, "\t-l <dist> Cache object lifetimes in requests (exp:20000).\n");
+    fprintf(stderr, "\t-r <n>    Mean objects per request burst (16).\n");
+    fprintf(stderr, "\t-g <curve> Buffer growth per realloc (geom:1.5).\n");
+    fprintf(stderr, "\t-k <n>    Mean growth steps per buffer (8).\n");
+    fprintf(stderr, "\t-e <n>    Mean requests between growth steps (100).\n");
+    fprintf(stderr, "\t-p <n>    Phases with drifting weights and sizes (1).\n");
+    fprintf(stderr, "\t-a <m,c>  Fractions of new objects memalign'd and calloc'd (0,0).\n");
+    fprintf(stderr, "\t-A <n>    Alignment of memalign'd objects, a power of two (64).\n");
+    fprintf(stderr, "Distributions: const:V uniform:LO:HI exp:MEAN lognormal:MEDIAN:SIGMA pareto:MIN:ALPHA\n");
+}
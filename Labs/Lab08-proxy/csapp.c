@@ -23,6 +23,7 @@
  */
 /* $begin csapp.c */
 #include "csapp.h"
+#include <netinet/tcp.h>
 
 /************************** 
  * Error-handling functions
@@ -793,6 +794,56 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 /* $end rio_writen */
 
 
+/*
+ * rio_fill - Refill the internal buffer via read() if it is empty.
+ *    Returns the number of unread bytes, 0 on EOF, -1 on error.
+ */
+/* $begin rio_fill */
+static ssize_t rio_fill(rio_t *rp)
+{
+    ssize_t nread;
+
+    while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
+	nread = read(rp->rio_fd, rp->rio_buf, rp->rio_bufsize);
+	if (nread < 0) {
+	    if (errno != EINTR) /* Interrupted by sig handler return */
+		return -1;
+	}
+	else if (nread == 0)    /* EOF */
+	    return 0;
+	else {
+	    rp->rio_cnt = nread;
+	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
+	}
+    }
+    return rp->rio_cnt;
+}
+/* $end rio_fill */
+
+/*
+ * rio_fillmore - Move the unread bytes to the front of the internal
+ *    buffer and append one read() after them. The buffer must not be
+ *    full. Returns the number of bytes read, 0 on EOF, -1 on error.
+ */
+/* $begin rio_fillmore */
+static ssize_t rio_fillmore(rio_t *rp)
+{
+    ssize_t nread;
+
+    if (rp->rio_bufptr != rp->rio_buf) {
+	memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+	rp->rio_bufptr = rp->rio_buf;
+    }
+    while ((nread = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt, 
+			 rp->rio_bufsize - rp->rio_cnt)) < 0) {
+	if (errno != EINTR) /* Interrupted by sig handler return */
+	    return -1;
+    }
+    rp->rio_cnt += nread;
+    return nread;
+}
+/* $end rio_fillmore */
+
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
  *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
@@ -805,19 +856,10 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 {
     int cnt;
+    ssize_t rc;
 
-    while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
-	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
-			   sizeof(rp->rio_buf));
-	if (rp->rio_cnt < 0) {
-	    if (errno != EINTR) /* Interrupted by sig handler return */
-		return -1;
-	}
-	else if (rp->rio_cnt == 0)  /* EOF */
-	    return 0;
-	else 
-	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
-    }
+    if ((rc = rio_fill(rp)) <= 0)
+	return rc;              /* EOF or error */
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
     cnt = n;          
@@ -838,12 +880,50 @@ void rio_readinitb(rio_t *rp, int fd)
 {
     rp->rio_fd = fd;  
     rp->rio_cnt = 0;  
+    rp->rio_buf = rp->rio_ibuf;
+    rp->rio_bufsize = sizeof(rp->rio_ibuf);
     rp->rio_bufptr = rp->rio_buf;
 }
 /* $end rio_readinitb */
 
 /*
- * rio_readnb - Robustly read n bytes (buffered)
+ * rio_readinitbuf - Like rio_readinitb, but read through the caller's
+ *    buffer of the given size instead of the RIO_BUFSIZE one in rio_t
+ */
+/* $begin rio_readinitbuf */
+void rio_readinitbuf(rio_t *rp, int fd, char *buf, size_t size)
+{
+    rp->rio_fd = fd;
+    rp->rio_cnt = 0;
+    rp->rio_buf = buf;
+    rp->rio_bufsize = size;
+    rp->rio_bufptr = rp->rio_buf;
+}
+/* $end rio_readinitbuf */
+
+/*
+ * rio_setbufb - Switch rp over to another buffer, e.g. a larger one for
+ *    the body after the headers were parsed. Unread bytes move along, so
+ *    the new buffer must be able to hold them. Returns -1 if it can't.
+ */
+/* $begin rio_setbufb */
+int rio_setbufb(rio_t *rp, char *buf, size_t size)
+{
+    if (size < rp->rio_cnt || size == 0) {
+	errno = EINVAL;
+	return -1;
+    }
+    memmove(buf, rp->rio_bufptr, rp->rio_cnt);
+    rp->rio_buf = buf;
+    rp->rio_bufsize = size;
+    rp->rio_bufptr = buf;
+    return 0;
+}
+/* $end rio_setbufb */
+
+/*
+ * rio_readnb - Robustly read n bytes (buffered). Requests at least as
+ *    large as the internal buffer are read straight into usrbuf.
  */
 /* $begin rio_readnb */
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n) 
@@ -853,7 +933,18 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
     char *bufp = usrbuf;
     
     while (nleft > 0) {
-	if ((nread = rio_read(rp, bufp, nleft)) < 0) 
+	if (rp->rio_cnt == 0 && nleft >= rp->rio_bufsize) {
+	    /* Buffer is empty and would only add a copy: read directly */
+	    if ((nread = read(rp->rio_fd, bufp, nleft)) < 0) {
+		if (errno == EINTR) /* Interrupted by sig handler return */
+		    nread = 0;      /* and call read() again */
+		else
+		    return -1;      /* errno set by read() */
+	    }
+	    else if (nread == 0)
+		break;              /* EOF */
+	}
+	else if ((nread = rio_read(rp, bufp, nleft)) < 0) 
             return -1;          /* errno set by read() */ 
 	else if (nread == 0)
 	    break;              /* EOF */
@@ -865,34 +956,241 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 /* $end rio_readnb */
 
 /* 
- * rio_readlineb - Robustly read a text line (buffered)
+ * rio_readlineb - Robustly read a text line (buffered). Scans the
+ *    internal buffer for the newline with memchr() and copies whole
+ *    spans with memcpy() instead of going through it byte by byte.
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {
-                n++;
-     		break;
-            }
-	} else if (rc == 0) {
-	    if (n == 1)
+    size_t n = 0, cnt;
+    ssize_t rc;
+    char *bufp = usrbuf, *nl = NULL;
+
+    if (maxlen == 0)
+	return 0;
+    while (n < maxlen - 1 && nl == NULL) {
+	if ((rc = rio_fill(rp)) < 0)
+	    return -1;	  /* Error */
+	else if (rc == 0) {
+	    if (n == 0)
 		return 0; /* EOF, no data read */
 	    else
 		break;    /* EOF, some data was read */
-	} else
-	    return -1;	  /* Error */
+	}
+	cnt = maxlen - 1 - n;
+	if (rp->rio_cnt < cnt)
+	    cnt = rp->rio_cnt;
+	if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+	    cnt = nl - rp->rio_bufptr + 1;
+	memcpy(bufp, rp->rio_bufptr, cnt);
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	bufp += cnt;
+	n += cnt;
     }
     *bufp = 0;
-    return n-1;
+    return n;
 }
 /* $end rio_readlineb */
 
+/* 
+ * rio_readlinep - Zero-copy rio_readlineb. Points *linep at the next
+ *    line inside the internal buffer and returns its length, newline
+ *    included. The line is not null-terminated and stays valid only
+ *    until the next read from rp. A line that does not fit in the
+ *    buffer is returned in buffer-sized pieces without a newline.
+ *    Returns 0 on EOF with no data read, -1 on error.
+ */
+/* $begin rio_readlinep */
+ssize_t rio_readlinep(rio_t *rp, char **linep)
+{
+    size_t scanned = 0, cnt;
+    ssize_t nread;
+    char *nl;
+
+    while ((nl = memchr(rp->rio_bufptr + scanned, '\n', 
+			rp->rio_cnt - scanned)) == NULL) {
+	scanned = rp->rio_cnt;
+	if (rp->rio_cnt == rp->rio_bufsize)
+	    break;                    /* Line longer than the buffer */
+	if ((nread = rio_fillmore(rp)) < 0)
+	    return -1;                /* Read in the rest of the line */
+	else if (nread == 0)
+	    break;                    /* EOF */
+    }
+
+    cnt = nl ? (size_t)(nl - rp->rio_bufptr + 1) : (size_t)rp->rio_cnt;
+    *linep = rp->rio_bufptr;
+    rp->rio_bufptr += cnt;
+    rp->rio_cnt -= cnt;
+    return cnt;
+}
+/* $end rio_readlinep */
+
+/*
+ * rio_peekb - Zero-copy look at the input. Reads until at least n bytes
+ *    (at most the buffer size) are buffered or EOF, points *bufp at them
+ *    and returns how many bytes are buffered, which may be more than n.
+ *    Nothing is consumed; call rio_consumeb() once they were used. The
+ *    bytes stay valid until the next read from rp. Returns 0 on EOF with
+ *    nothing buffered, -1 on error.
+ */
+/* $begin rio_peekb */
+ssize_t rio_peekb(rio_t *rp, char **bufp, size_t n)
+{
+    ssize_t nread;
+
+    if (n > rp->rio_bufsize)
+	n = rp->rio_bufsize;
+    while (rp->rio_cnt < n) {
+	if ((nread = rio_fillmore(rp)) < 0)
+	    return -1;
+	else if (nread == 0)
+	    break;              /* EOF */
+    }
+    *bufp = rp->rio_bufptr;
+    return rp->rio_cnt;
+}
+/* $end rio_peekb */
+
+/*
+ * rio_consumeb - Drop the first n bytes returned by rio_peekb()
+ */
+/* $begin rio_consumeb */
+void rio_consumeb(rio_t *rp, size_t n)
+{
+    if (n > rp->rio_cnt)
+	n = rp->rio_cnt;
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+}
+/* $end rio_consumeb */
+
+/*
+ * rio_writev - Robustly write every byte of an iovec array (unbuffered),
+ *    resuming after short writes. Modifies iov.
+ */
+/* $begin rio_writev */
+static ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t nwritten, total = 0;
+
+    while (iovcnt > 0) {
+	if (iov->iov_len == 0) { /* Skip drained entries */
+	    iov++;
+	    iovcnt--;
+	    continue;
+	}
+	if ((nwritten = writev(fd, iov, iovcnt)) <= 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		continue;        /* and call writev() again */
+	    return -1;           /* errno set by writev() */
+	}
+	total += nwritten;
+	while (nwritten > 0 && nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (nwritten > 0) {      /* Short write inside an entry */
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    return total;
+}
+/* $end rio_writev */
+
+/*
+ * rio_writeinitb - Associate a descriptor with a write buffer and reset buffer
+ */
+/* $begin rio_writeinitb */
+void rio_writeinitb(rio_wbuf_t *wp, int fd)
+{
+    wp->rio_fd = fd;
+    wp->rio_cnt = 0;
+    wp->rio_corked = 0;
+}
+/* $end rio_writeinitb */
+
+/*
+ * rio_flushb - Write out every byte held in the internal buffer
+ */
+/* $begin rio_flushb */
+ssize_t rio_flushb(rio_wbuf_t *wp)
+{
+    ssize_t n = wp->rio_cnt;
+
+    if (n == 0)
+	return 0;
+    if (rio_writen(wp->rio_fd, wp->rio_buf, n) != n)
+	return -1;
+    wp->rio_cnt = 0;
+    return n;
+}
+/* $end rio_flushb */
+
+/*
+ * rio_writenb - Robustly write n bytes (buffered). Small writes are
+ *    copied into the internal buffer, which is only written out once it
+ *    fills up or on rio_flushb(). A payload at least as large as the
+ *    buffer is not copied, it goes out together with the buffered bytes
+ *    in a single writev().
+ */
+/* $begin rio_writenb */
+ssize_t rio_writenb(rio_wbuf_t *wp, void *usrbuf, size_t n)
+{
+    struct iovec iov[2];
+
+    if (n <= RIO_WBUFSIZE - wp->rio_cnt) {  /* Fits, just copy */
+	memcpy(wp->rio_buf + wp->rio_cnt, usrbuf, n);
+	wp->rio_cnt += n;
+	return n;
+    }
+    if (n < RIO_WBUFSIZE) {                 /* Make room, then copy */
+	if (rio_flushb(wp) < 0)
+	    return -1;
+	memcpy(wp->rio_buf, usrbuf, n);
+	wp->rio_cnt = n;
+	return n;
+    }
+
+    iov[0].iov_base = wp->rio_buf;          /* Gather buffer + payload */
+    iov[0].iov_len = wp->rio_cnt;
+    iov[1].iov_base = usrbuf;
+    iov[1].iov_len = n;
+    if (rio_writev(wp->rio_fd, iov, 2) < 0)
+	return -1;
+    wp->rio_cnt = 0;
+    return n;
+}
+/* $end rio_writenb */
+
+/*
+ * rio_corkb - Cork (on != 0) or uncork a TCP socket. While corked the
+ *    kernel only sends full segments, so a response flushed in several
+ *    pieces still leaves in as few packets as possible. Uncorking flushes
+ *    the internal buffer and pushes out the last partial segment. A no-op
+ *    for descriptors that are not TCP sockets.
+ */
+/* $begin rio_corkb */
+int rio_corkb(rio_wbuf_t *wp, int on)
+{
+    on = (on != 0);
+    if (!on && rio_flushb(wp) < 0)
+	return -1;
+#ifdef TCP_CORK
+    if (on != wp->rio_corked &&
+	setsockopt(wp->rio_fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) < 0 &&
+	errno != ENOTSOCK && errno != EOPNOTSUPP && errno != ENOPROTOOPT)
+	return -1;
+#endif
+    wp->rio_corked = on;
+    return 0;
+}
+/* $end rio_corkb */
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
@@ -916,6 +1214,17 @@ void Rio_readinitb(rio_t *rp, int fd)
     rio_readinitb(rp, fd);
 } 
 
+void Rio_readinitbuf(rio_t *rp, int fd, char *buf, size_t size)
+{
+    rio_readinitbuf(rp, fd, buf, size);
+}
+
+void Rio_setbufb(rio_t *rp, char *buf, size_t size)
+{
+    if (rio_setbufb(rp, buf, size) < 0)
+	unix_error("Rio_setbufb error");
+}
+
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n) 
 {
     ssize_t rc;
@@ -934,6 +1243,47 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
     return rc;
 } 
 
+ssize_t Rio_readlinep(rio_t *rp, char **linep)
+{
+    ssize_t rc;
+
+    if ((rc = rio_readlinep(rp, linep)) < 0)
+	unix_error("Rio_readlinep error");
+    return rc;
+}
+
+ssize_t Rio_peekb(rio_t *rp, char **bufp, size_t n)
+{
+    ssize_t rc;
+
+    if ((rc = rio_peekb(rp, bufp, n)) < 0)
+	unix_error("Rio_peekb error");
+    return rc;
+}
+
+void Rio_writeinitb(rio_wbuf_t *wp, int fd)
+{
+    rio_writeinitb(wp, fd);
+}
+
+void Rio_writenb(rio_wbuf_t *wp, void *usrbuf, size_t n)
+{
+    if (rio_writenb(wp, usrbuf, n) != n)
+	unix_error("Rio_writenb error");
+}
+
+void Rio_flushb(rio_wbuf_t *wp)
+{
+    if (rio_flushb(wp) < 0)
+	unix_error("Rio_flushb error");
+}
+
+void Rio_corkb(rio_wbuf_t *wp, int on)
+{
+    if (rio_corkb(wp, on) < 0)
+	unix_error("Rio_corkb error");
+}
+
 /******************************** 
  * Client/server helper functions
  ********************************/
@@ -0,0 +1,102 @@
+#!/usr/bin/python3
+
+"""
+loadgen.py - closed-loop HTTP/1.0 load generator for tiny and the proxy
+
+Keeps <concurrency> connections in flight, each sending one GET and reading
+the response until EOF, until <requests> responses have been received.
+Prints throughput, and with --pid, the read/write-class syscalls the server
+made per request (from /proc/<pid>/io; io_uring operations don't show up
+there, servers in io_uring mode report their io_uring_enter calls).
+
+usage: loadgen.py [--proxy host:port] [--gzip] [--pid pid]
+                  <host> <port> <path> <concurrency> <requests>
+"""
+
+import argparse
+import selectors
+import socket
+import time
+
+
+def proc_io(pid):
+    counts = {}
+    with open("/proc/%d/io" % pid) as f:
+        for line in f:
+            key, val = line.split(":")
+            counts[key] = int(val)
+    return counts["syscr"] + counts["syscw"]
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("host")
+    ap.add_argument("port", type=int)
+    ap.add_argument("path")
+    ap.add_argument("concurrency", type=int)
+    ap.add_argument("requests", type=int)
+    ap.add_argument("--proxy", help="send requests through the proxy at host:port")
+    ap.add_argument("--gzip", action="store_true", help="send Accept-Encoding: gzip")
+    ap.add_argument("--pid", type=int, help="server pid, to count its syscalls")
+    args = ap.parse_args()
+
+    if args.proxy:
+        target = args.proxy.split(":")
+        target = (target[0], int(target[1]))
+        uri = "http://%s:%d%s" % (args.host, args.port, args.path)
+    else:
+        target = (args.host, args.port)
+        uri = args.path
+    req = "GET %s HTTP/1.0\r\nHost: %s\r\n" % (uri, args.host)
+    if args.gzip:
+        req += "Accept-Encoding: gzip\r\n"
+    req = (req + "\r\n").encode()
+
+    sel = selectors.DefaultSelector()
+    started = done = nbytes = errors = 0
+
+    def start():
+        nonlocal started
+        s = socket.socket()
+        s.setblocking(False)
+        s.connect_ex(target)
+        sel.register(s, selectors.EVENT_WRITE, [req, 0])
+        started += 1
+
+    sys0 = proc_io(args.pid) if args.pid else 0
+    t0 = time.time()
+    while started < min(args.concurrency, args.requests):
+        start()
+    while done < args.requests:
+        for key, ev in sel.select(timeout=10):
+            s, st = key.fileobj, key.data
+            try:
+                if ev & selectors.EVENT_WRITE:
+                    st[0] = st[0][s.send(st[0]):]
+                    if not st[0]:
+                        sel.modify(s, selectors.EVENT_READ, st)
+                    continue
+                data = s.recv(65536)
+            except OSError:
+                data, errors = b"", errors + 1
+            if data:
+                st[1] += len(data)
+                continue
+            sel.unregister(s)
+            s.close()
+            nbytes += st[1]
+            done += 1
+            if started < args.requests:
+                start()
+    elapsed = time.time() - t0
+    sys1 = proc_io(args.pid) if args.pid else 0
+
+    print("%d requests, concurrency %d: %.0f req/s, %.1f MB/s, %d bytes/req, %d errors"
+          % (done, args.concurrency, done / elapsed, nbytes / elapsed / 1e6,
+             nbytes // done, errors))
+    if args.pid:
+        print("server read/write syscalls per request: %.2f" % ((sys1 - sys0) / done))
+
+
+if __name__ == "__main__":
+    main()
@@ -2,6 +2,8 @@
 #include "csapp.h"
 #include "blockqueue.h"
 #include "cache.h"
+#include "uring.h"
+#include "region.h"
 
 /* Recommended max cache and object sizes */
 #define MAX_CACHE_SIZE 1049000
@@ -16,6 +18,19 @@
 // max size of every lines in http
 #define MAX_HTTP_LINE 1024
 
+// relay buffer of each worker thread, responses are read through it
+#define RELAY_BUFSIZE (64*1024)
+
+// chunk size of the regions the request lines are parsed and built in
+#define REQ_CHUNK (16*1024)
+
+// request lines read before the array holding them grows
+#define REQ_LINES 16
+
+// io_uring mode: ring size and connection slots (one registered buffer each)
+#define PC_RING_ENTRIES 512
+#define PC_MAX_CONNS 256
+
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
 
@@ -25,40 +40,81 @@ BlockQueue *BQ;
 // Cache based on LRU, providing thread-safely insert and get method
 LruCache *lruCache;
 
-// worker thread, for comsuming BQ, gets a integer argument as connected socket fd
+// what a worker thread reuses from one request to the next
+typedef struct {
+    char *relaybuf;    // responses are read through it
+    region_t *region;  // request lines live here until the request is done
+} WorkerCtx;
+
+// request lines come from a region reset after every request; -m makes
+// the regions pass every allocation to malloc, to compare the two
+static region_fallback_t malloc_fallback = {malloc, free};
+static region_fallback_t *req_fallback = NULL;
+
+// worker thread, for comsuming BQ; worker_task gets the thread's WorkerCtx
 void *worker_thread(void *vargp);
 void *worker_task(void *vargp);
 
-// get an entire http request from socket fd, and return the request-line in http
-char **get_http_request(int fd);
+// get an entire http request from socket fd into region, and return the request-line in http
+char **get_http_request(int fd, region_t *region);
 
 // get hostname from http request line
 void gethostnamefromhttp(char *src, char *method, char *host, char *port, char *uri);
 
+// build the http request sent to the server in region, a null-terminated array of lines
+char **make_http_request(char *hostname, char *uri, region_t *region);
+
 // send an http request
 int send_http_request(int fd, char **httpreq);
 
-// redirect http response
-int redirect_http_response(int srcfd, int desfd, char *cache_key);
+// redirect http response, reading it through relaybuf of RELAY_BUFSIZE bytes
+int redirect_http_response(int srcfd, int desfd, char *cache_key, char *relaybuf);
+
+// region wrappers that exit on error, like csapp's Malloc
+static region_t *Region_create(size_t chunk_size, const region_fallback_t *fallback);
+static void *Region_alloc(region_t *r, size_t size);
 
-// free space of string array
-void free_str_arr(char **arr);
+// serve every connection from one io_uring completion loop, returns only if setup fails
+void uring_proxy(uring_t *ring, int listenfd);
 
 int main(int argc, char **argv)
 {
-    int i, listenfd, connfd;
+    int i, listenfd, connfd, use_uring = 0;
     socklen_t clientlen;
     struct sockaddr_storage clientaddr;
     pthread_t tid;
-
+    uring_t ring;
+
+    while (argc > 2 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-u")) { // -u: io_uring mode
+            use_uring = 1;
+        } else if (!strcmp(argv[1], "-m")) { // -m: request lines from malloc
+            req_fallback = &malloc_fallback;
+        } else {
+            break;
+        }
+        argc--;
+        argv++;
+    }
     if (argc != 2) {
-        perror("usage error");
+        fprintf(stderr, "usage: %s [-u] [-m] <port>\n", argv[0]);
         exit(0);
     }
 
+    // a client or server hanging up mid-response must not kill the proxy
+    Signal(SIGPIPE, SIG_IGN);
+
     // 1.initialize shared blocked queue and cache
     BQ = bq_init(MAX_BQ_SIZE);
     lruCache = cache_create(MAX_CACHE_SIZE, MAX_OBJECT_SIZE);
+    listenfd = Open_listenfd(argv[1]); // get and set a listening socket
+
+    if (use_uring) {
+        if (uring_init(&ring, PC_RING_ENTRIES) == 0) {
+            uring_proxy(&ring, listenfd);
+        }
+        fprintf(stderr, "io_uring unavailable (%s), using blocking I/O\n", strerror(errno));
+    }
 
     // 2.initialize the worker thread (create pthreads that get task from MyTaskQueue and finish it)
     for (i=0; i<MAX_WK_NUM; i++) {
@@ -66,7 +122,6 @@ int main(int argc, char **argv)
     }
 
     // 3.Listening a specified port
-    listenfd = Open_listenfd(argv[1]); // get and set a listening socket
     while(1) { // produce task
         clientlen = sizeof(struct sockaddr_storage);
         connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
@@ -81,12 +136,18 @@ int main(int argc, char **argv)
 }
 
 void *worker_thread(void *vargp) {
+    WorkerCtx ctx;
+
+    ctx.relaybuf = Malloc(RELAY_BUFSIZE); // reused by every request of this thread
+    ctx.region = Region_create(REQ_CHUNK, req_fallback);
     while(1) {
-        worker_task(vargp);
+        worker_task(&ctx);
+        region_reset(ctx.region); // whatever the request parsed and built, at once
     }
 }
 
 void *worker_task(void *vargp) {
+    WorkerCtx *ctx = vargp;
     int connfd, clientfd;
     char **old_req;
     char hostname[MAXLINE], port[MAXLINE], method[MAXLINE], uri[MAXLINE];
@@ -94,58 +155,45 @@ void *worker_task(void *vargp) {
     connfd = bq_get(BQ);
 
     // 1.wait and read an entire HTTP request
-    old_req = get_http_request(connfd);
+    old_req = get_http_request(connfd, ctx->region);
     // 2.check if cache-hit
     CacheItem *cacheItem = cache_get(old_req[0], lruCache);
     if (cacheItem != NULL) {
         // cache hitting
         Rio_writen(connfd, cacheItem->value, cacheItem->size);
-        free_str_arr(old_req);
+        Close(connfd);
         return 0;
     }
     // cache missiing
     char *cache_key = Malloc(sizeof(*cache_key)*MAXLINE); // get cache key
     strcpy(cache_key, old_req[0]);
     gethostnamefromhttp(old_req[0], method, hostname, port, uri);
-    free_str_arr(old_req);
     if (strncmp("GET", method, 3)) {
         printf("invalid http method\n");
+        Free(cache_key);
+        Close(connfd);
         return 0;
     }
 
     // 2.add some HTTP head
-    char **new_req = Malloc(sizeof(*new_req)*6);
-    new_req[0] = Malloc(sizeof(*new_req[0])*MAX_HTTP_LINE);
-    sprintf(new_req[0], "GET /%s HTTP/1.0\r\n\r\n", uri);
-    new_req[1] = Malloc(sizeof(*new_req[1])*22);
-    sprintf(new_req[1], "Connection: close\r\n");
-    new_req[2] = Malloc(sizeof(*new_req[2])*28);
-    sprintf(new_req[2], "Proxy-Connection: close\r\n");
-    new_req[3] = Malloc(sizeof(*new_req[3])*128);
-    strcpy(new_req[3], user_agent_hdr); // copy user_agent_hdr, including the terminating null byte
-    new_req[4] = Malloc(sizeof(*new_req[4])*MAX_HTTP_LINE);
-    sprintf(new_req[4], "Host: %s\r\n\r\n", hostname);
-    new_req[5] = NULL; // null-terminated
+    char **new_req = make_http_request(hostname, uri, ctx->region);
 
     // 3.request with new HTTP request
     if ((clientfd = open_clientfd(hostname, port)) < 0) {
-        free_str_arr(new_req);
         // Close(clientfd);
         Close(connfd);
         printf("open_clientfd fail\n");
         return 0;
     }
     if (send_http_request(clientfd, new_req)) {
-        free_str_arr(new_req);
         Close(clientfd);
         Close(connfd);
         printf("send_http_request fail\n");
         return 0;
     }
-    free_str_arr(new_req);
 
     // 4.redirect response to client
-    if (redirect_http_response(clientfd, connfd, cache_key)) {
+    if (redirect_http_response(clientfd, connfd, cache_key, ctx->relaybuf)) {
         printf("redirect_http_response fail\n");
     }
 
@@ -155,28 +203,29 @@ void *worker_task(void *vargp) {
     return 0;
 }
 
-char **get_http_request(int fd) {
-    char **req;
-    size_t req_sz = 1;
+char **get_http_request(int fd, region_t *region) {
+    char **req, **old;
+    size_t req_sz = 1, req_cap = REQ_LINES;
     ssize_t sz;
     rio_t rbuf; // internal read buffer, stored on stack instead of heap
     char httptext[MAX_HTTP_LINE];
-    int termi_cnt = 0; // count "\r\n" http section barrier textline
 
     Rio_readinitb(&rbuf, fd); // init internal read buffer
 
-    req = Malloc(sizeof(req)*req_sz);
+    req = Region_alloc(region, sizeof(*req)*req_cap);
     req[0] = NULL; // null terminated array
     while((sz = Rio_readlineb(&rbuf, &httptext, MAX_HTTP_LINE)) > 0) {
-        req = Realloc(req, sizeof(req)*(req_sz + 1));
-        req[req_sz-1] = Malloc(sizeof(*req)*MAX_HTTP_LINE);
-        strncpy(req[req_sz-1], httptext, sz);
-        req_sz++;
-        if (strncmp(httptext, "\r\n", 2)) {
-            termi_cnt++;
+        if (req_sz == req_cap) { // no realloc in a region: copy into one twice as large
+            old = req;
+            req = Region_alloc(region, sizeof(*req)*req_cap*2);
+            memcpy(req, old, sizeof(*req)*req_cap);
+            req_cap *= 2;
         }
-        if (termi_cnt >= 2) {
-            break; // already get an entire http GET request
+        req[req_sz-1] = Region_alloc(region, sz + 1);
+        memcpy(req[req_sz-1], httptext, sz + 1); // including the terminating null byte
+        req_sz++;
+        if (!strcmp(httptext, "\r\n")) {
+            break; // "\r\n" barrier textline, already get an entire http GET request
         }
     }
     req[req_sz-1] = NULL; // null terminated array
@@ -184,27 +233,50 @@ char **get_http_request(int fd) {
     return req;
 }
 
+char **make_http_request(char *hostname, char *uri, region_t *region) {
+    char **new_req = Region_alloc(region, sizeof(*new_req)*6);
+    new_req[0] = Region_alloc(region, sizeof(*new_req[0])*MAX_HTTP_LINE);
+    sprintf(new_req[0], "GET /%s HTTP/1.0\r\n", uri); // headers follow, the blank line ends them
+    new_req[1] = Region_alloc(region, sizeof(*new_req[1])*22);
+    sprintf(new_req[1], "Connection: close\r\n");
+    new_req[2] = Region_alloc(region, sizeof(*new_req[2])*28);
+    sprintf(new_req[2], "Proxy-Connection: close\r\n");
+    new_req[3] = Region_alloc(region, sizeof(*new_req[3])*128);
+    strcpy(new_req[3], user_agent_hdr); // copy user_agent_hdr, including the terminating null byte
+    new_req[4] = Region_alloc(region, sizeof(*new_req[4])*MAX_HTTP_LINE);
+    sprintf(new_req[4], "Host: %s\r\n\r\n", hostname);
+    new_req[5] = NULL; // null-terminated
+    return new_req;
+}
+
 int send_http_request(int fd, char **httpreq) {
     int i;
+    rio_wbuf_t wbuf;
+
+    // gather every header line and send them with a single write
+    Rio_writeinitb(&wbuf, fd);
     for (i=0; httpreq[i]; i++) {
-        Rio_writen(fd, httpreq[i], strlen(httpreq[i]));
+        Rio_writenb(&wbuf, httpreq[i], strlen(httpreq[i]));
     }
+    Rio_flushb(&wbuf);
     return 0;
 }
 
-int redirect_http_response(int srcfd, int desfd, char *cache_key) {
-    char buf[MAXLINE];
+int redirect_http_response(int srcfd, int desfd, char *cache_key, char *relaybuf) {
+    char *data;
     ssize_t rsz, cache_sz=0;
     rio_t rio;
     char *cache_buf = Malloc(sizeof(cache_buf)*MAX_OBJECT_SIZE);
 
-    Rio_readinitb(&rio, srcfd);
-    while((rsz = Rio_readnb(&rio, buf, MAX_HTTP_LINE)) > 0) {
-        Rio_writen(desfd, buf, rsz);
+    // forward whatever each read brings straight out of the relay buffer
+    Rio_readinitbuf(&rio, srcfd, relaybuf, RELAY_BUFSIZE);
+    while((rsz = Rio_peekb(&rio, &data, 1)) > 0) {
+        Rio_writen(desfd, data, rsz);
         if (cache_sz + rsz <= MAX_OBJECT_SIZE) {
-            strncpy(cache_buf+cache_sz, buf, rsz);
+            memcpy(cache_buf+cache_sz, data, rsz); // response may be binary
         }
         cache_sz += rsz;
+        rio_consumeb(&rio, rsz);
     }
 
     // cache this http response
@@ -241,11 +313,278 @@ void gethostnamefromhttp(char *src, char *method, char *host, char *port, char *
     return;
 }
 
-void free_str_arr(char **arr) {
-    char **sta = arr;
-    while (arr != NULL && *arr != NULL) {
-        Free(*arr);
-        arr++;
+static region_t *Region_create(size_t chunk_size, const region_fallback_t *fallback) {
+    region_t *r;
+
+    if ((r = region_create(chunk_size, fallback)) == NULL) {
+        unix_error("Region_create error");
     }
-    Free(sta);
-}
\ No newline at end of file
+    return r;
+}
+
+static void *Region_alloc(region_t *r, size_t size) {
+    void *p;
+
+    if ((p = region_alloc(r, size)) == NULL) {
+        unix_error("Region_alloc error");
+    }
+    return p;
+}
+
+/*
+ * io_uring mode: one completion loop relays every connection. Client
+ * requests and server responses are read into registered buffers and
+ * responses are written back from them; every accept, read, send and
+ * close is queued on the ring and submitted in one io_uring_enter()
+ * per loop iteration. Connecting to the server is still blocking.
+ */
+
+// operation encoded in the low byte of a request tag
+#define PT_ACCEPT    1
+#define PT_READ_REQ  2  // reading the client's request
+#define PT_SEND      3  // sending out (request to server, or cached response to client)
+#define PT_READ_RESP 4  // reading the server's response
+#define PT_WRITE     5  // writing a response chunk to the client
+#define PT_CLOSE     6
+#define PT_TAG(slot, op) (((uint64_t)(slot) << 8) | (op))
+
+// per-connection state of the completion loop
+typedef struct {
+    int connfd;        // client socket, -1 if the slot is free
+    int srvfd;         // server socket, -1 when serving from cache
+    int rcnt;          // request bytes in buf
+    char *buf;         // registered buffer of MAXLINE bytes
+    char *out;         // pending send, malloc'd
+    size_t outlen, outoff;
+    size_t wlen, woff; // response chunk in buf being written to the client
+    char *cache_key;
+    char *cache_buf;
+    size_t cache_sz;
+} pconn_t;
+
+static pconn_t *pconns;
+static int *pfree, npfree; // stack of free connection slots
+static unsigned long preqs; // requests completed in io_uring mode
+static region_t *pregion;   // the request being built, reset once it is flattened
+
+// release a connection and queue the close of its sockets
+static void pconn_close(uring_t *ring, int slot) {
+    pconn_t *c = &pconns[slot];
+    if (c->srvfd >= 0) {
+        uring_close(ring, c->srvfd, PT_TAG(slot, PT_CLOSE));
+        c->srvfd = -1;
+    }
+    uring_close(ring, c->connfd, PT_TAG(slot, PT_CLOSE));
+    c->connfd = -1;
+    if (c->out != NULL) {
+        Free(c->out);
+        c->out = NULL;
+    }
+    if (c->cache_key != NULL) {
+        Free(c->cache_key);
+        c->cache_key = NULL;
+    }
+    if (c->cache_buf != NULL) {
+        Free(c->cache_buf);
+        c->cache_buf = NULL;
+    }
+    pfree[npfree++] = slot;
+}
+
+// a response was fully relayed, report now and then how many io_uring_enter calls it took
+static void pconn_done(uring_t *ring, int slot) {
+    if (++preqs % 1000 == 0) {
+        printf("io_uring: %lu requests, %lu io_uring_enter calls\n", preqs, ring->enters);
+        fflush(stdout);
+    }
+    pconn_close(ring, slot);
+}
+
+// the client's request is complete: answer from cache or forward it to the server
+static void pconn_request(uring_t *ring, int slot) {
+    pconn_t *c = &pconns[slot];
+    char hostname[MAXLINE], port[MAXLINE], method[MAXLINE], uri[MAXLINE];
+    char *eol = strstr(c->buf, "\r\n");
+    char **new_req;
+    CacheItem *cacheItem;
+    int i;
+
+    c->cache_key = Malloc(sizeof(*c->cache_key)*MAXLINE); // request line is the cache key
+    strncpy(c->cache_key, c->buf, eol + 2 - c->buf);
+    c->cache_key[eol + 2 - c->buf] = '\0';
+
+    if ((cacheItem = cache_get(c->cache_key, lruCache)) != NULL) {
+        // cache hitting; copy, the item may be evicted while we are still sending
+        c->out = Malloc(cacheItem->size);
+        memcpy(c->out, cacheItem->value, cacheItem->size);
+        c->outlen = cacheItem->size;
+        c->outoff = 0;
+        uring_send(ring, c->connfd, c->out, c->outlen, PT_TAG(slot, PT_SEND));
+        return;
+    }
+
+    gethostnamefromhttp(c->cache_key, method, hostname, port, uri);
+    if (strncmp("GET", method, 3)) {
+        printf("invalid http method\n");
+        pconn_close(ring, slot);
+        return;
+    }
+    if ((c->srvfd = open_clientfd(hostname, port)) < 0) {
+        printf("open_clientfd fail\n");
+        c->srvfd = -1;
+        pconn_close(ring, slot);
+        return;
+    }
+
+    // flatten the new request into one buffer so it goes out in one send
+    new_req = make_http_request(hostname, uri, pregion);
+    c->outlen = 0;
+    for (i = 0; new_req[i]; i++) {
+        c->outlen += strlen(new_req[i]);
+    }
+    c->out = Malloc(c->outlen + 1);
+    c->out[0] = '\0';
+    for (i = 0; new_req[i]; i++) {
+        strcat(c->out, new_req[i]);
+    }
+    region_reset(pregion);
+    c->outoff = 0;
+    c->cache_buf = Malloc(sizeof(*c->cache_buf)*MAX_OBJECT_SIZE);
+    c->cache_sz = 0;
+    uring_send(ring, c->srvfd, c->out, c->outlen, PT_TAG(slot, PT_SEND));
+}
+
+void uring_proxy(uring_t *ring, int listenfd) {
+    int i, slot, res;
+    uint64_t tag;
+    pconn_t *c;
+    char *bufs;
+    struct iovec *iov;
+
+    pconns = Calloc(PC_MAX_CONNS, sizeof(*pconns));
+    pfree = Malloc(sizeof(*pfree)*PC_MAX_CONNS);
+    bufs = Malloc((size_t) PC_MAX_CONNS * MAXLINE);
+    iov = Malloc(sizeof(*iov)*PC_MAX_CONNS);
+    pregion = Region_create(REQ_CHUNK, req_fallback);
+    for (i=0; i<PC_MAX_CONNS; i++) {
+        pconns[i].connfd = -1;
+        pconns[i].srvfd = -1;
+        pconns[i].buf = bufs + (size_t) i * MAXLINE;
+        iov[i].iov_base = pconns[i].buf;
+        iov[i].iov_len = MAXLINE;
+        pfree[i] = PC_MAX_CONNS - 1 - i;
+    }
+    npfree = PC_MAX_CONNS;
+    if (uring_register_buffers(ring, iov, PC_MAX_CONNS) < 0) {
+        uring_free(ring);
+        Free(iov);
+        Free(bufs);
+        Free(pfree);
+        Free(pconns);
+        region_destroy(pregion);
+        return;
+    }
+    Free(iov);
+    printf("Serving with io_uring\n");
+
+    uring_accept(ring, listenfd, NULL, NULL, PT_TAG(0, PT_ACCEPT));
+    while (1) {
+        if (uring_submit_and_wait(ring, 1) < 0) {
+            unix_error("uring_proxy: io_uring_enter error");
+        }
+        while (uring_next_cqe(ring, &tag, &res)) {
+            slot = tag >> 8;
+            c = &pconns[slot];
+            switch (tag & 0xff) {
+            case PT_ACCEPT:
+                uring_accept(ring, listenfd, NULL, NULL, PT_TAG(0, PT_ACCEPT));
+                if (res < 0) {
+                    break;
+                }
+                if (npfree == 0) { // out of slots, refuse the connection
+                    Close(res);
+                    break;
+                }
+                slot = pfree[--npfree];
+                c = &pconns[slot];
+                c->connfd = res;
+                c->rcnt = 0;
+                uring_read_fixed(ring, c->connfd, c->buf, MAXLINE - 1, slot, PT_TAG(slot, PT_READ_REQ));
+                break;
+
+            case PT_READ_REQ:
+                if (res <= 0) {
+                    pconn_close(ring, slot);
+                    break;
+                }
+                c->rcnt += res;
+                c->buf[c->rcnt] = '\0';
+                if (strstr(c->buf, "\r\n\r\n")) {
+                    pconn_request(ring, slot);
+                } else if (c->rcnt < MAXLINE - 1) {
+                    uring_read_fixed(ring, c->connfd, c->buf + c->rcnt, MAXLINE - 1 - c->rcnt, slot,
+                                     PT_TAG(slot, PT_READ_REQ));
+                } else { // request headers don't fit in the buffer
+                    pconn_close(ring, slot);
+                }
+                break;
+
+            case PT_SEND:
+                if (res < 0) {
+                    pconn_close(ring, slot);
+                    break;
+                }
+                c->outoff += res;
+                if (c->outoff < c->outlen) {
+                    uring_send(ring, c->srvfd >= 0 ? c->srvfd : c->connfd, c->out + c->outoff,
+                               c->outlen - c->outoff, PT_TAG(slot, PT_SEND));
+                } else if (c->srvfd >= 0) { // request forwarded, relay the response
+                    uring_read_fixed(ring, c->srvfd, c->buf, MAXLINE, slot, PT_TAG(slot, PT_READ_RESP));
+                } else { // cached response sent
+                    pconn_done(ring, slot);
+                }
+                break;
+
+            case PT_READ_RESP:
+                if (res < 0) {
+                    pconn_close(ring, slot);
+                    break;
+                }
+                if (res == 0) { // server is done, cache this http response
+                    if (c->cache_sz <= MAX_OBJECT_SIZE) {
+                        cache_insert(c->cache_key, c->cache_buf, c->cache_sz, lruCache);
+                        c->cache_key = NULL; // owned by the cache now
+                        c->cache_buf = NULL;
+                    }
+                    pconn_done(ring, slot);
+                    break;
+                }
+                if (c->cache_sz + res <= MAX_OBJECT_SIZE) {
+                    memcpy(c->cache_buf + c->cache_sz, c->buf, res);
+                }
+                c->cache_sz += res;
+                c->wlen = res;
+                c->woff = 0;
+                uring_write_fixed(ring, c->connfd, c->buf, res, slot, PT_TAG(slot, PT_WRITE));
+                break;
+
+            case PT_WRITE:
+                if (res < 0) {
+                    pconn_close(ring, slot);
+                    break;
+                }
+                c->woff += res;
+                if (c->woff < c->wlen) {
+                    uring_write_fixed(ring, c->connfd, c->buf + c->woff, c->wlen - c->woff, slot,
+                                      PT_TAG(slot, PT_WRITE));
+                } else {
+                    uring_read_fixed(ring, c->srvfd, c->buf, MAXLINE, slot, PT_TAG(slot, PT_READ_RESP));
+                }
+                break;
+
+            case PT_CLOSE:
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,396 @@
+/*
+ * riobench.c - microbenchmarks for the Rio package
+ *
+ * usage: riobench write [responses] [lines] [linesize] [bodysize]
+ *        riobench readline [blocks]
+ *        riobench relay [megabytes]
+ *
+ * write: sends <responses> responses of <lines> small header lines plus
+ *   an optional <bodysize> body over a loopback TCP connection, drained
+ *   by a reader thread, once per writer strategy:
+ *     writen  - rio_writen() for every line (the old way)
+ *     writenb - rio_writenb() for every line, rio_flushb() per response
+ *     corked  - like writenb, but corked, uncorked per response
+ *   and reports throughput and write-class syscalls per response.
+ *
+ * readline: reads <blocks> copies of a browser-like HTTP request header
+ *   block back from a temporary file, line by line, with
+ *     bytewise  - the original one-byte-at-a-time rio_readlineb()
+ *     readlineb - the memchr()-based rio_readlineb()
+ *     readlinep - the zero-copy rio_readlinep()
+ *   and reports lines/s and MB/s.
+ *
+ * relay: a source thread streams <megabytes> MB into one loopback TCP
+ *   connection, the main thread relays it into a second one, which is
+ *   drained by a reader thread. Relay loops:
+ *     readnb 1K - rio_readnb() of 1 KB chunks through an 8 KB rio_t,
+ *                 then rio_writen() (the proxy's old loop)
+ *     readnb N  - rio_readnb() of N-byte chunks, going straight into
+ *                 the N-byte user buffer
+ *     peek N    - rio_peekb()/rio_consumeb() on an N-byte rio buffer,
+ *                 rio_writen() out of it with no copy
+ *   for N = 8, 64 and 256 KB; reports MB/s and read syscalls per MB.
+ */
+#include <netinet/tcp.h>
+#include "csapp.h"
+
+#define DEF_RESPONSES 20000
+#define DEF_LINES     12
+#define DEF_LINESIZE  32
+#define DEF_BLOCKS    200000
+#define DEF_MEGABYTES 1024
+
+static char *header_block =
+    "GET http://www.cmu.edu/hub/index.html HTTP/1.1\r\n"
+    "Host: www.cmu.edu\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: http://www.cmu.edu/\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: _ga=GA1.2.1234567890.1690000000; _gid=GA1.2.987654321.1690000000\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "If-Modified-Since: Tue, 11 Jul 2023 08:00:00 GMT\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n";
+
+/* read- (syscr) or write-class (syscw) syscalls made by this thread so far */
+static long thread_sysc(char *key)
+{
+    char line[MAXLINE];
+    long n = -1, v;
+    FILE *fp;
+
+    if ((fp = fopen("/proc/thread-self/io", "r")) == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), fp) != NULL)
+        if (!strncmp(line, key, strlen(key)) && sscanf(line + strlen(key), ": %ld", &v) == 1)
+            n = v;
+    fclose(fp);
+    return n;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* reader thread: discard everything until EOF */
+static void *drain(void *vargp)
+{
+    int fd = *(int *) vargp;
+    char buf[65536];
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    Close(fd);
+    return NULL;
+}
+
+/* connected loopback TCP pair, returns the writing end, *rfd the reading one */
+static int tcp_pair(int *rfd)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int listenfd, wfd, one = 1;
+
+    listenfd = Socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Bind(listenfd, (SA *) &addr, sizeof(addr));
+    Listen(listenfd, 1);
+    if (getsockname(listenfd, (SA *) &addr, &len) < 0)
+        unix_error("getsockname error");
+
+    wfd = Socket(AF_INET, SOCK_STREAM, 0);
+    Connect(wfd, (SA *) &addr, sizeof(addr));
+    *rfd = Accept(listenfd, NULL, NULL);
+    Close(listenfd);
+    Setsockopt(wfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return wfd;
+}
+
+static void bench_write(char *name, int mode, int responses, int lines,
+                        char *line, int linesize, char *body, int bodysize)
+{
+    pthread_t tid;
+    rio_wbuf_t wbuf;
+    int rfd, wfd, i, j;
+    long sys0, sys1;
+    double t0, t1, mb;
+
+    wfd = tcp_pair(&rfd);
+    Pthread_create(&tid, NULL, drain, &rfd);
+    Rio_writeinitb(&wbuf, wfd);
+    sys0 = thread_sysc("syscw");
+    t0 = now();
+    for (i = 0; i < responses; i++) {
+        if (mode == 0) {
+            for (j = 0; j < lines; j++)
+                Rio_writen(wfd, line, linesize);
+            if (bodysize > 0)
+                Rio_writen(wfd, body, bodysize);
+            continue;
+        }
+        if (mode == 2)
+            Rio_corkb(&wbuf, 1);
+        for (j = 0; j < lines; j++)
+            Rio_writenb(&wbuf, line, linesize);
+        if (bodysize > 0)
+            Rio_writenb(&wbuf, body, bodysize);
+        if (mode == 2)
+            Rio_corkb(&wbuf, 0);
+        else
+            Rio_flushb(&wbuf);
+    }
+    t1 = now();
+    sys1 = thread_sysc("syscw");
+    Close(wfd);
+    Pthread_join(tid, NULL);
+
+    mb = (double) responses * (lines * linesize + bodysize) / 1e6;
+    printf("%-8s %9.0f resp/s %8.1f MB/s %7.2f write syscalls/resp\n", name,
+           responses / (t1 - t0), mb / (t1 - t0),
+           (sys0 < 0 || sys1 < 0) ? -1.0 : (double) (sys1 - sys0) / responses);
+}
+
+/* the rio_read()/rio_readlineb() pair before memchr(), for comparison */
+static ssize_t bytewise_read(rio_t *rp, char *usrbuf)
+{
+    while (rp->rio_cnt <= 0) {
+        rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, rp->rio_bufsize);
+        if (rp->rio_cnt < 0) {
+            if (errno != EINTR)
+                return -1;
+        }
+        else if (rp->rio_cnt == 0)
+            return 0;
+        else
+            rp->rio_bufptr = rp->rio_buf;
+    }
+    *usrbuf = *rp->rio_bufptr++;
+    rp->rio_cnt--;
+    return 1;
+}
+
+static ssize_t bytewise_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+{
+    int n, rc;
+    char c, *bufp = usrbuf;
+
+    for (n = 1; n < maxlen; n++) {
+        if ((rc = bytewise_read(rp, &c)) == 1) {
+            *bufp++ = c;
+            if (c == '\n') {
+                n++;
+                break;
+            }
+        } else if (rc == 0) {
+            if (n == 1)
+                return 0;
+            else
+                break;
+        } else
+            return -1;
+    }
+    *bufp = 0;
+    return n-1;
+}
+
+static void bench_readline(char *name, int mode, int fd, long nbytes)
+{
+    rio_t rio;
+    char buf[MAXLINE], *linep;
+    long lines = 0, total = 0;
+    ssize_t n;
+    double t0, t1;
+
+    Lseek(fd, 0, SEEK_SET);
+    Rio_readinitb(&rio, fd);
+    t0 = now();
+    while (1) {
+        if (mode == 0)
+            n = bytewise_readlineb(&rio, buf, MAXLINE);
+        else if (mode == 1)
+            n = Rio_readlineb(&rio, buf, MAXLINE);
+        else
+            n = Rio_readlinep(&rio, &linep);
+        if (n <= 0)
+            break;
+        lines++;
+        total += n;
+    }
+    t1 = now();
+    if (total != nbytes) {
+        fprintf(stderr, "%s: read %ld bytes, expected %ld\n", name, total, nbytes);
+        exit(1);
+    }
+    printf("%-10s %11.0f lines/s %8.1f MB/s\n", name,
+           lines / (t1 - t0), total / (t1 - t0) / 1e6);
+}
+
+static void readline_main(int blocks)
+{
+    FILE *fp = tmpfile();
+    int i, fd;
+    long nbytes;
+
+    if (fp == NULL)
+        unix_error("tmpfile error");
+    fd = fileno(fp);
+    for (i = 0; i < blocks; i++)
+        Rio_writen(fd, header_block, strlen(header_block));
+    nbytes = (long) blocks * strlen(header_block);
+
+    printf("%d header blocks of %d bytes\n", blocks, (int) strlen(header_block));
+    bench_readline("bytewise", 0, fd, nbytes);
+    bench_readline("readlineb", 1, fd, nbytes);
+    bench_readline("readlinep", 2, fd, nbytes);
+    fclose(fp);
+}
+
+struct source_args {
+    int fd;
+    long nbytes;
+};
+
+/* source thread: stream nbytes into fd, then close it */
+static void *source(void *vargp)
+{
+    struct source_args *sa = vargp;
+    static char buf[65536];
+    long left = sa->nbytes;
+    size_t n;
+
+    memset(buf, 's', sizeof(buf));
+    while (left > 0) {
+        n = left < sizeof(buf) ? left : sizeof(buf);
+        Rio_writen(sa->fd, buf, n);
+        left -= n;
+    }
+    Close(sa->fd);
+    return NULL;
+}
+
+static void bench_relay(char *name, int mode, size_t bufsize, long nbytes)
+{
+    pthread_t stid, dtid;
+    struct source_args sa;
+    rio_t rio;
+    char *buf = Malloc(bufsize), *data;
+    int srcfd, dstfd, drainfd;
+    long total = 0, sys0, sys1;
+    ssize_t n;
+    double t0, t1;
+
+    /* source -> srcfd, relay srcfd -> dstfd, dstfd -> drain */
+    sa.fd = tcp_pair(&srcfd);
+    sa.nbytes = nbytes;
+    Pthread_create(&stid, NULL, source, &sa);
+    dstfd = tcp_pair(&drainfd);
+    Pthread_create(&dtid, NULL, drain, &drainfd);
+
+    if (mode == 0)
+        Rio_readinitb(&rio, srcfd);
+    else
+        Rio_readinitbuf(&rio, srcfd, buf, bufsize);
+    sys0 = thread_sysc("syscr");
+    t0 = now();
+    while (1) {
+        if (mode == 0)
+            n = Rio_readnb(&rio, buf, 1024);
+        else if (mode == 1)
+            n = Rio_readnb(&rio, buf, bufsize);
+        else
+            n = Rio_peekb(&rio, &data, 1);
+        if (n <= 0)
+            break;
+        Rio_writen(dstfd, mode == 2 ? data : buf, n);
+        if (mode == 2)
+            rio_consumeb(&rio, n);
+        total += n;
+    }
+    t1 = now();
+    sys1 = thread_sysc("syscr");
+    Close(srcfd);
+    Close(dstfd);
+    Pthread_join(stid, NULL);
+    Pthread_join(dtid, NULL);
+    Free(buf);
+
+    if (total != nbytes) {
+        fprintf(stderr, "%s: relayed %ld bytes, expected %ld\n", name, total, nbytes);
+        exit(1);
+    }
+    printf("%-12s %8.1f MB/s %8.1f read syscalls/MB\n", name, total / (t1 - t0) / 1e6,
+           (sys0 < 0 || sys1 < 0) ? -1.0 : (sys1 - sys0) / (total / 1e6));
+}
+
+static void relay_main(int megabytes)
+{
+    static size_t sizes[] = {8 * 1024, 64 * 1024, 256 * 1024};
+    long nbytes = (long) megabytes * 1000000;
+    char name[32];
+    int i;
+
+    printf("relaying %d MB over loopback TCP\n", megabytes);
+    bench_relay("readnb 1K", 0, RIO_BUFSIZE, nbytes);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        sprintf(name, "readnb %dK", (int) (sizes[i] / 1024));
+        bench_relay(name, 1, sizes[i], nbytes);
+        sprintf(name, "peek %dK", (int) (sizes[i] / 1024));
+        bench_relay(name, 2, sizes[i], nbytes);
+    }
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s write [responses] [lines] [linesize] [bodysize]\n", prog);
+    fprintf(stderr, "       %s readline [blocks]\n", prog);
+    fprintf(stderr, "       %s relay [megabytes]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int responses = DEF_RESPONSES, lines = DEF_LINES;
+    int linesize = DEF_LINESIZE, bodysize = 0;
+    char *line, *body;
+
+    if (argc < 2)
+        usage(argv[0]);
+    if (!strcmp(argv[1], "readline")) {
+        readline_main(argc > 2 ? atoi(argv[2]) : DEF_BLOCKS);
+        exit(0);
+    }
+    if (!strcmp(argv[1], "relay")) {
+        relay_main(argc > 2 ? atoi(argv[2]) : DEF_MEGABYTES);
+        exit(0);
+    }
+    if (strcmp(argv[1], "write"))
+        usage(argv[0]);
+    if (argc > 2) responses = atoi(argv[2]);
+    if (argc > 3) lines = atoi(argv[3]);
+    if (argc > 4) linesize = atoi(argv[4]);
+    if (argc > 5) bodysize = atoi(argv[5]);
+
+    line = Malloc(linesize);
+    memset(line, 'h', linesize);
+    body = Malloc(bodysize > 0 ? bodysize : 1);
+    memset(body, 'b', bodysize);
+
+    printf("%d responses of %d x %d-byte lines + %d-byte body\n",
+           responses, lines, linesize, bodysize);
+    bench_write("writen", 0, responses, lines, line, linesize, body, bodysize);
+    bench_write("writenb", 1, responses, lines, line, linesize, body, bodysize);
+    bench_write("corked", 2, responses, lines, line, linesize, body, bodysize);
+
+    Free(line);
+    Free(body);
+    exit(0);
+}
@@ -28,6 +28,7 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 
 /* Default file permissions are DEF_MODE & ~DEF_UMASK */
 /* $begin createmasks */
@@ -44,13 +45,26 @@ typedef struct sockaddr SA;
 /* $begin rio_t */
 #define RIO_BUFSIZE 8192
 typedef struct {
-    int rio_fd;                /* Descriptor for this internal buf */
-    int rio_cnt;               /* Unread bytes in internal buf */
-    char *rio_bufptr;          /* Next unread byte in internal buf */
-    char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
+    int rio_fd;                 /* Descriptor for this internal buf */
+    int rio_cnt;                /* Unread bytes in internal buf */
+    char *rio_bufptr;           /* Next unread byte in internal buf */
+    char *rio_buf;              /* Internal buf, rio_ibuf or caller's */
+    size_t rio_bufsize;         /* Size of rio_buf */
+    char rio_ibuf[RIO_BUFSIZE]; /* Default internal buffer */
 } rio_t;
 /* $end rio_t */
 
+/* Persistent state for buffered Rio writes */
+/* $begin rio_wbuf_t */
+#define RIO_WBUFSIZE 8192
+typedef struct {
+    int rio_fd;                 /* Descriptor for this internal buf */
+    int rio_cnt;                /* Unflushed bytes in internal buf */
+    int rio_corked;             /* TCP_CORK is set on rio_fd */
+    char rio_buf[RIO_WBUFSIZE]; /* Internal buffer */
+} rio_wbuf_t;
+/* $end rio_wbuf_t */
+
 /* External variables */
 extern int h_errno;    /* Defined by BIND for DNS errors */ 
 extern char **environ; /* Defined by libc */
@@ -176,15 +190,32 @@ void V(sem_t *sem);
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
 void rio_readinitb(rio_t *rp, int fd); 
+void rio_readinitbuf(rio_t *rp, int fd, char *buf, size_t size);
+int rio_setbufb(rio_t *rp, char *buf, size_t size);
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t	rio_readlinep(rio_t *rp, char **linep);
+ssize_t	rio_peekb(rio_t *rp, char **bufp, size_t n);
+void rio_consumeb(rio_t *rp, size_t n);
+void rio_writeinitb(rio_wbuf_t *wp, int fd);
+ssize_t rio_writenb(rio_wbuf_t *wp, void *usrbuf, size_t n);
+ssize_t rio_flushb(rio_wbuf_t *wp);
+int rio_corkb(rio_wbuf_t *wp, int on);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
 void Rio_writen(int fd, void *usrbuf, size_t n);
 void Rio_readinitb(rio_t *rp, int fd); 
+void Rio_readinitbuf(rio_t *rp, int fd, char *buf, size_t size);
+void Rio_setbufb(rio_t *rp, char *buf, size_t size);
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t Rio_readlinep(rio_t *rp, char **linep);
+ssize_t Rio_peekb(rio_t *rp, char **bufp, size_t n);
+void Rio_writeinitb(rio_wbuf_t *wp, int fd);
+void Rio_writenb(rio_wbuf_t *wp, void *usrbuf, size_t n);
+void Rio_flushb(rio_wbuf_t *wp);
+void Rio_corkb(rio_wbuf_t *wp, int on);
 
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(char *hostname, char *port);
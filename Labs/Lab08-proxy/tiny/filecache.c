@@ -0,0 +1,221 @@
+#include <zlib.h>
+#include "csapp.h"
+#include "filecache.h"
+
+void *fc_compressor(void *vargp);
+
+// string hash (djb2) for bucket index
+static unsigned int fc_hash(char *s) {
+    unsigned int h = 5381;
+    while (*s) {
+        h = h * 33 + (unsigned char) *s++;
+    }
+    return h;
+}
+
+FileCache *fc_create(int nbuckets, size_t max_cache_sz, size_t max_object_sz) {
+    pthread_t tid;
+    FileCache *cache = Malloc(sizeof(*cache));
+    cache->buckets = Calloc(nbuckets, sizeof(*cache->buckets));
+    cache->nbuckets = nbuckets;
+    cache->cache_sz = 0;
+    cache->max_cache_sz = max_cache_sz;
+    cache->max_object_sz = max_object_sz;
+    cache->qhead = NULL;
+    cache->qrear = NULL;
+    Sem_init(&cache->mutex, 0, 1);
+    Sem_init(&cache->jobs, 0, 0);
+
+    Pthread_create(&tid, NULL, fc_compressor, cache);
+    Pthread_detach(tid);
+    return cache;
+}
+
+// drop one reference of entry, free it when nobody holds it. Caller holds mutex
+static void fc_release(FileEntry *entry) {
+    if (--entry->refcnt > 0) {
+        return;
+    }
+    Free(entry->filename);
+    Free(entry->body);
+    if (entry->gzbody != NULL) {
+        Free(entry->gzbody);
+    }
+    Free(entry);
+}
+
+// unlink entry from its bucket and give back its space. Caller holds mutex
+static void fc_unlink(FileCache *cache, FileEntry *entry) {
+    FileEntry **pp = &cache->buckets[fc_hash(entry->filename) % cache->nbuckets];
+    while (*pp != entry) {
+        pp = &(*pp)->next;
+    }
+    *pp = entry->next;
+    entry->linked = 0;
+
+    cache->cache_sz -= entry->size;
+    if (entry->gzstate == FC_GZ_READY) {
+        cache->cache_sz -= entry->gzsize;
+    }
+    fc_release(entry);
+}
+
+// read the whole file into a new entry, NULL if it doesn't fit in the cache
+static FileEntry *fc_load(FileCache *cache, char *filename, struct stat *sbuf) {
+    int srcfd;
+    FileEntry *entry;
+
+    if (sbuf->st_size > cache->max_object_sz ||
+        cache->cache_sz + sbuf->st_size > cache->max_cache_sz) {
+        return NULL;
+    }
+    entry = Malloc(sizeof(*entry));
+    entry->filename = Malloc(strlen(filename) + 1);
+    strcpy(entry->filename, filename);
+    entry->mtime = sbuf->st_mtime;
+    entry->size = sbuf->st_size;
+    entry->body = Malloc(sbuf->st_size > 0 ? sbuf->st_size : 1);
+    entry->gzbody = NULL;
+    entry->gzsize = 0;
+    entry->gzstate = FC_GZ_NONE;
+    entry->refcnt = 1; // the table's reference
+    entry->linked = 1;
+    entry->next = NULL;
+    entry->qnext = NULL;
+
+    srcfd = Open(filename, O_RDONLY, 0);
+    if (Rio_readn(srcfd, entry->body, entry->size) != entry->size) {
+        Close(srcfd);
+        fc_release(entry); // file shrank under us
+        return NULL;
+    }
+    Close(srcfd);
+    return entry;
+}
+
+FileEntry *fc_lookup(FileCache *cache, char *filename, struct stat *sbuf, int compress) {
+    unsigned int b = fc_hash(filename) % cache->nbuckets;
+    FileEntry *entry;
+
+    P(&cache->mutex);
+    for (entry = cache->buckets[b]; entry != NULL; entry = entry->next) {
+        if (!strcmp(entry->filename, filename)) {
+            break;
+        }
+    }
+    if (entry != NULL && entry->mtime == sbuf->st_mtime && entry->size == sbuf->st_size) {
+        entry->refcnt++;
+        V(&cache->mutex);
+        return entry; // cache hit
+    }
+    if (entry != NULL) {
+        fc_unlink(cache, entry); // file was modified after it was cached
+    }
+
+    if ((entry = fc_load(cache, filename, sbuf)) == NULL) {
+        V(&cache->mutex);
+        return NULL;
+    }
+    entry->next = cache->buckets[b];
+    cache->buckets[b] = entry;
+    cache->cache_sz += entry->size;
+    entry->refcnt++; // the caller's reference
+
+    if (compress) {
+        // hand a reference to the compressor thread
+        entry->gzstate = FC_GZ_PENDING;
+        entry->refcnt++;
+        if (cache->qrear == NULL) {
+            cache->qhead = entry;
+        } else {
+            cache->qrear->qnext = entry;
+        }
+        cache->qrear = entry;
+        V(&cache->jobs);
+    }
+    V(&cache->mutex);
+    return entry;
+}
+
+void fc_put(FileCache *cache, FileEntry *entry) {
+    P(&cache->mutex);
+    fc_release(entry);
+    V(&cache->mutex);
+}
+
+int fc_gzip_variant(FileCache *cache, FileEntry *entry, char **gzbody, size_t *gzsize) {
+    int ready;
+
+    P(&cache->mutex);
+    ready = (entry->gzstate == FC_GZ_READY);
+    if (ready) {
+        *gzbody = entry->gzbody;
+        *gzsize = entry->gzsize;
+    }
+    V(&cache->mutex);
+    return ready;
+}
+
+// gzip src into a new buffer; returns its size, or 0 if compressing doesn't shrink src
+static size_t fc_gzip(char *src, size_t srcsz, char **dst) {
+    z_stream zs;
+    size_t bound;
+
+    memset(&zs, 0, sizeof(zs));
+    // windowBits 15+16 makes zlib emit a gzip header and trailer instead of a zlib one
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return 0;
+    }
+    bound = deflateBound(&zs, srcsz);
+    *dst = Malloc(bound);
+    zs.next_in = (Bytef *) src;
+    zs.avail_in = srcsz;
+    zs.next_out = (Bytef *) *dst;
+    zs.avail_out = bound;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out >= srcsz) {
+        deflateEnd(&zs);
+        Free(*dst);
+        return 0;
+    }
+    deflateEnd(&zs);
+    return zs.total_out;
+}
+
+// background thread, builds the gzip variant of every queued entry
+void *fc_compressor(void *vargp) {
+    FileCache *cache = vargp;
+    FileEntry *entry;
+    char *gzbody;
+    size_t gzsize;
+
+    while (1) {
+        P(&cache->jobs);
+        P(&cache->mutex);
+        entry = cache->qhead;
+        cache->qhead = entry->qnext;
+        if (cache->qhead == NULL) {
+            cache->qrear = NULL;
+        }
+        V(&cache->mutex);
+
+        // body is immutable while we hold a reference, so compress without the lock
+        gzsize = fc_gzip(entry->body, entry->size, &gzbody);
+
+        P(&cache->mutex);
+        if (gzsize > 0 && entry->linked && cache->cache_sz + gzsize <= cache->max_cache_sz) {
+            entry->gzbody = gzbody;
+            entry->gzsize = gzsize;
+            entry->gzstate = FC_GZ_READY;
+            cache->cache_sz += gzsize;
+        } else {
+            // incompressible, over budget, or the entry was dropped from the table
+            if (gzsize > 0) {
+                Free(gzbody);
+            }
+            entry->gzstate = FC_GZ_NONE;
+        }
+        fc_release(entry);
+        V(&cache->mutex);
+    }
+    return NULL;
+}
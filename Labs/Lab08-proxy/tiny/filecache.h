@@ -0,0 +1,48 @@
+#include <semaphore.h>
+#include <sys/types.h>
+#include <time.h>
+
+// state of the gzip variant of a cached file
+#define FC_GZ_NONE    0 // not compressible, or compression didn't pay off
+#define FC_GZ_PENDING 1 // queued for the background compressor
+#define FC_GZ_READY   2 // gzbody holds a valid gzip stream
+
+typedef struct FileEntry_t {
+    char *filename;     // key, path relative to tiny's root
+    time_t mtime;       // st_mtime of the file when it was loaded
+    off_t size;         // st_size of the file when it was loaded
+    char *body;         // raw file content
+    char *gzbody;       // gzip variant of body, valid once gzstate is FC_GZ_READY
+    size_t gzsize;      // the size of gzbody
+    int gzstate;
+    int refcnt;         // references held by the table, the compressor and senders
+    int linked;         // still reachable from the table
+    struct FileEntry_t *next;  // next entry in the same hash bucket
+    struct FileEntry_t *qnext; // next entry in the compression queue
+} FileEntry;
+
+typedef struct {
+    FileEntry **buckets;
+    int nbuckets;
+    size_t cache_sz;      // bytes of raw and gzip bodies held by the cache
+    size_t max_cache_sz;
+    size_t max_object_sz;
+    FileEntry *qhead;     // compression queue, FIFO
+    FileEntry *qrear;
+    sem_t mutex;          // protects every field above and the entries' gz fields
+    sem_t jobs;           // counts queued compression jobs
+} FileCache;
+
+// create file cache and start its background gzip compressor thread
+FileCache *fc_create(int nbuckets, size_t max_cache_sz, size_t max_object_sz);
+
+// get a reference to the entry of filename, (re)loading it if sbuf shows the
+// file changed; returns NULL if the file can't be cached. If compress is set,
+// a gzip variant is built in the background the first time the file is loaded
+FileEntry *fc_lookup(FileCache *cache, char *filename, struct stat *sbuf, int compress);
+
+// drop the reference returned by fc_lookup once the response has been sent
+void fc_put(FileCache *cache, FileEntry *entry);
+
+// return non-zero and fill gzbody/gzsize if the gzip variant of entry is ready
+int fc_gzip_variant(FileCache *cache, FileEntry *entry, char **gzbody, size_t *gzsize);
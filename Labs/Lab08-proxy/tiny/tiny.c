@@ -5,32 +5,81 @@
  *
  * Updated 11/2019 droh 
  *   - Fixed sprintf() aliasing issue in serve_static(), and clienterror().
+ *
+ * Static files are kept in an in-memory file cache. Text files get a
+ * gzip variant built by a background thread, which is served to
+ * clients that send "Accept-Encoding: gzip".
+ *
+ * With -u, tiny serves static content from a single io_uring
+ * completion loop instead of one blocking connection at a time, and
+ * falls back to blocking I/O if io_uring is unavailable.
  */
 #include "csapp.h"
+#include "filecache.h"
+#include "uring.h"
+
+/* File cache limits */
+#define FC_BUCKETS        256
+#define FC_MAX_CACHE_SIZE (16*(1<<20))
+#define FC_MAX_OBJECT_SIZE (1<<20)
+
+/* Files smaller than this aren't worth a gzip variant */
+#define GZIP_MIN_SIZE 64
+
+/* io_uring mode */
+#define UC_RING_ENTRIES 512
+#define UC_MAX_CONNS    256   /* connection slots, one registered buffer each */
+#define UC_SPLICE_CHUNK 65536 /* bytes per splice of an uncached file */
+
+FileCache *fileCache;
+unsigned long bytes_sent; /* response bytes written since startup */
 
 void doit(int fd);
-void read_requesthdrs(rio_t *rp);
+int read_requesthdrs(rio_t *rp);
+int accepts_gzip(char *value);
+int route_request(int fd, char *uri, char *filename, char *cgiargs, 
+		  struct stat *sbuf);
 int parse_uri(char *uri, char *filename, char *cgiargs);
-void serve_static(int fd, char *filename, int filesize);
-void get_filetype(char *filename, char *filetype);
+size_t static_response(char *filename, struct stat *sbuf, int gzip_ok, 
+		       char *hdr, char **body, size_t *bodysize, 
+		       FileEntry **entry);
+void serve_static(int fd, char *filename, struct stat *sbuf, int gzip_ok);
+void init_filetypes(void);
+int get_filetype(char *filename, char *filetype);
 void serve_dynamic(int fd, char *filename, char *cgiargs);
 void clienterror(int fd, char *cause, char *errnum, 
 		 char *shortmsg, char *longmsg);
+void uring_serve(uring_t *ring, int listenfd);
 
 int main(int argc, char **argv) 
 {
-    int listenfd, connfd;
+    int listenfd, connfd, use_uring = 0;
     char hostname[MAXLINE], port[MAXLINE];
     socklen_t clientlen;
     struct sockaddr_storage clientaddr;
+    uring_t ring;
 
     /* Check command line args */
+    if (argc == 3 && !strcmp(argv[1], "-u")) {
+	use_uring = 1;
+	argc--;
+	argv++;
+    }
     if (argc != 2) {
-	fprintf(stderr, "usage: %s <port>\n", argv[0]);
+	fprintf(stderr, "usage: %s [-u] <port>\n", argv[0]);
 	exit(1);
     }
 
+    init_filetypes();
+    fileCache = fc_create(FC_BUCKETS, FC_MAX_CACHE_SIZE, FC_MAX_OBJECT_SIZE);
+
     listenfd = Open_listenfd(argv[1]);
+    if (use_uring) {
+	if (uring_init(&ring, UC_RING_ENTRIES) == 0)
+	    uring_serve(&ring, listenfd); /* returns only if setup fails */
+	fprintf(stderr, "io_uring unavailable (%s), using blocking I/O\n", 
+		strerror(errno));
+    }
     while (1) {
 	clientlen = sizeof(clientaddr);
 	connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen); //line:netp:tiny:accept
@@ -49,7 +98,7 @@ int main(int argc, char **argv)
 /* $begin doit */
 void doit(int fd) 
 {
-    int is_static;
+    int is_static, gzip_ok;
     struct stat sbuf;
     char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
     char filename[MAXLINE], cgiargs[MAXLINE];
@@ -66,53 +115,102 @@ void doit(int fd)
                     "Tiny does not implement this method");
         return;
     }                                                    //line:netp:doit:endrequesterr
-    read_requesthdrs(&rio);                              //line:netp:doit:readrequesthdrs
+    gzip_ok = read_requesthdrs(&rio);                    //line:netp:doit:readrequesthdrs
 
     /* Parse URI from GET request */
+    if ((is_static = route_request(fd, uri, filename, cgiargs, &sbuf)) < 0)
+	return;
+    if (is_static)  /* Serve static content */          
+	serve_static(fd, filename, &sbuf, gzip_ok);      //line:netp:doit:servestatic
+    else            /* Serve dynamic content */
+	serve_dynamic(fd, filename, cgiargs);            //line:netp:doit:servedynamic
+}
+/* $end doit */
+
+/*
+ * route_request - map the URI to a file and check that it can be served.
+ *     Returns 1 for static content, 0 for dynamic content, or -1 after
+ *     sending an error response to the client.
+ */
+int route_request(int fd, char *uri, char *filename, char *cgiargs, 
+		  struct stat *sbuf)
+{
+    int is_static;
+
     is_static = parse_uri(uri, filename, cgiargs);       //line:netp:doit:staticcheck
-    if (stat(filename, &sbuf) < 0) {                     //line:netp:doit:beginnotfound
+    if (stat(filename, sbuf) < 0) {                      //line:netp:doit:beginnotfound
 	clienterror(fd, filename, "404", "Not found",
 		    "Tiny couldn't find this file");
-	return;
+	return -1;
     }                                                    //line:netp:doit:endnotfound
 
-    if (is_static) { /* Serve static content */          
-	if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) { //line:netp:doit:readable
+    if (is_static) {
+	if (!(S_ISREG(sbuf->st_mode)) || !(S_IRUSR & sbuf->st_mode)) { //line:netp:doit:readable
 	    clienterror(fd, filename, "403", "Forbidden",
 			"Tiny couldn't read the file");
-	    return;
+	    return -1;
 	}
-	serve_static(fd, filename, sbuf.st_size);        //line:netp:doit:servestatic
     }
-    else { /* Serve dynamic content */
-	if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) { //line:netp:doit:executable
+    else {
+	if (!(S_ISREG(sbuf->st_mode)) || !(S_IXUSR & sbuf->st_mode)) { //line:netp:doit:executable
 	    clienterror(fd, filename, "403", "Forbidden",
 			"Tiny couldn't run the CGI program");
-	    return;
+	    return -1;
 	}
-	serve_dynamic(fd, filename, cgiargs);            //line:netp:doit:servedynamic
     }
+    return is_static;
 }
-/* $end doit */
 
 /*
- * read_requesthdrs - read HTTP request headers
+ * read_requesthdrs - read HTTP request headers,
+ *                    return 1 if the client accepts gzip content coding
  */
 /* $begin read_requesthdrs */
-void read_requesthdrs(rio_t *rp) 
+int read_requesthdrs(rio_t *rp) 
 {
     char buf[MAXLINE];
+    int gzip_ok = 0;
 
     Rio_readlineb(rp, buf, MAXLINE);
     printf("%s", buf);
     while(strcmp(buf, "\r\n")) {          //line:netp:readhdrs:checkterm
+	if (!strncasecmp(buf, "Accept-Encoding:", 16))
+	    gzip_ok = accepts_gzip(buf + 16);
 	Rio_readlineb(rp, buf, MAXLINE);
 	printf("%s", buf);
     }
-    return;
+    return gzip_ok;
 }
 /* $end read_requesthdrs */
 
+/*
+ * accepts_gzip - return 1 if an Accept-Encoding header value lists
+ *                gzip (or *) without disabling it with q=0
+ */
+int accepts_gzip(char *value)
+{
+    char *tok, *end, *q, *saveptr;
+
+    for (tok = strtok_r(value, ",\r\n", &saveptr); tok; 
+	 tok = strtok_r(NULL, ",\r\n", &saveptr)) {
+	while (isspace(*tok))
+	    tok++;
+	if (!strncasecmp(tok, "gzip", 4))
+	    end = tok + 4;
+	else if (*tok == '*')
+	    end = tok + 1;
+	else
+	    continue;
+	if (*end != '\0' && *end != ';' && !isspace(*end))
+	    continue;  /* e.g. "gzipx" */
+	if ((q = strstr(end, "q=")) != NULL && atof(q + 2) == 0.0)
+	    return 0;  /* explicitly refused */
+	return 1;
+    }
+    return 0;
+}
+
+
 /*
  * parse_uri - parse URI into filename and CGI args
  *             return 0 if dynamic content, 1 if static
@@ -146,48 +244,156 @@ int parse_uri(char *uri, char *filename, char *cgiargs)
 /* $end parse_uri */
 
 /*
- * serve_static - copy a file back to the client 
+ * static_response - build the response headers for a static file into
+ *     hdr and return their length. *body is the cached body to send
+ *     (the gzip variant when the client accepts it and it is ready), or
+ *     NULL if the file isn't cached and the caller must send it from
+ *     disk. *entry holds a file cache reference the caller must fc_put().
+ */
+size_t static_response(char *filename, struct stat *sbuf, int gzip_ok, 
+		       char *hdr, char **body, size_t *bodysize, 
+		       FileEntry **entry)
+{
+    int compress;
+    char *encoding = NULL, filetype[MAXLINE], *hdrp = hdr;
+
+    compress = get_filetype(filename, filetype) &&   //line:netp:servestatic:getfiletype
+	sbuf->st_size >= GZIP_MIN_SIZE;
+    *body = NULL;
+    *bodysize = sbuf->st_size;
+    if ((*entry = fc_lookup(fileCache, filename, sbuf, compress)) != NULL) {
+	*body = (*entry)->body;
+	if (gzip_ok && fc_gzip_variant(fileCache, *entry, body, bodysize))
+	    encoding = "gzip";
+    }
+
+    hdrp += sprintf(hdrp, "HTTP/1.0 200 OK\r\n"); //line:netp:servestatic:beginserve
+    hdrp += sprintf(hdrp, "Server: Tiny Web Server\r\n");
+    hdrp += sprintf(hdrp, "Content-length: %zu\r\n", *bodysize);
+    if (compress)
+	hdrp += sprintf(hdrp, "Vary: Accept-Encoding\r\n");
+    if (encoding)
+	hdrp += sprintf(hdrp, "Content-encoding: %s\r\n", encoding);
+    hdrp += sprintf(hdrp, "Content-type: %s\r\n\r\n", filetype);
+    return hdrp - hdr;                            //line:netp:servestatic:endserve
+}
+
+/*
+ * serve_static - copy a file back to the client, from the file cache
+ *     when possible, gzip-encoded when the client accepts it and the
+ *     compressed variant is ready
  */
 /* $begin serve_static */
-void serve_static(int fd, char *filename, int filesize)
+void serve_static(int fd, char *filename, struct stat *sbuf, int gzip_ok)
 {
     int srcfd;
-    char *srcp, filetype[MAXLINE], buf[MAXBUF];
+    char *srcp, buf[MAXBUF];
+    size_t hdrsize, bodysize;
+    FileEntry *entry;
 
-    /* Send response headers to client */
-    get_filetype(filename, filetype);    //line:netp:servestatic:getfiletype
-    sprintf(buf, "HTTP/1.0 200 OK\r\n"); //line:netp:servestatic:beginserve
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Server: Tiny Web Server\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-length: %d\r\n", filesize);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-type: %s\r\n\r\n", filetype);
-    Rio_writen(fd, buf, strlen(buf));    //line:netp:servestatic:endserve
+    /* Send response headers to client in one write */
+    hdrsize = static_response(filename, sbuf, gzip_ok, buf, &srcp, &bodysize, 
+			      &entry);
+    Rio_writen(fd, buf, hdrsize);
 
     /* Send response body to client */
-    srcfd = Open(filename, O_RDONLY, 0); //line:netp:servestatic:open
-    srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0); //line:netp:servestatic:mmap
-    Close(srcfd);                       //line:netp:servestatic:close
-    Rio_writen(fd, srcp, filesize);     //line:netp:servestatic:write
-    Munmap(srcp, filesize);             //line:netp:servestatic:munmap
+    if (entry != NULL) {
+	Rio_writen(fd, srcp, bodysize);
+	fc_put(fileCache, entry);
+    }
+    else { /* Too big to cache, map it for this request only */
+	srcfd = Open(filename, O_RDONLY, 0); //line:netp:servestatic:open
+	srcp = Mmap(0, bodysize, PROT_READ, MAP_PRIVATE, srcfd, 0); //line:netp:servestatic:mmap
+	Close(srcfd);                       //line:netp:servestatic:close
+	Rio_writen(fd, srcp, bodysize);     //line:netp:servestatic:write
+	Munmap(srcp, bodysize);             //line:netp:servestatic:munmap
+    }
+
+    bytes_sent += hdrsize + bodysize;
+    printf("Sent %zu of %lld bytes (%lu bytes since startup)\n", bodysize, 
+	   (long long)sbuf->st_size, bytes_sent);
 }
 
 /*
- * get_filetype - derive file type from file name
+ * Suffix -> MIME type table. Entries are hashed by suffix into
+ * ft_table by init_filetypes(), so get_filetype() does one probe
+ * sequence per request instead of a strstr() per known type.
  */
-void get_filetype(char *filename, char *filetype) 
+typedef struct {
+    char *suffix;
+    char *filetype;
+    int compressible;  /* worth a gzip variant */
+} filetype_t;
+
+static filetype_t filetypes[] = {
+    {"html", "text/html", 1},
+    {"htm",  "text/html", 1},
+    {"css",  "text/css", 1},
+    {"js",   "application/javascript", 1},
+    {"json", "application/json", 1},
+    {"svg",  "image/svg+xml", 1},
+    {"txt",  "text/plain", 1},
+    {"c",    "text/plain", 1},
+    {"h",    "text/plain", 1},
+    {"gif",  "image/gif", 0},
+    {"png",  "image/png", 0},
+    {"jpg",  "image/jpeg", 0},
+    {"jpeg", "image/jpeg", 0},
+    {NULL, NULL, 0}
+};
+static filetype_t default_filetype = {"", "text/plain", 1};
+
+#define FT_SLOTS 64  /* power of 2, well above the number of suffixes */
+static filetype_t *ft_table[FT_SLOTS];
+
+/* ft_hash - case-insensitive string hash (djb2) */
+static unsigned int ft_hash(const char *s)
 {
-    if (strstr(filename, ".html"))
-	strcpy(filetype, "text/html");
-    else if (strstr(filename, ".gif"))
-	strcpy(filetype, "image/gif");
-    else if (strstr(filename, ".png"))
-	strcpy(filetype, "image/png");
-    else if (strstr(filename, ".jpg"))
-	strcpy(filetype, "image/jpeg");
-    else
-	strcpy(filetype, "text/plain");
+    unsigned int h = 5381;
+
+    while (*s)
+	h = h * 33 + tolower((unsigned char)*s++);
+    return h;
+}
+
+/*
+ * init_filetypes - build the suffix hash table (linear probing)
+ */
+void init_filetypes(void)
+{
+    filetype_t *ft;
+    unsigned int i;
+
+    for (ft = filetypes; ft->suffix; ft++) {
+	i = ft_hash(ft->suffix) & (FT_SLOTS - 1);
+	while (ft_table[i])
+	    i = (i + 1) & (FT_SLOTS - 1);
+	ft_table[i] = ft;
+    }
+}
+
+/*
+ * get_filetype - derive file type from file name suffix,
+ *                return 1 if the type is worth compressing
+ */
+int get_filetype(char *filename, char *filetype) 
+{
+    char *suffix = strrchr(filename, '.');
+    filetype_t *ft = &default_filetype;
+    unsigned int i;
+
+    if (suffix && !strchr(suffix, '/')) {
+	suffix++;
+	for (i = ft_hash(suffix) & (FT_SLOTS - 1); ft_table[i]; 
+	     i = (i + 1) & (FT_SLOTS - 1)) {
+	    if (!strcasecmp(ft_table[i]->suffix, suffix)) {
+		ft = ft_table[i];
+		break;
+	    }
+	}
+    }
+    strcpy(filetype, ft->filetype);
+    return ft->compressible;
 }  
 /* $end serve_static */
 
@@ -223,23 +429,319 @@ void clienterror(int fd, char *cause, char *errnum,
 		 char *shortmsg, char *longmsg) 
 {
     char buf[MAXLINE];
+    rio_wbuf_t wbuf;
+
+    Rio_writeinitb(&wbuf, fd); /* Send the whole response in one write */
 
     /* Print the HTTP response headers */
     sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
+    Rio_writenb(&wbuf, buf, strlen(buf));
     sprintf(buf, "Content-type: text/html\r\n\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    Rio_writenb(&wbuf, buf, strlen(buf));
 
     /* Print the HTTP response body */
     sprintf(buf, "<html><title>Tiny Error</title>");
-    Rio_writen(fd, buf, strlen(buf));
+    Rio_writenb(&wbuf, buf, strlen(buf));
     sprintf(buf, "<body bgcolor=""ffffff"">\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    Rio_writenb(&wbuf, buf, strlen(buf));
     sprintf(buf, "%s: %s\r\n", errnum, shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
+    Rio_writenb(&wbuf, buf, strlen(buf));
     sprintf(buf, "<p>%s: %s\r\n", longmsg, cause);
-    Rio_writen(fd, buf, strlen(buf));
+    Rio_writenb(&wbuf, buf, strlen(buf));
     sprintf(buf, "<hr><em>The Tiny Web server</em>\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    Rio_writenb(&wbuf, buf, strlen(buf));
+    Rio_flushb(&wbuf);
 }
 /* $end clienterror */
+
+/*****************************************************************
+ * io_uring mode - one completion loop serves every connection.
+ * Accepts, request reads (into registered buffers), response sends
+ * and file->socket splices are queued on the ring and submitted in
+ * one io_uring_enter() per loop iteration. CGI programs and error
+ * responses are still handled with blocking writes.
+ *****************************************************************/
+
+/* Operation encoded in the low byte of a request tag */
+#define UT_ACCEPT     1
+#define UT_RECV       2
+#define UT_SEND       3
+#define UT_SPLICE_IN  4
+#define UT_SPLICE_OUT 5
+#define UT_CLOSE      6
+#define UT_TAG(slot, op) (((uint64_t)(slot) << 8) | (op))
+
+/* Per-connection state of the completion loop */
+typedef struct {
+    int fd;               /* connected socket, -1 if the slot is free */
+    int rcnt;             /* request bytes in buf */
+    char *buf;            /* registered buffer: request, then response headers */
+    FileEntry *entry;     /* file cache reference held while sending */
+    struct iovec iov[2];  /* unsent headers and cached body */
+    struct msghdr msg;
+    size_t nbytes;        /* response size, headers included */
+    int filefd;           /* uncached file being spliced, or -1 */
+    int pipefd[2];
+    off_t in_off;         /* file bytes spliced into the pipe */
+    off_t out_off;        /* file bytes spliced out to the socket */
+    off_t filesize;
+    int splice_err;
+} uconn_t;
+
+static uconn_t *uconns;
+static int *ufree, nufree;  /* stack of free connection slots */
+static unsigned long ureqs; /* requests completed in io_uring mode */
+
+/*
+ * uconn_close - release everything held by a connection and queue
+ *     the close of its socket
+ */
+static void uconn_close(uring_t *ring, int slot)
+{
+    uconn_t *c = &uconns[slot];
+
+    if (c->entry) {
+	fc_put(fileCache, c->entry);
+	c->entry = NULL;
+    }
+    if (c->filefd >= 0) {
+	Close(c->filefd);
+	Close(c->pipefd[0]);
+	Close(c->pipefd[1]);
+	c->filefd = -1;
+    }
+    uring_close(ring, c->fd, UT_TAG(slot, UT_CLOSE));
+    c->fd = -1;
+    ufree[nufree++] = slot;
+}
+
+/*
+ * uconn_splice - queue the next file->pipe->socket splice pair, or just
+ *     drain the pipe if the socket took less than the last pair moved
+ */
+static void uconn_splice(uring_t *ring, int slot)
+{
+    uconn_t *c = &uconns[slot];
+    unsigned len;
+
+    if (c->out_off < c->in_off) {
+	uring_splice(ring, c->pipefd[0], -1, c->fd, c->in_off - c->out_off, 
+		     0, UT_TAG(slot, UT_SPLICE_OUT));
+	return;
+    }
+    len = c->filesize - c->in_off;
+    if (len > UC_SPLICE_CHUNK)
+	len = UC_SPLICE_CHUNK;
+    uring_splice(ring, c->filefd, c->in_off, c->pipefd[1], len, 
+		 1, UT_TAG(slot, UT_SPLICE_IN));
+    uring_splice(ring, c->pipefd[0], -1, c->fd, len, 
+		 0, UT_TAG(slot, UT_SPLICE_OUT));
+}
+
+/*
+ * uconn_done - account for a fully sent response and close the connection
+ */
+static void uconn_done(uring_t *ring, int slot)
+{
+    bytes_sent += uconns[slot].nbytes;
+    if (++ureqs % 1000 == 0) {
+	printf("io_uring: %lu requests, %lu io_uring_enter calls, "
+	       "%lu bytes sent\n", ureqs, ring->enters, bytes_sent);
+	fflush(stdout);
+    }
+    uconn_close(ring, slot);
+}
+
+/*
+ * uconn_doit - handle a complete request sitting in the connection buffer
+ */
+static void uconn_doit(uring_t *ring, int slot)
+{
+    uconn_t *c = &uconns[slot];
+    int is_static, gzip_ok = 0;
+    struct stat sbuf;
+    char method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+    char filename[MAXLINE], cgiargs[MAXLINE], *line, *body;
+    size_t hdrsize, bodysize;
+
+    sscanf(c->buf, "%s %s %s", method, uri, version);
+    if (strcasecmp(method, "GET")) {
+        clienterror(c->fd, method, "501", "Not Implemented",
+                    "Tiny does not implement this method");
+	uconn_close(ring, slot);
+	return;
+    }
+    for (line = strstr(c->buf, "\r\n"); line; line = strstr(line, "\r\n")) {
+	line += 2;
+	if (!strncasecmp(line, "Accept-Encoding:", 16)) {
+	    gzip_ok = accepts_gzip(line + 16);
+	    break;
+	}
+    }
+
+    if ((is_static = route_request(c->fd, uri, filename, cgiargs, &sbuf)) <= 0) {
+	if (is_static == 0)
+	    serve_dynamic(c->fd, filename, cgiargs);
+	uconn_close(ring, slot);
+	return;
+    }
+
+    /* The request is parsed, reuse its buffer for the response headers */
+    hdrsize = static_response(filename, &sbuf, gzip_ok, c->buf, &body, 
+			      &bodysize, &c->entry);
+    c->iov[0].iov_base = c->buf;
+    c->iov[0].iov_len = hdrsize;
+    c->iov[1].iov_base = body;
+    c->iov[1].iov_len = body ? bodysize : 0;
+    memset(&c->msg, 0, sizeof(c->msg));
+    c->msg.msg_iov = c->iov;
+    c->msg.msg_iovlen = 2;
+    c->nbytes = hdrsize + bodysize;
+    if (body == NULL) { /* Not cached, splice it from disk after the headers */
+	if ((c->filefd = open(filename, O_RDONLY)) < 0) {
+	    uconn_close(ring, slot);
+	    return;
+	}
+	if (pipe(c->pipefd) < 0) {
+	    Close(c->filefd);
+	    c->filefd = -1;
+	    uconn_close(ring, slot);
+	    return;
+	}
+	c->filesize = bodysize;
+	c->in_off = c->out_off = 0;
+	c->splice_err = 0;
+    }
+    uring_sendmsg(ring, c->fd, &c->msg, UT_TAG(slot, UT_SEND));
+}
+
+/*
+ * uring_serve - run the io_uring completion loop on listenfd. Returns
+ *     only if the buffers can't be registered with the ring.
+ */
+void uring_serve(uring_t *ring, int listenfd)
+{
+    int i, slot, res;
+    uint64_t tag;
+    uconn_t *c;
+    char *bufs;
+    struct iovec *iov;
+
+    uconns = Calloc(UC_MAX_CONNS, sizeof(*uconns));
+    ufree = Malloc(UC_MAX_CONNS * sizeof(*ufree));
+    bufs = Malloc((size_t)UC_MAX_CONNS * MAXLINE);
+    iov = Malloc(UC_MAX_CONNS * sizeof(*iov));
+    for (i = 0; i < UC_MAX_CONNS; i++) {
+	uconns[i].fd = -1;
+	uconns[i].filefd = -1;
+	uconns[i].buf = bufs + (size_t)i * MAXLINE;
+	iov[i].iov_base = uconns[i].buf;
+	iov[i].iov_len = MAXLINE;
+	ufree[i] = UC_MAX_CONNS - 1 - i;
+    }
+    nufree = UC_MAX_CONNS;
+    if (uring_register_buffers(ring, iov, UC_MAX_CONNS) < 0) {
+	uring_free(ring);
+	Free(iov);
+	Free(bufs);
+	Free(ufree);
+	Free(uconns);
+	return;
+    }
+    Free(iov);
+    printf("Serving with io_uring\n");
+
+    uring_accept(ring, listenfd, NULL, NULL, UT_TAG(0, UT_ACCEPT));
+    while (1) {
+	if (uring_submit_and_wait(ring, 1) < 0)
+	    unix_error("uring_serve: io_uring_enter error");
+	while (uring_next_cqe(ring, &tag, &res)) {
+	    slot = tag >> 8;
+	    c = &uconns[slot];
+	    switch (tag & 0xff) {
+	    case UT_ACCEPT:
+		uring_accept(ring, listenfd, NULL, NULL, UT_TAG(0, UT_ACCEPT));
+		if (res < 0)
+		    break;
+		if (nufree == 0) { /* Out of slots, serve it the blocking way */
+		    doit(res);
+		    Close(res);
+		    break;
+		}
+		slot = ufree[--nufree];
+		c = &uconns[slot];
+		c->fd = res;
+		c->rcnt = 0;
+		uring_read_fixed(ring, c->fd, c->buf, MAXLINE - 1, slot, 
+				 UT_TAG(slot, UT_RECV));
+		break;
+
+	    case UT_RECV:
+		if (res <= 0) {
+		    uconn_close(ring, slot);
+		    break;
+		}
+		c->rcnt += res;
+		c->buf[c->rcnt] = '\0';
+		if (strstr(c->buf, "\r\n\r\n"))
+		    uconn_doit(ring, slot);
+		else if (c->rcnt < MAXLINE - 1)
+		    uring_read_fixed(ring, c->fd, c->buf + c->rcnt, 
+				     MAXLINE - 1 - c->rcnt, slot, 
+				     UT_TAG(slot, UT_RECV));
+		else  /* Headers don't fit in the buffer */
+		    uconn_close(ring, slot);
+		break;
+
+	    case UT_SEND:
+		if (res < 0) {
+		    uconn_close(ring, slot);
+		    break;
+		}
+		/* Advance past what was sent, resend the rest */
+		for (i = 0; i < 2 && res > 0; i++) {
+		    if (res >= c->iov[i].iov_len) {
+			res -= c->iov[i].iov_len;
+			c->iov[i].iov_len = 0;
+		    }
+		    else {
+			c->iov[i].iov_base = (char *)c->iov[i].iov_base + res;
+			c->iov[i].iov_len -= res;
+			res = 0;
+		    }
+		}
+		if (c->iov[0].iov_len + c->iov[1].iov_len > 0)
+		    uring_sendmsg(ring, c->fd, &c->msg, UT_TAG(slot, UT_SEND));
+		else if (c->filefd >= 0)
+		    uconn_splice(ring, slot);
+		else
+		    uconn_done(ring, slot);
+		break;
+
+	    case UT_SPLICE_IN:
+		if (res <= 0)
+		    c->splice_err = 1; /* its linked SPLICE_OUT gets cancelled */
+		else
+		    c->in_off += res;
+		break;
+
+	    case UT_SPLICE_OUT:
+		if (res == -ECANCELED && !c->splice_err)
+		    res = 0;  /* short SPLICE_IN broke the link, drain the pipe */
+		if (res < 0 || c->splice_err) {
+		    uconn_close(ring, slot);
+		    break;
+		}
+		c->out_off += res;
+		if (c->out_off < c->filesize)
+		    uconn_splice(ring, slot);
+		else
+		    uconn_done(ring, slot);
+		break;
+
+	    case UT_CLOSE:
+		break;
+	    }
+	}
+    }
+}
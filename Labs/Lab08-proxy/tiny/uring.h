@@ -0,0 +1,61 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/*
+ * uring - a minimal io_uring wrapper on top of the raw syscalls, so the
+ * servers need no liburing. Requests are queued into the submission ring
+ * by the uring_<op>() functions and handed to the kernel in one batch by
+ * uring_submit_and_wait(); completions are popped with uring_next_cqe().
+ * Every request carries a caller-chosen 64-bit tag that comes back with
+ * its completion.
+ */
+typedef struct {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_khead;        // shared with the kernel
+    unsigned *sq_ktail;
+    unsigned *sq_kmask;
+    unsigned *sq_array;
+    void *sqes;                // struct io_uring_sqe[sq_entries]
+    unsigned sqe_head;         // sqes handed to the kernel so far
+    unsigned sqe_tail;         // sqes queued so far
+    unsigned *cq_khead;
+    unsigned *cq_ktail;
+    unsigned *cq_kmask;
+    void *cqes;                // struct io_uring_cqe[]
+    void *sq_ptr, *cq_ptr;     // mmap'd rings
+    size_t sq_sz, cq_sz, sqes_sz;
+    unsigned long enters;      // io_uring_enter() calls, for benchmarking
+} uring_t;
+
+// create a ring, returns -1 with errno set if io_uring is unavailable
+int uring_init(uring_t *ring, unsigned entries);
+
+// tear the ring down
+void uring_free(uring_t *ring);
+
+// register n buffers for uring_read_fixed()/uring_write_fixed()
+int uring_register_buffers(uring_t *ring, struct iovec *iov, unsigned n);
+
+// queue requests; if a splice has link set, the request queued right
+// after it starts only once the splice moved all len bytes
+void uring_accept(uring_t *ring, int fd, struct sockaddr *addr, socklen_t *addrlen, uint64_t tag);
+void uring_read_fixed(uring_t *ring, int fd, void *buf, unsigned len, int bufidx, uint64_t tag);
+void uring_write_fixed(uring_t *ring, int fd, void *buf, unsigned len, int bufidx, uint64_t tag);
+void uring_send(uring_t *ring, int fd, void *buf, unsigned len, uint64_t tag);
+void uring_sendmsg(uring_t *ring, int fd, struct msghdr *msg, uint64_t tag);
+void uring_splice(uring_t *ring, int fd_in, int64_t off_in, int fd_out, unsigned len,
+                  int link, uint64_t tag);
+void uring_close(uring_t *ring, int fd, uint64_t tag);
+
+// submit every queued request and wait for at least wait_nr completions
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr);
+
+// pop one completion; returns 0 if the completion ring is empty
+int uring_next_cqe(uring_t *ring, uint64_t *tag, int *res);
+
+#endif /* __URING_H__ */
@@ -0,0 +1,220 @@
+#include "csapp.h"
+#include "uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring_t *ring, unsigned entries) {
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    if ((ring->ring_fd = sys_io_uring_setup(entries, &p)) < 0) {
+        return -1;
+    }
+
+    // map the submission ring, the completion ring and the sqe array
+    ring->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_sz = ring->cq_sz = (ring->sq_sz > ring->cq_sz) ? ring->sq_sz : ring->cq_sz;
+    }
+    ring->sq_ptr = mmap(0, ring->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        close(ring->ring_fd);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(0, ring->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_sz);
+            close(ring->ring_fd);
+            return -1;
+        }
+    }
+    ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(0, ring->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ptr != ring->sq_ptr) {
+            munmap(ring->cq_ptr, ring->cq_sz);
+        }
+        munmap(ring->sq_ptr, ring->sq_sz);
+        close(ring->ring_fd);
+        return -1;
+    }
+
+    sq = ring->sq_ptr;
+    cq = ring->cq_ptr;
+    ring->sq_entries = p.sq_entries;
+    ring->sq_khead = (unsigned *) (sq + p.sq_off.head);
+    ring->sq_ktail = (unsigned *) (sq + p.sq_off.tail);
+    ring->sq_kmask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+    ring->cq_khead = (unsigned *) (cq + p.cq_off.head);
+    ring->cq_ktail = (unsigned *) (cq + p.cq_off.tail);
+    ring->cq_kmask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring->cqes = cq + p.cq_off.cqes;
+    return 0;
+}
+
+void uring_free(uring_t *ring) {
+    munmap(ring->sqes, ring->sqes_sz);
+    if (ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_sz);
+    }
+    munmap(ring->sq_ptr, ring->sq_sz);
+    close(ring->ring_fd);
+}
+
+int uring_register_buffers(uring_t *ring, struct iovec *iov, unsigned n) {
+    return sys_io_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iov, n);
+}
+
+// publish queued sqes to the kernel's submission ring, return how many are pending
+static unsigned uring_flush(uring_t *ring) {
+    unsigned mask = *ring->sq_kmask;
+    unsigned ktail = *ring->sq_ktail;
+
+    while (ring->sqe_head != ring->sqe_tail) {
+        ring->sq_array[ktail & mask] = ring->sqe_head & mask;
+        ktail++;
+        ring->sqe_head++;
+    }
+    __atomic_store_n(ring->sq_ktail, ktail, __ATOMIC_RELEASE);
+    return ktail - __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE);
+}
+
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr) {
+    unsigned submit = uring_flush(ring);
+    int rc;
+
+    ring->enters++;
+    while ((rc = sys_io_uring_enter(ring->ring_fd, submit, wait_nr,
+                                    wait_nr ? IORING_ENTER_GETEVENTS : 0)) < 0 && errno == EINTR) {
+        ;
+    }
+    return rc;
+}
+
+// get a zeroed sqe, submitting queued ones first if the ring is full
+static struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+    struct io_uring_sqe *sqe;
+
+    while (ring->sqe_tail - __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        if (uring_submit_and_wait(ring, 0) < 0) {
+            unix_error("uring_get_sqe: io_uring_enter error");
+        }
+    }
+    sqe = (struct io_uring_sqe *) ring->sqes + (ring->sqe_tail & *ring->sq_kmask);
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static struct io_uring_sqe *uring_prep(uring_t *ring, int op, int fd, void *addr,
+                                       unsigned len, uint64_t off, uint64_t tag) {
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = tag;
+    return sqe;
+}
+
+void uring_accept(uring_t *ring, int fd, struct sockaddr *addr, socklen_t *addrlen, uint64_t tag) {
+    uring_prep(ring, IORING_OP_ACCEPT, fd, addr, 0, (uint64_t) (uintptr_t) addrlen, tag);
+}
+
+void uring_read_fixed(uring_t *ring, int fd, void *buf, unsigned len, int bufidx, uint64_t tag) {
+    uring_prep(ring, IORING_OP_READ_FIXED, fd, buf, len, 0, tag)->buf_index = bufidx;
+}
+
+void uring_write_fixed(uring_t *ring, int fd, void *buf, unsigned len, int bufidx, uint64_t tag) {
+    uring_prep(ring, IORING_OP_WRITE_FIXED, fd, buf, len, 0, tag)->buf_index = bufidx;
+}
+
+void uring_send(uring_t *ring, int fd, void *buf, unsigned len, uint64_t tag) {
+    uring_prep(ring, IORING_OP_SEND, fd, buf, len, 0, tag);
+}
+
+void uring_sendmsg(uring_t *ring, int fd, struct msghdr *msg, uint64_t tag) {
+    uring_prep(ring, IORING_OP_SENDMSG, fd, msg, 1, 0, tag);
+}
+
+void uring_splice(uring_t *ring, int fd_in, int64_t off_in, int fd_out, unsigned len,
+                  int link, uint64_t tag) {
+    // off_in of -1 means fd_in is a pipe or socket without an offset; fd_out never has one
+    struct io_uring_sqe *sqe = uring_prep(ring, IORING_OP_SPLICE, fd_out, NULL, len,
+                                          (uint64_t) -1, tag);
+    sqe->splice_fd_in = fd_in;
+    sqe->splice_off_in = (uint64_t) off_in;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+}
+
+void uring_close(uring_t *ring, int fd, uint64_t tag) {
+    uring_prep(ring, IORING_OP_CLOSE, fd, NULL, 0, 0, tag);
+}
+
+int uring_next_cqe(uring_t *ring, uint64_t *tag, int *res) {
+    unsigned head = *ring->cq_khead;
+    struct io_uring_cqe *cqe;
+
+    if (head == __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    cqe = (struct io_uring_cqe *) ring->cqes + (head & *ring->cq_kmask);
+    *tag = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_khead, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#else /* !HAVE_IO_URING */
+
+/* No io_uring on this platform: uring_init() fails and callers fall back */
+int uring_init(uring_t *ring, unsigned entries) {
+    errno = ENOSYS;
+    return -1;
+}
+
+void uring_free(uring_t *ring) {}
+int uring_register_buffers(uring_t *ring, struct iovec *iov, unsigned n) { errno = ENOSYS; return -1; }
+void uring_accept(uring_t *ring, int fd, struct sockaddr *addr, socklen_t *addrlen, uint64_t tag) {}
+void uring_read_fixed(uring_t *ring, int fd, void *buf, unsigned len, int bufidx, uint64_t tag) {}
+void uring_write_fixed(uring_t *ring, int fd, void *buf, unsigned len, int bufidx, uint64_t tag) {}
+void uring_send(uring_t *ring, int fd, void *buf, unsigned len, uint64_t tag) {}
+void uring_sendmsg(uring_t *ring, int fd, struct msghdr *msg, uint64_t tag) {}
+void uring_splice(uring_t *ring, int fd_in, int64_t off_in, int fd_out, unsigned len,
+                  int link, uint64_t tag) {}
+void uring_close(uring_t *ring, int fd, uint64_t tag) {}
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr) { errno = ENOSYS; return -1; }
+int uring_next_cqe(uring_t *ring, uint64_t *tag, int *res) { return 0; }
+
+#endif /* HAVE_IO_URING */